@@ -0,0 +1,97 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "app.h"
+#include "dwi/tractography/file.h"
+#include "dwi/tractography/compact.h"
+
+using namespace MR; 
+using namespace MR::DWI; 
+
+SET_VERSION_DEFAULT;
+
+DESCRIPTION = {
+  "convert a tracks file to or from the compact track format.",
+  "In the compact format, the first point of each track is stored in full, and each subsequent point "
+    "as its displacement from the previous point, quantised to a fixed grid. Each point is guaranteed "
+    "to lie within the specified tolerance of its original position. All track commands can read "
+    "files in either format.",
+  NULL
+};
+
+ARGUMENTS = {
+  Argument ("input", "input tracks", "the input tracks file.").type_file (),
+  Argument ("output", "output tracks", "the output tracks file.").type_file (),
+  Argument::End
+};
+
+
+OPTIONS = { 
+  Option ("tolerance", "tolerance", 
+      "the maximum distance (in mm) between each point and its original position (default is 0.01 mm).")
+    .append (Argument ("value", "value", "the tolerance in mm.").type_float (1e-6, 10.0, 0.01)),
+
+  Option ("expand", "expand", 
+      "write the output in the standard (floating-point) tracks format instead."),
+
+  Option::End 
+};
+
+
+
+EXECUTE {
+  Tractography::Properties properties;
+  Tractography::Reader file;
+  file.open (argument[0].get_string(), properties);
+  guint total_count = to<guint> (properties["total_count"]);
+
+  float tolerance = 0.01;
+  std::vector<OptBase> opt = get_options (0); // tolerance
+  if (opt.size()) tolerance = opt[0][0].get_float();
+
+  bool expand = get_options (1).size(); // expand
+
+  Tractography::Writer writer;
+  Tractography::CompactWriter compact_writer;
+  if (expand) writer.create (argument[1].get_string(), properties);
+  else compact_writer.create (argument[1].get_string(), properties, tolerance);
+
+  std::vector<Point> tck;
+  ProgressBar::init (0, expand ? "expanding tracks..." : "compacting tracks...");
+
+  while (file.next (tck)) {
+    if (expand) writer.append (tck);
+    else compact_writer.append (tck);
+    ProgressBar::inc();
+  }
+
+  ProgressBar::done();
+  file.close();
+
+  if (expand) {
+    writer.total_count = MAX (total_count, writer.count);
+    writer.close();
+  }
+  else {
+    compact_writer.total_count = MAX (total_count, compact_writer.count);
+    compact_writer.close();
+  }
+}
+
@@ -44,11 +44,10 @@
 
 #include "app.h"
 #include "ptr.h"
-#include "file/config.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 #include "math/linalg.h"
 #include "dwi/gradient.h"
-#include "dwi/sdeconv/constrained.h"
+#include "dwi/sdeconv/batch.h"
 
 using namespace std; 
 using namespace MR; 
@@ -113,6 +112,8 @@ OPTIONS = {
   Option ("niter", "maximum number of iterations", "the maximum number of iterations to perform for each voxel (default = 50).")
     .append (Argument ("number", "number", "the maximum number of iterations to use.").type_integer (1, 1000, 50)),
 
+  Option ("warm", "warm start", "initialise each voxel using the set of negative directions found for the previous voxel processed by the same thread (i.e. its neighbour along the x axis, except at the start of each row), rather than from the linear deconvolution. Voxels are then deconvolved one at a time rather than in batches. The histogram of the number of iterations required is reported when running with -info."),
+
   Option::End 
 };
 
@@ -121,86 +122,175 @@ OPTIONS = {
 
 
 
-class Thread 
+// Iteration counts are accumulated per thread, and merged into this
+// instance as each thread's Processor is destroyed:
+class IterationCounts
 {
   public:
-    Thread (const DWI::SH::CSDeconv::Common& sdeconv_common, Image::Position& dwi_position, Image::Position* mask_position, Image::Object& SH_object, 
-        const std::vector<int>& vec_bzeros, const std::vector<int>& vec_dwis, bool normalise_to_b0) : 
-      common (sdeconv_common),
-      dwi (dwi_position), 
-      mask (mask_position), 
-      SH_obj (SH_object), 
+    IterationCounts (int max_iterations) : counts (max_iterations+1, 0), failed (0) { }
+
+    void add (const std::vector<guint>& thread_counts, guint thread_failed) 
+    {
+      Glib::Mutex::Lock lock (mutex);
+      for (guint n = 0; n < counts.size(); n++) 
+        counts[n] += thread_counts[n];
+      failed += thread_failed;
+    }
+
+    void report () const
+    {
+      guint total = failed;
+      double mean = 0.0;
+      for (guint n = 0; n < counts.size(); n++) {
+        total += counts[n];
+        mean += n * counts[n];
+      }
+      if (total > failed) mean /= total - failed;
+
+      info ("iteration count histogram (" + str(total) + " voxels, mean " + str(mean) + " iterations):");
+      for (guint n = 1; n < counts.size(); n++) 
+        if (counts[n]) 
+          info ("  " + str(n) + ": " + str(counts[n]));
+      if (failed) 
+        info ("  did not converge: " + str(failed));
+    }
+
+  private:
+    Glib::Mutex mutex;
+    std::vector<guint> counts;
+    guint failed;
+};
+
+
+
+
+// Each thread works through whole rows of voxels claimed via
+// Image::threaded_row_loop(), reading the DW signals through its own
+// positions; the output rows are disjoint, so no locking is required. The
+// voxels within the mask for each row are deconvolved together as a batch.
+// With -warm, each voxel needs to be seeded from the solution of the voxel
+// processed just before it, so the voxels are instead deconvolved one at a
+// time through the first slot of the batch. The first voxel of each row is
+// then seeded from the last voxel of the previous row processed by this
+// thread, which is not necessarily adjacent.
+class Processor 
+{
+  public:
+    Processor (const DWI::SH::CSDeconv::Common& sdeconv_common, Image::Object& dwi_object, Image::Object* mask_object,
+        const std::vector<int>& vec_bzeros, const std::vector<int>& vec_dwis, bool normalise_to_b0, int max_iterations, 
+        bool warm_start, IterationCounts& iteration_counts) : 
+      dwi (dwi_object), 
+      sdeconv (sdeconv_common, dwi.dim(0)),
+      row (dwi.dim(0)),
+      mask (mask_object ? new Image::Position (*mask_object) : NULL), 
       bzeros (vec_bzeros),
       dwis (vec_dwis),
       normalise (normalise_to_b0),
-      done (false) { 
-        dwi.set (0,-1);
-        if (mask) mask->set (0,-1);
+      niter (max_iterations),
+      warm (warm_start),
+      total_counts (iteration_counts),
+      sigs (dwis.size()),
+      counts (niter+1, 0),
+      failed (0) { }
+
+    Processor (const Processor& P) : 
+      dwi (P.dwi), 
+      sdeconv (P.sdeconv),
+      row (P.row.size()),
+      mask (P.mask ? new Image::Position (*P.mask) : NULL), 
+      bzeros (P.bzeros),
+      dwis (P.dwis),
+      normalise (P.normalise),
+      niter (P.niter),
+      warm (P.warm),
+      total_counts (P.total_counts),
+      sigs (P.sigs),
+      counts (niter+1, 0),
+      failed (0) { }
+
+    ~Processor () { total_counts.add (counts, failed); }
+
+    void operator() (Image::Position& SH)
+    {
+      dwi.set (1, SH[1]);
+      dwi.set (2, SH[2]);
+      if (mask) {
+        mask->set (1, SH[1]);
+        mask->set (2, SH[2]);
       }
 
-    ~Thread () { }
+      guint num = 0;
+      for (dwi.set(0,0); dwi[0] < dwi.dim(0); dwi.inc(0)) {
+        if (mask) {
+          mask->set (0, dwi[0]);
+          if (mask->value() < 0.5) continue;
+        }
+
+        get_data();
+        if (warm) {
+          sdeconv.set (0, sigs, true);
+          sdeconv.run (1, niter);
+          store (SH, 0, dwi[0]);
+        }
+        else {
+          sdeconv.set (num, sigs);
+          row[num++] = dwi[0];
+        }
+      }
 
-    void execute ();
+      if (warm) return;
 
-    int niter;
+      sdeconv.run (num, niter);
+      for (guint n = 0; n < num; n++) 
+        store (SH, n, row[n]);
+    }
 
   protected:
-    Glib::Mutex       mutex;
-    const DWI::SH::CSDeconv::Common& common;
-    Image::Position&  dwi;
-    Image::Position*  mask;
-    Image::Object&    SH_obj;
+    Image::Position   dwi;
+    DWI::SH::CSDeconvBatch sdeconv;
+    std::vector<int>  row;
+    Ptr<Image::Position> mask;
     const std::vector<int>&  bzeros;
     const std::vector<int>&  dwis;
-    bool              normalise, done;
+    const bool        normalise;
+    const int         niter;
+    const bool        warm;
+    IterationCounts&  total_counts;
+    Math::Vector      sigs;
+    std::vector<guint> counts;
+    guint             failed;
+
+    void store (Image::Position& SH, guint slot, int x)
+    {
+      if (sdeconv.iterations (slot)) counts[sdeconv.iterations (slot)]++;
+      else {
+        error ("failed to converge");
+        failed++;
+      }
 
-    bool get_data (Math::Vector& sigs, Image::Position& SH)
+      SH.set (0, x);
+      for (SH.set(3,0); SH[3] < SH.dim(3); SH.inc(3))
+        SH.value (sdeconv.FOD(slot)[SH[3]]);
+    }
+
+    void get_data ()
     {
-      Glib::Mutex::Lock lock (mutex);
-      if (done) return (true);
-      do {
-        ProgressBar::inc();
-        dwi.inc(0); if (mask) mask->inc(0);
-        if (dwi[0] >= dwi.dim(0)) {
-          dwi.set(0,0); dwi.inc(1); 
-          if (mask) { mask->set(0,0); mask->inc(1); }
-          if (dwi[1] >= dwi.dim(1)) {
-            dwi.set(1,0); dwi.inc(2); 
-            if (mask) { mask->set(1,0); mask->inc(2); }
-            if (dwi[2] >= dwi.dim(2)) {
-              done = true;
-              return (true);
-            }
-          }
+      double norm = 0.0;
+      if (normalise) {
+        for (guint n = 0; n < bzeros.size(); n++) {
+          dwi.set(3, bzeros[n]);
+          norm += dwi.value ();
         }
+        norm /= bzeros.size();
+      }
 
-        bool proceed = true;
-        if (mask) if (mask->value() < 0.5) proceed = false;
-
-        if (proceed) {
-          double norm = 0.0;
-          if (normalise) {
-            for (guint n = 0; n < bzeros.size(); n++) {
-              dwi.set(3, bzeros[n]);
-              norm += dwi.value ();
-            }
-            norm /= bzeros.size();
-          }
-
-          for (guint n = 0; n < dwis.size(); n++) {
-            dwi.set(3, dwis[n]);
-            sigs[n] = dwi.value(); 
-            if (gsl_isnan (sigs[n])) break; 
-            if (sigs[n] < 0.0) sigs[n] = 0.0;
-            if (normalise) sigs[n] /= norm;
-          }
-
-          SH.set(0, dwi[0]);
-          SH.set(1, dwi[1]);
-          SH.set(2, dwi[2]);
-          return (false);
-        }
-      } while (true);
+      for (guint n = 0; n < dwis.size(); n++) {
+        dwi.set(3, dwis[n]);
+        sigs[n] = dwi.value(); 
+        if (gsl_isnan (sigs[n])) break; 
+        if (sigs[n] < 0.0) sigs[n] = 0.0;
+        if (normalise) sigs[n] /= norm;
+      }
     }
 
 };
@@ -209,38 +299,15 @@ class Thread
 
 
 
-void Thread::execute () 
-{
-  Math::Vector sigs (dwis.size());
-  DWI::SH::CSDeconv sdeconv (common);
-  Image::Position SH (SH_obj);
-
-  do {
-    if (get_data (sigs, SH)) return;
-
-    sdeconv.set (sigs);
-
-    int n;
-    for (n = 0; n < niter; n++) 
-      if (sdeconv.iterate()) break;
-    if (n == niter) error ("failed to converge");
-
-    for (SH.set(3,0); SH[3] < SH.dim(3); SH.inc(3))
-      SH.value (sdeconv.FOD()[SH[3]]);
-
-  } while (true);
-}
-
-
-
-
-
 
 
 
 
 EXECUTE {
+  if (!Glib::thread_supported()) Glib::thread_init();
+
   Image::Object &dwi_obj (*argument[0].get_image());
+  dwi_obj.optimise_voxel_major();
   Image::Header header (dwi_obj);
 
   if (header.ndim() != 4) 
@@ -614,12 +681,9 @@ EXECUTE {
   header.axes.axis[2] = 3; header.axes.forward[2] = true;
   header.axes.axis[3] = 0; header.axes.forward[3] = true;
 
-  Image::Position dwi (dwi_obj);
-
   opt = get_options (2);
-  Ptr<Image::Position> mask;
-  if (opt.size()) 
-    mask = new Image::Position (*opt[0][0].get_image());
+  RefPtr<Image::Object> mask_obj;
+  if (opt.size()) mask_obj = opt[0][0].get_image();
 
 
   bool normalise = get_options(5).size();
@@ -641,30 +705,12 @@ EXECUTE {
   sdeconv_common.lambda = lambda;
   sdeconv_common.threshold = threshold;
 
-  Image::Object& SH_obj (*argument[2].get_image (header));
-  SH_obj.map();
-
-  Glib::thread_init();
-  Thread threader (sdeconv_common, dwi, mask.get(), SH_obj, bzeros, dwis, normalise);
-  threader.niter = niter;
-
-
-  int num_threads = File::Config::get_int ("NumberOfThreads", 1); 
-  info ("launching " + str (num_threads) + " threads");
-
-  ProgressBar::init (dwi.dim(0)*dwi.dim(1)*dwi.dim(2), "performing constrained spherical deconvolution...");
-  Glib::Thread* threads[num_threads-1];
-  for (int n = 0; n < num_threads-1; n++) 
-    threads[n] = Glib::Thread::create (sigc::mem_fun (threader, &Thread::execute), true);
+  Image::Position SH (*argument[2].get_image (header));
 
-  threader.execute();
-
-  for (int n = 0; n < num_threads-1; n++) 
-    threads[n]->join();
-
-  ProgressBar::done();
+  IterationCounts iteration_counts (niter);
+  {
+    Processor processor (sdeconv_common, dwi_obj, mask_obj.get(), bzeros, dwis, normalise, niter, get_options(9).size(), iteration_counts);
+    Image::threaded_row_loop (SH, processor, "performing constrained spherical deconvolution...", 3);
+  }
+  iteration_counts.report();
 }
-
-
-
-
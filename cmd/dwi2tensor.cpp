@@ -28,7 +28,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 #include "math/matrix.h"
 #include "math/linalg.h"
 #include "dwi/gradient.h"
@@ -61,12 +61,132 @@ OPTIONS = {
   Option ("ignorevolumes", "ignore image volumes", "ignore the image volumes specified when computing the tensor.", false, true)
     .append (Argument ("volumes", "volume numbers", "the volumes to be ignored").type_sequence_int ()),
 
+  Option ("wls", "weighted least-squares fit", "use a weighted least-squares fit, with each log-signal weighted by its squared signal intensity, instead of the default ordinary least-squares fit."),
+
   Option::End
 };
 
 
+namespace {
+
+  // solve A x = b in place for a symmetric positive-definite 7x7 system,
+  // using only the lower triangle of A. Returns false if A is not positive
+  // definite.
+  inline bool cholesky_solve (double A[7][7], double b[7])
+  {
+    for (int j = 0; j < 7; j++) {
+      double s = A[j][j];
+      for (int k = 0; k < j; k++) s -= A[j][k]*A[j][k];
+      if (s <= 0.0) return (false);
+      A[j][j] = sqrt (s);
+      for (int i = j+1; i < 7; i++) {
+        double t = A[i][j];
+        for (int k = 0; k < j; k++) t -= A[i][k]*A[j][k];
+        A[i][j] = t / A[j][j];
+      }
+    }
+
+    for (int i = 0; i < 7; i++) {
+      double t = b[i];
+      for (int k = 0; k < i; k++) t -= A[i][k]*b[k];
+      b[i] = t / A[i][i];
+    }
+
+    for (int i = 6; i >= 0; i--) {
+      double t = b[i];
+      for (int k = i+1; k < 7; k++) t -= A[k][i]*b[k];
+      b[i] = t / A[i][i];
+    }
+
+    return (true);
+  }
+
+}
+
+
+
+// Fits a whole row of voxels at a time: the log-signals for the row are
+// gathered into a (volumes x voxels) matrix, and the ordinary least-squares
+// estimates obtained with a single matrix-matrix product with the
+// pseudo-inverse of the b-matrix for that slice. If requested, these are
+// then replaced by per-voxel weighted least-squares estimates.
+class FitTensor {
+  public:
+    FitTensor (Image::Object& dwi_obj, int dw_axis, 
+        const std::vector<Math::Matrix>& bmatrices, const std::vector<Math::Matrix>& inverse_bmatrices, bool weighted) : 
+      dwi (dwi_obj), axis (dw_axis), bmat (bmatrices), binv (inverse_bmatrices), wls (weighted),
+      D (dwi.dim(axis), dwi.dim(0)) { 
+        if (wls) W.allocate (D.rows(), D.columns());
+      }
+
+    void operator() (Image::Position& dt)
+    {
+      const int z = dt[2];
+
+      dwi.set (1, dt[1]);
+      dwi.set (2, z);
+      for (dwi.set(0,0); dwi[0] < dwi.dim(0); dwi.inc(0)) {
+        for (dwi.set(axis,0); dwi[axis] < dwi.dim(axis); dwi.inc(axis)) {
+          double S = dwi.value();
+          D (dwi[axis], dwi[0]) = S > 0.0 ? -log (S) : 1e-12;
+          if (wls) W (dwi[axis], dwi[0]) = S > 0.0 ? S*S : 0.0;
+        }
+      }
+
+      T.multiply (binv[z], D);
+
+      if (wls) 
+        for (guint x = 0; x < D.columns(); x++) 
+          weighted_fit (bmat[z], x);
+
+      for (dt.set(0,0); dt[0] < dt.dim(0); dt.inc(0)) 
+        for (dt.set(3,0); dt[3] < dt.dim(3); dt.inc(3)) 
+          dt.value (T (dt[3], dt[0]));
+    }
+
+  private:
+    Image::Position dwi;
+    const int axis;
+    const std::vector<Math::Matrix>& bmat;
+    const std::vector<Math::Matrix>& binv;
+    const bool wls;
+    Math::Matrix D, W, T;
+
+    // replace the OLS estimate for voxel x with the WLS estimate, unless the
+    // weighted normal equations are singular:
+    void weighted_fit (const Math::Matrix& B, guint x)
+    {
+      double A[7][7], b[7];
+      for (int j = 0; j < 7; j++) {
+        b[j] = 0.0;
+        for (int k = 0; k <= j; k++) A[j][k] = 0.0;
+      }
+
+      for (guint i = 0; i < D.rows(); i++) {
+        const double w = W(i,x);
+        if (w == 0.0) continue;
+        const double y = D(i,x);
+        for (int j = 0; j < 7; j++) {
+          const double wb = w*B(i,j);
+          b[j] += wb*y;
+          for (int k = 0; k <= j; k++) 
+            A[j][k] += wb*B(i,k);
+        }
+      }
+
+      if (cholesky_solve (A, b)) 
+        for (int j = 0; j < 7; j++) 
+          T(j,x) = b[j];
+    }
+};
+
+
+
+
+
 EXECUTE {
   Image::Object &dwi_obj (*argument[0].get_image());
+  dwi_obj.optimise_voxel_major();
   Image::Header header (dwi_obj);
 
   if (header.ndim() < 4) 
@@ -124,44 +244,35 @@ EXECUTE {
   header.data_type = DataType::Float32;
   header.DW_scheme.reset();
 
-  Image::Position dwi (dwi_obj);
   Image::Position dt (*argument[1].get_image (header));
 
-  info ("converting base image \"" + dwi.name() + " to tensor image \"" + dt.name() + "\"");
+  info ("converting base image \"" + dwi_obj.name() + " to tensor image \"" + dt.name() + "\"");
 
-  ProgressBar::init (dwi.dim(0)*dwi.dim(1)*dwi.dim(2), "converting DW images to tensor image..."); 
-
-  float d[dwi.dim(axis)];
-  for (dwi.set(2,0), dt.set(2,0); dwi[2] < dwi.dim(2); dwi.inc(2), dt.inc(2)) {
+  // the pseudo-inverse only needs recomputing for slices with excluded
+  // volumes; all other slices share the same one:
+  std::vector<Math::Matrix> bmat_slice (dwi_obj.dim(2)), binv_slice (dwi_obj.dim(2));
+  for (int z = 0; z < dwi_obj.dim(2); z++) {
+    if (z && islc[z].empty() && islc[z-1].empty()) {
+      bmat_slice[z] = bmat_slice[z-1];
+      binv_slice[z] = binv_slice[z-1];
+      continue;
+    }
 
     grad.copy (bmat);
     for (guint i = 0; i < ivol.size(); i++)
       for (int j = 0; j < 7; j++)
         grad (ivol[i],j) = 0.0;
 
-    for (guint i = 0; i < islc[dt[2]].size(); i++)
+    for (guint i = 0; i < islc[z].size(); i++)
       for (int j = 0; j < 7; j++)
-        grad (islc[dt[2]][i],j) = 0.0;
+        grad (islc[z][i],j) = 0.0;
 
     pinverter.invert (binv, grad);
-
-    for (dwi.set(1,0), dt.set(1,0); dwi[1] < dwi.dim(1); dwi.inc(1), dt.inc(1)) {
-      for (dwi.set(0,0), dt.set(0,0); dwi[0] < dwi.dim(0); dwi.inc(0), dt.inc(0)) {
-        for (dwi.set(axis,0); dwi[axis] < dwi.dim(axis); dwi.inc(axis)) {
-          d[dwi[axis]] = dwi.value();
-          d[dwi[axis]] = d[dwi[axis]] > 0.0 ? -log (d[dwi[axis]]) : 1e-12;
-        }
-        for (dt.set(3,0); dt[3] < dt.dim(3); dt.inc(3)) {
-          float val = 0.0;
-          for (int i = 0; i < dwi.dim(axis); i++)
-            val += (float) (binv(dt[3], i)*d[i]);
-          dt.value (val);
-        }
-        ProgressBar::inc();
-      }
-    }
+    bmat_slice[z] = grad;
+    binv_slice[z] = binv;
   }
 
-  ProgressBar::done();
+  FitTensor fit (dwi_obj, axis, bmat_slice, binv_slice, get_options(3).size());
+  Image::threaded_row_loop (dt, fit, "converting DW images to tensor image...", 3);
 }
 
@@ -25,7 +25,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 #include "dwi/SH.h"
 
 #define DOT_THRESHOLD 0.99
@@ -76,6 +76,135 @@ class Direction {
     bool operator<(const Direction& d) const { return (a > d.a); }
 };
 
+class FindPeaks {
+  public:
+    FindPeaks (Image::Object& SH_obj, Image::Object* peaks_obj, const Math::Matrix& directions, 
+        const std::vector<Direction>& true_peak_directions, int num_peaks, float amplitude_threshold) :
+      SH (SH_obj), 
+      ipeaks (peaks_obj ? new Image::Position (*peaks_obj) : NULL), 
+      dirs (directions), 
+      true_peaks (true_peak_directions), 
+      npeaks (num_peaks), 
+      lmax (DWI::SH::LforN (SH.dim(3))),
+      threshold (amplitude_threshold), 
+      peaks_out (npeaks) { }
+
+    FindPeaks (const FindPeaks& F) : 
+      SH (F.SH), 
+      ipeaks (F.ipeaks ? new Image::Position (*F.ipeaks) : NULL), 
+      dirs (F.dirs), 
+      true_peaks (F.true_peaks), 
+      npeaks (F.npeaks), 
+      lmax (F.lmax),
+      threshold (F.threshold), 
+      peaks_out (npeaks) { }
+
+    void operator() (Image::Position& out)
+    {
+      float val[SH.dim(3)];
+      SH.set (0, out[0]);
+      SH.set (1, out[1]);
+      SH.set (2, out[2]);
+
+      bool skip = false;
+      if (ipeaks) {
+        ipeaks->set (0, out[0]);
+        ipeaks->set (1, out[1]);
+        ipeaks->set (2, out[2]);
+        if (gsl_isnan (ipeaks->value())) skip = true;
+      }
+      
+      if (!skip) {
+        float min = GSL_POSINF, max = GSL_NEGINF;
+        for (SH.set(3,0); SH[3] < SH.dim(3); SH.inc(3)) {
+          val[SH[3]] = SH.value();
+          if (gsl_isnan (val[SH[3]])) {
+            skip = true;
+            break;
+          }
+          if (val[SH[3]] < min) min = val[SH[3]];
+          if (val[SH[3]] > max) max = val[SH[3]];
+        }
+        if (min == max) skip = true;
+      }
+
+      if (skip) for (out.set(3,0); out[3] < out.dim(3); out.inc(3)) out.value (GSL_NAN);
+      else {
+        std::vector<Direction> all_peaks;
+        for (guint i = 0; i < dirs.rows(); i++) {
+          Direction p (dirs(i,0), dirs(i,1)); 
+          p.a = DWI::SH::get_peak (val, lmax, p.v, true);
+          
+          if (gsl_finite (p.a)) {
+            for (guint j = 0; j < all_peaks.size(); j++) {
+              if (fabs (p.v.dot (all_peaks[j].v)) > DOT_THRESHOLD) {
+                p.a = NAN;
+                break;
+              }
+            }
+          }
+          if (gsl_finite (p.a) && p.a >= threshold) all_peaks.push_back (p);
+        }
+        
+        if (ipeaks) {
+          for (int i = 0; i < npeaks; i++) {
+            Point p;
+            ipeaks->set(3, 3*i);
+            for (int n = 0; n < 3; n++) { p[n] = ipeaks->value(); ipeaks->inc(3); }
+            p.normalise();
+
+            float mdot = 0.0;
+            for (guint n = 0; n < all_peaks.size(); n++) {
+              float f = fabs (p.dot (all_peaks[n].v));
+              if (f > mdot) { 
+                mdot = f; 
+                peaks_out[i] = all_peaks[n];
+              }
+            }
+          }
+        }
+        else if (true_peaks.size()) {
+          for (int i = 0; i < npeaks; i++) {
+            float mdot = 0.0;
+            for (guint n = 0; n < all_peaks.size(); n++) {
+              float f = fabs (all_peaks[n].v.dot (true_peaks[i].v));
+              if (f > mdot) { 
+                mdot = f; 
+                peaks_out[i] = all_peaks[n];
+              }
+            }
+          }
+        }
+        else std::partial_sort_copy (all_peaks.begin(), all_peaks.end(), peaks_out.begin(), peaks_out.end());
+
+
+
+        
+        int actual_npeaks = MIN (npeaks, (int) all_peaks.size());
+        out.set (3, 0);
+        for (int n = 0; n < actual_npeaks; n++) {
+           out.value (peaks_out[n].a*peaks_out[n].v[0]); out.inc(3); 
+           out.value (peaks_out[n].a*peaks_out[n].v[1]); out.inc(3); 
+           out.value (peaks_out[n].a*peaks_out[n].v[2]); out.inc(3);
+        }
+        for (; out[3] < 3*npeaks; out.inc(3)) out.value (GSL_NAN);
+      }
+    }
+
+  private:
+    Image::Position SH;
+    Ptr<Image::Position> ipeaks;
+    const Math::Matrix& dirs;
+    const std::vector<Direction>& true_peaks;
+    const int npeaks, lmax;
+    const float threshold;
+    std::vector<Direction> peaks_out;
+};
+
+
+
+
+
 EXECUTE {
 
   // Load direction set:
@@ -100,130 +229,30 @@ EXECUTE {
   if (opt.size()) threshold = opt[0][0].get_float();
 
   Image::Object &SH_obj (*argument[0].get_image());
+  SH_obj.optimise_voxel_major();
   Image::Header header (SH_obj);
 
   header.data_type = DataType::Float32;
   header.axes.set_ndim (4);
 
-  Ptr<Image::Position> ipeaks;
+  Image::Object* peaks_obj = NULL;
   opt = get_options (2); // peaks image
   if (opt.size()) {
     if (true_peaks.size()) throw Exception ("you can't specify both a peaks file and orientations to be estimated at the same time");
-    ipeaks = new Image::Position (*opt[0][0].get_image());
-    if (ipeaks->dim(0) != header.dim(0) || ipeaks->dim(1) != header.dim(1) || ipeaks->dim(2) != header.dim(2))
-      throw Exception ("dimensions of peaks image \"" + ipeaks->name() + "\" do not match that of SH coefficients image \"" + SH_obj.name() + "\"");
-    npeaks = ipeaks->dim(3) / 3;
+    peaks_obj = &*opt[0][0].get_image();
+    if (peaks_obj->dim(0) != header.dim(0) || peaks_obj->dim(1) != header.dim(1) || peaks_obj->dim(2) != header.dim(2))
+      throw Exception ("dimensions of peaks image \"" + peaks_obj->name() + "\" do not match that of SH coefficients image \"" + SH_obj.name() + "\"");
+    npeaks = peaks_obj->dim(3) / 3;
   }
 
   header.axes.dim[3] = 3 * npeaks;
 
-  Image::Position SH (SH_obj);
   Image::Position out (*argument[2].get_image (header));
 
-  std::vector<Direction> peaks_out (npeaks);
-  float val[SH.dim(3)];
-  int lmax = DWI::SH::LforN (SH.dim(3));
+  int lmax = DWI::SH::LforN (SH_obj.dim(3));
   DWI::SH::precompute (lmax, 512);
-  
- 
   info ("using lmax = " + str (lmax));
 
-  ProgressBar::init (SH.dim(0)*SH.dim(1)*SH.dim(2), "finding orientations of largest peaks...");
-
-  for (SH.set(2,0), out.set(2,0); SH[2] < SH.dim(2); SH.inc(2), out.inc(2)) {
-    if (ipeaks.get()) ipeaks->set(2,SH[2]);
-
-    for (SH.set(1,0), out.set(1,0); SH[1] < SH.dim(1); SH.inc(1), out.inc(1)) {
-      if (ipeaks.get()) ipeaks->set(1,SH[1]);
-
-      for (SH.set(0,0), out.set(0,0); SH[0] < SH.dim(0); SH.inc(0), out.inc(0)) {
-
-        bool skip = false;
-        if (ipeaks.get()) {
-          ipeaks->set(0, SH[0]);
-          if (gsl_isnan (ipeaks->value())) skip = true;
-        }
-        
-        if (!skip) {
-          float min = GSL_POSINF, max = GSL_NEGINF;
-          for (SH.set(3,0); SH[3] < SH.dim(3); SH.inc(3)) {
-            val[SH[3]] = SH.value();
-            if (gsl_isnan (val[SH[3]])) {
-              skip = true;
-              break;
-            }
-            if (val[SH[3]] < min) min = val[SH[3]];
-            if (val[SH[3]] > max) max = val[SH[3]];
-          }
-          if (min == max) skip = true;
-        }
-
-        if (skip) for (out.set(3,0); out[3] < out.dim(3); out.inc(3)) out.value (GSL_NAN);
-        else {
-          std::vector<Direction> all_peaks;
-          for (guint i = 0; i < dirs.rows(); i++) {
-            Direction p (dirs(i,0), dirs(i,1)); 
-            p.a = DWI::SH::get_peak (val, lmax, p.v, true);
-            
-            if (gsl_finite (p.a)) {
-              for (guint j = 0; j < all_peaks.size(); j++) {
-                if (fabs (p.v.dot (all_peaks[j].v)) > DOT_THRESHOLD) {
-                  p.a = NAN;
-                  break;
-                }
-              }
-            }
-            if (gsl_finite (p.a) && p.a >= threshold) all_peaks.push_back (p);
-          }
-          
-          if (ipeaks.get()) {
-            for (int i = 0; i < npeaks; i++) {
-              Point p;
-              ipeaks->set(3, 3*i);
-              for (int n = 0; n < 3; n++) { p[n] = ipeaks->value(); ipeaks->inc(3); }
-              p.normalise();
-
-              float mdot = 0.0;
-              for (guint n = 0; n < all_peaks.size(); n++) {
-                float f = fabs (p.dot (all_peaks[n].v));
-                if (f > mdot) { 
-                  mdot = f; 
-                  peaks_out[i] = all_peaks[n];
-                }
-              }
-            }
-          }
-          else if (true_peaks.size()) {
-            for (int i = 0; i < npeaks; i++) {
-              float mdot = 0.0;
-              for (guint n = 0; n < all_peaks.size(); n++) {
-                float f = fabs (all_peaks[n].v.dot (true_peaks[i].v));
-                if (f > mdot) { 
-                  mdot = f; 
-                  peaks_out[i] = all_peaks[n];
-                }
-              }
-            }
-          }
-          else std::partial_sort_copy (all_peaks.begin(), all_peaks.end(), peaks_out.begin(), peaks_out.end());
-
-
-
-          
-          int actual_npeaks = MIN (npeaks, (int) all_peaks.size());
-          out.set (3, 0);
-          for (int n = 0; n < actual_npeaks; n++) {
-             out.value (peaks_out[n].a*peaks_out[n].v[0]); out.inc(3); 
-             out.value (peaks_out[n].a*peaks_out[n].v[1]); out.inc(3); 
-             out.value (peaks_out[n].a*peaks_out[n].v[2]); out.inc(3);
-          }
-          for (; out[3] < 3*npeaks; out.inc(3)) out.value (GSL_NAN);
-        }
-
-        ProgressBar::inc();
-      }
-    }
-  }
-  ProgressBar::done();
+  FindPeaks find_peaks (SH_obj, peaks_obj, dirs, true_peaks, npeaks, threshold);
+  Image::threaded_loop (out, find_peaks, "finding orientations of largest peaks...", 3);
 }
-
@@ -21,7 +21,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 
 using namespace std; 
 using namespace MR; 
@@ -42,78 +42,78 @@ ARGUMENTS = {
 
 OPTIONS = { Option::End };
 
-EXECUTE {
-  Image::Object& in_obj (*argument[0].get_image());
-  in_obj.optimise();
+class Median {
+  public:
+    Median (Image::Object& in_obj) : in (in_obj) { }
 
-  Image::Position in (in_obj);
-  Image::Header header (in.image.header());
+    void operator() (Image::Position& out)
+    {
+      int from[3], to[3], n, nc, i;
+      float val, v[14], cm, t;
+      bool avg;
 
-  Image::Position out (*argument[1].get_image (header));
-
-  int from[3], to[3], n, n1, n2, nc, i;
-  float val, v[14], cm, t;
-  bool avg;
-
-  ProgressBar::init (out.voxel_count(), "median filtering...");
-
-  do { 
-    for (out.set(2,0); out[2] < out.dim(2); out.inc(2)) {
-      from[2] = out[2] > 0 ? out[2]-1 : 0;
-      to[2] = out[2] < out.dim(2)-1 ? out[2]+2 : out.dim(2);
-      n2 = to[2]-from[2];
-      for (out.set(1,0); out[1] < out.dim(1); out.inc(1)) {
-        from[1] = out[1] > 0 ? out[1]-1 : 0;
-        to[1] = out[1] < out.dim(1)-1 ? out[1]+2 : out.dim(1);
-        n1 = n2*(to[1]-from[1]);
-        for (out.set(0,0); out[0] < out.dim(0); out.inc(0)) {
-          from[0] = out[0] > 0 ? out[0]-1 : 0;
-          to[0] = out[0] < out.dim(0)-1 ? out[0]+2 : out.dim(0);
-          n = n1*(to[0]-from[0]);
-          avg = (n+1)%2;
-          n = (n/2)+1;
-          nc = 0;
-          cm = -INFINITY;
-
-          for (in.set(2,from[2]); in[2] < to[2]; in.inc(2)) {
-            for (in.set(1,from[1]); in[1] < to[1]; in.inc(1)) {
-              for (in.set(0,from[0]); in[0] < to[0]; in.inc(0)) {
-                val = in.value();
-                if (nc < n) {
-                  v[nc] = val;
-                  if (v[nc] > cm) cm = v[nc];
-                  nc++;
-                }
-                else if (val < cm) {
-                  for (i = 0; v[i] != cm; i++);
-                  v[i] = val;
-                  cm = -INFINITY;
-                  for (i = 0; i < n; i++)
-                    if (v[i] > cm) cm = v[i];
-                }
-              }
+      for (i = 0; i < 3; i++) {
+        from[i] = out[i] > 0 ? out[i]-1 : 0;
+        to[i] = out[i] < out.dim(i)-1 ? out[i]+2 : out.dim(i);
+      }
+      n = (to[0]-from[0]) * (to[1]-from[1]) * (to[2]-from[2]);
+      avg = (n+1)%2;
+      n = (n/2)+1;
+      nc = 0;
+      cm = -INFINITY;
+
+      in = out;
+      for (in.set(2,from[2]); in[2] < to[2]; in.inc(2)) {
+        for (in.set(1,from[1]); in[1] < to[1]; in.inc(1)) {
+          for (in.set(0,from[0]); in[0] < to[0]; in.inc(0)) {
+            val = in.value();
+            if (nc < n) {
+              v[nc] = val;
+              if (v[nc] > cm) cm = v[nc];
+              nc++;
             }
-          }
-
-          if (avg) {
-            t = cm = -INFINITY;
-            for (i = 0; i < n; i++) {
-              if (v[i] > cm) {
-                t = cm;
-                cm = v[i];
-              }
-              else if (v[i] > t) t = v[i];
+            else if (val < cm) {
+              for (i = 0; v[i] != cm; i++);
+              v[i] = val;
+              cm = -INFINITY;
+              for (i = 0; i < n; i++)
+                if (v[i] > cm) cm = v[i];
             }
-            cm = (cm+t)/2.0;
           }
+        }
+      }
 
-          out.value (cm);
-          ProgressBar::inc();
+      if (avg) {
+        t = cm = -INFINITY;
+        for (i = 0; i < n; i++) {
+          if (v[i] > cm) {
+            t = cm;
+            cm = v[i];
+          }
+          else if (v[i] > t) t = v[i];
         }
+        cm = (cm+t)/2.0;
       }
+
+      out.value (cm);
     }
-  } while (out++);
 
-  ProgressBar::done();
+  private:
+    Image::Position in;
+};
+
+
+
+
+
+EXECUTE {
+  Image::Object& in_obj (*argument[0].get_image());
+  in_obj.optimise();
+
+  Image::Header header (in_obj.header());
+  Image::Position out (*argument[1].get_image (header));
+
+  Median median (in_obj);
+  Image::threaded_loop (out, median, "median filtering...");
 }
 
@@ -0,0 +1,99 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <set>
+
+#include "app.h"
+#include "dwi/tractography/file.h"
+
+using namespace MR; 
+
+SET_VERSION_DEFAULT;
+
+DESCRIPTION = {
+  "merge several track files into one, typically the shards generated by separate runs of streamtrack using its -shard option.",
+  "The track data are copied directly into the output file, so that merging is limited only by disk throughput. "
+    "The counts of selected and generated tracks in the output are the totals over all input files. "
+    "All other track properties are taken from the first input file.",
+  NULL
+};
+
+ARGUMENTS = {
+  Argument ("input", "input tracks", "the input track files.", true, true).type_file (),
+  Argument ("output", "output tracks file", "the output tracks file.").type_file(),
+  Argument::End
+};
+
+
+OPTIONS = { Option::End };
+
+
+
+EXECUTE {
+  DWI::Tractography::Properties properties;
+  DataType dtype;
+  String data_file;
+  goffset offset;
+  DWI::Tractography::read_header (argument[0].get_string(), properties, dtype, data_file, offset);
+
+  const String rng_seed (properties["rng_seed"]);
+  guint num_shards = 0;
+  std::set<guint> shards;
+  properties.erase ("shard");
+
+  DWI::Tractography::Writer writer;
+  writer.create (argument.back().get_string(), properties);
+
+  ProgressBar::init (argument.size()-1, "merging tracks...");
+
+  for (guint nfile = 0; nfile < argument.size()-1; ++nfile) {
+    const String name (argument[nfile].get_string());
+    DWI::Tractography::read_header (name, properties, dtype, data_file, offset);
+
+    if (properties["rng_seed"] != rng_seed) 
+      error ("WARNING: tracks file \"" + name + "\" was generated using a different random number generator seed");
+
+    if (properties["shard"].size()) {
+      std::vector<String> V = split (properties["shard"], "/");
+      if (V.size() == 2) {
+        if (num_shards && num_shards != to<guint> (V[1])) 
+          error ("WARNING: tracks file \"" + name + "\" belongs to a different set of shards");
+        num_shards = to<guint> (V[1]);
+        if (!shards.insert (to<guint> (V[0])).second)
+          error ("WARNING: shard " + V[0] + " is included more than once");
+      }
+    }
+
+    guint num = writer.append_file (name);
+    if (num != to<guint> (properties["count"]))
+      error ("WARNING: tracks file \"" + name + "\" contains " + str (num) + " tracks, but its header specifies " + properties["count"]);
+    writer.total_count += to<guint> (properties["total_count"]);
+    ProgressBar::inc();
+  }
+
+  ProgressBar::done();
+
+  if (num_shards && shards.size() != num_shards) 
+    error ("WARNING: only " + str (shards.size()) + " of " + str (num_shards) + " shards were merged");
+
+  info ("merged " + str (writer.count) + " tracks (out of " + str (writer.total_count) + " generated)");
+  writer.close();
+}
+
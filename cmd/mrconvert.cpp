@@ -33,7 +33,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/typed_position.h"
 #include "image/axis.h"
 #include "math/linalg.h"
 
@@ -96,7 +96,7 @@ OPTIONS = {
 
 
 
-inline bool next (Image::Position& ref, Image::Position& other, const std::vector<int>* pos)
+template <class RefPos, class OtherPos> inline bool next (RefPos& ref, OtherPos& other, const std::vector<int>* pos)
 {
   int axis = 0;
   do {
@@ -114,6 +114,66 @@ inline bool next (Image::Position& ref, Image::Position& other, const std::vecto
 
 
 
+template <class InPos> class CopyData
+{
+  public:
+    CopyData (InPos& input, const std::vector<int>* positions, Image::OutputType type, bool zero_NaN) :
+      in (input), pos (positions), output_type (type), replace_NaN (zero_NaN) { }
+
+    template <class OutPos> void operator() (OutPos& out) 
+    {
+      for (int n = 0; n < in.ndim(); n++) in.set (n, pos[n][0]);
+
+      ProgressBar::init (out.voxel_count(), "copying data...");
+
+      do { 
+
+        float re, im = 0.0;
+        in.get (output_type, re, im);
+        if (replace_NaN) if (gsl_isnan (re)) re = 0.0;
+        out.re (re);
+
+        if (output_type == Image::RealImag) {
+          if (replace_NaN) if (gsl_isnan (im)) im = 0.0;
+          out.im (im);
+        }
+
+        ProgressBar::inc();
+      } while (next (out, in, pos));
+
+      ProgressBar::done();
+    }
+
+  private:
+    InPos& in;
+    const std::vector<int>* pos;
+    const Image::OutputType output_type;
+    const bool replace_NaN;
+};
+
+
+
+class Copy 
+{
+  public:
+    Copy (Image::Object& output, const std::vector<int>* positions, Image::OutputType type, bool zero_NaN) :
+      out_obj (output), pos (positions), output_type (type), replace_NaN (zero_NaN) { }
+
+    template <class InPos> void operator() (InPos& in) 
+    {
+      CopyData<InPos> copy (in, pos, output_type, replace_NaN);
+      Image::dispatch (out_obj, copy);
+    }
+
+  private:
+    Image::Object& out_obj;
+    const std::vector<int>* pos;
+    const Image::OutputType output_type;
+    const bool replace_NaN;
+};
+
+
+
 
 
 EXECUTE {
@@ -217,29 +277,8 @@ EXECUTE {
 
 
 
-  Image::Position in (in_obj);
-  Image::Position out (*argument[1].get_image (header));
-
-  for (int n = 0; n < in.ndim(); n++) in.set (n, pos[n][0]);
-
-  ProgressBar::init (out.voxel_count(), "copying data...");
-
-  do { 
-
-    float re, im = 0.0;
-    in.get (output_type, re, im);
-    if (replace_NaN) if (gsl_isnan (re)) re = 0.0;
-    out.re (re);
-
-    if (output_type == Image::RealImag) {
-      if (replace_NaN) if (gsl_isnan (im)) im = 0.0;
-      out.im (im);
-    }
-
-    ProgressBar::inc();
-  } while (next (out, in, pos));
-
-  ProgressBar::done();
+  Copy copy (*argument[1].get_image (header), pos, output_type, replace_NaN);
+  Image::dispatch (in_obj, copy);
 }
 
 
@@ -21,7 +21,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 
 using namespace std; 
 using namespace MR; 
@@ -44,6 +44,42 @@ ARGUMENTS = {
 OPTIONS = { Option::End };
 
 
+class Multiply {
+  public:
+    Multiply (std::vector<RefPtr<Image::Object> >& in_obj) 
+    { 
+      for (guint i = 0; i < in_obj.size(); i++) 
+        in.push_back (Image::Position (*in_obj[i]));
+    }
+
+    void operator() (Image::Position& out)
+    {
+      for (guint i = 0; i < in.size(); i++) 
+        for (int n = 0; n < in[i].ndim(); n++)
+          in[i].set (n, in[i].dim(n) > 1 ? out[n] : 0);
+
+      if (out.is_complex()) {
+        Math::ComplexNumber<float> c (1.0, 0.0);
+        for (guint i = 0; i < in.size(); i++) 
+          if (in[i].is_complex()) c *= in[i].Z();
+        out.Z (c);
+      } 
+      else {
+        float val = 1.0;
+        for (guint i = 0; i < in.size(); i++) 
+          val *= in[i].value();
+        out.value (val);
+      }
+    }
+
+  private:
+    std::vector<Image::Position> in;
+};
+
+
+
+
+
 EXECUTE {
   int num_images = argument.size() - 1;
   std::vector<RefPtr<Image::Object> > in_obj (num_images);
@@ -70,36 +106,7 @@ EXECUTE {
 
 
   Image::Position out (*argument.back().get_image (header));
-
-  ProgressBar::init (num_images*out.voxel_count(), "multiplying...");
-
-  for (int i = 0; i < num_images; i++) {
-
-    out.zero();
-    Image::Position in (*in_obj[i]);
-
-    do {
-
-      for (int n = 0; n < in.ndim(); n++)
-        in.set (n, in.dim(n) > 1 ? out[n] : 0);
-
-      if (out.is_complex()) {
-        Math::ComplexNumber<float> c (1.0, 0.0);
-        if (i) c = out.Z();
-        if (in.is_complex()) c *= in.Z();
-        out.Z (c);
-      } 
-      else {
-        float val = i ? out.value() : 1.0;
-        out.value (val * in.value());
-      }
-
-      ProgressBar::inc();
-
-    } while (out++);
-
-  }
-
-  ProgressBar::done();
+  Multiply multiply (in_obj);
+  Image::threaded_loop (out, multiply, "multiplying...");
 
 }
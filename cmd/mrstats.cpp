@@ -30,7 +30,7 @@
 #include <fstream>
 
 #include "app.h"
-#include "image/position.h"
+#include "image/typed_position.h"
 
 using namespace std; 
 using namespace MR; 
@@ -66,7 +66,7 @@ OPTIONS = {
 
 
 
-template <class Function> inline void loop (Image::Position& pos, RefPtr<Image::Position>& mask, Function& func)
+template <class Pos, class Function> inline void loop (Pos& pos, RefPtr<Image::Position>& mask, Function& func)
 {
   if (mask) mask->set(2,0); 
   for (pos.set(2,0); pos[2] < pos.dim(2); pos.inc(2)) {
@@ -165,87 +165,110 @@ class DumpValues {
 
 
 
+class Run {
+  public:
+    Run (RefPtr<Image::Position>& mask_position, const String& histogram_filename, size_t num_bins, const String& dump_filename) :
+      mask (mask_position), histogram_file (histogram_filename), bins (num_bins), dump_file (dump_filename) { }
+
+    template <class Pos> void operator() (Pos& ima) 
+    {
+      if (histogram_file.size()) {
+        size_t nrows = 1;
+        for (int i = 3; i < ima.ndim(); i++) nrows *= ima.dim(i);
+
+        // calibrate:
+        GetMinMax limits;
+        ProgressBar::init (nrows, "calibrating...");
+        do {
+          loop (ima, mask, limits);
+          ProgressBar::inc();
+        } while (ima++);
+        ProgressBar::done();
+
+        // get histogram:
+        GetHistogram hist (limits, bins);
+        std::ofstream out (histogram_file.c_str());
+
+        // write out bin centres:
+        for (int i = 0; i < hist.N; i++)
+          out << (hist.min + hist.width/2.0) + i*hist.width << " ";
+        out << "\n";
+
+        ProgressBar::init (nrows, "building histogram...");
+        do {
+          hist.clear();
+          loop (ima, mask, hist);
+          for (int i = 0; i < hist.N; i++)
+            out << hist.data[i] << " ";
+          out << "\n";
+          ProgressBar::inc();
+        } while (ima++);
+        ProgressBar::done();
+
+        out.close();
+      }
+      else {
+        bool header_shown = false;
+        do {
+          GetStats stats;
+          loop (ima, mask, stats);
+          stats.finalise();
+
+          String s = "[ ";
+          for (int n = 3; n < ima.ndim(); n++) s += str(ima[n]) + " ";
+          s += "] ";
+
+          if (!header_shown) print ("channel         mean        std. dev.   min         max         count\n");
+          header_shown = true;
+          print (MR::printf ("%-15s %-11g %-11g %-11g %-11g %-11d\n", s.c_str(), stats.mean, stats.std, stats.min, stats.max, stats.count));
+        } while (ima++);
+      }
+
+      if (dump_file.size()) {
+        DumpValues dump (dump_file);
+        ProgressBar::init (ima.voxel_count(), "dumping values to file...");
+        do {
+          loop (ima, mask, dump);
+          ProgressBar::inc();
+        } while (ima++);
+        ProgressBar::done();
+      }
+    }
+
+  private:
+    RefPtr<Image::Position>& mask;
+    const String histogram_file;
+    const size_t bins;
+    const String dump_file;
+};
+
+
+
+
+
 EXECUTE {
-  Image::Position ima (*argument[0].get_image());
+  Image::Object& ima_obj (*argument[0].get_image());
 
   RefPtr<Image::Position> mask;
   std::vector<OptBase> opt = get_options (0); // mask
   if (opt.size()) {
     mask = new Image::Position (*opt[0][0].get_image ());
-    if (mask->dim(0) != ima.dim(0) || mask->dim(1) != ima.dim(1) || mask->dim(2) != ima.dim(2)) 
+    if (mask->dim(0) != ima_obj.dim(0) || mask->dim(1) != ima_obj.dim(1) || mask->dim(2) != ima_obj.dim(2)) 
       throw Exception ("dimensions of mask image do not match that of data image - aborting");
   }
 
-
+  String histogram_file, dump_file;
+  size_t bins = 100;
 
   opt = get_options (1); // histogram
-  if (opt.size()) {
-    String filename = opt[0][0].get_string();
-
-    opt = get_options (2); // bins
-    size_t bins = 100;
-    if (opt.size()) bins = opt[0][0].get_int();
-
-    size_t nrows = 1;
-    for (int i = 3; i < ima.ndim(); i++) nrows *= ima.dim(i);
-
-    // calibrate:
-    GetMinMax limits;
-    ProgressBar::init (nrows, "calibrating...");
-    do {
-      loop (ima, mask, limits);
-      ProgressBar::inc();
-    } while (ima++);
-    ProgressBar::done();
-
-    // get histogram:
-    GetHistogram hist (limits, bins);
-    std::ofstream out (filename.c_str());
-
-    // write out bin centres:
-    for (int i = 0; i < hist.N; i++)
-      out << (hist.min + hist.width/2.0) + i*hist.width << " ";
-    out << "\n";
-
-    ProgressBar::init (nrows, "building histogram...");
-    do {
-      hist.clear();
-      loop (ima, mask, hist);
-      for (int i = 0; i < hist.N; i++)
-        out << hist.data[i] << " ";
-      out << "\n";
-      ProgressBar::inc();
-    } while (ima++);
-    ProgressBar::done();
-
-    out.close();
-  }
-  else {
-    bool header_shown = false;
-    do {
-      GetStats stats;
-      loop (ima, mask, stats);
-      stats.finalise();
-
-      String s = "[ ";
-      for (int n = 3; n < ima.ndim(); n++) s += str(ima[n]) + " ";
-      s += "] ";
-
-      if (!header_shown) print ("channel         mean        std. dev.   min         max         count\n");
-      header_shown = true;
-      print (MR::printf ("%-15s %-11g %-11g %-11g %-11g %-11d\n", s.c_str(), stats.mean, stats.std, stats.min, stats.max, stats.count));
-    } while (ima++);
-  }
+  if (opt.size()) histogram_file = opt[0][0].get_string();
+
+  opt = get_options (2); // bins
+  if (opt.size()) bins = opt[0][0].get_int();
 
   opt = get_options (3); // dump
-  if (opt.size()) {
-    DumpValues dump (opt[0][0].get_string());
-    ProgressBar::init (ima.voxel_count(), "dumping values to file...");
-    do {
-      loop (ima, mask, dump);
-      ProgressBar::inc();
-    } while (ima++);
-    ProgressBar::done();
-  }
-}
+  if (opt.size()) dump_file = opt[0][0].get_string();
 
+  Run run (mask, histogram_file, bins, dump_file);
+  Image::dispatch (ima_obj, run);
+}
@@ -24,6 +24,7 @@
 #include "math/matrix.h"
 #include "point.h"
 #include "dwi/tractography/file.h"
+#include "dwi/tractography/mapped_reader.h"
 
 using namespace MR; 
 
@@ -88,9 +89,11 @@ class Range {
     static void check_increasing (const std::vector<Range>& list) 
     {
       int last = -1;
-      for (guint n = 0; n < list.size(); ++n) 
+      for (guint n = 0; n < list.size(); ++n) {
         if (list[n].start() <= last || ( list[n].start() != list[n].end() && list[n].increment() < 0 ))
           throw Exception ("number sequence should increase monotonically");
+        last = list[n].end();
+      }
     }
 
   private:
@@ -107,6 +110,22 @@ class Range {
 
 
 
+
+// move on to the next track requested, throwing 1 once all have been selected:
+inline void next_target (const std::vector<Range>& list, guint& n, int& target)
+{
+  if (target == list[n].end()) {
+    ++n;
+    if (n >= list.size())
+      throw 1;
+    target = list[n].start();
+  }
+  else target += list[n].increment();
+}
+
+
+
+
 EXECUTE {
   DWI::Tractography::Properties properties;
   DWI::Tractography::Reader file;
@@ -134,26 +153,54 @@ EXECUTE {
   try {
     int num = 0, target = list.size() ? list[0].start() : 0;
     guint n = 0;
+    DWI::Tractography::MappedReader reader;
     for (guint nfile = 0; nfile < argument.size()-1; ++nfile) {
-      file.open (argument[nfile].get_string(), properties);
+
+      // legacy MDS files can only be read sequentially:
+      try { 
+        Exception::Lower s (1);
+        reader.open (argument[nfile].get_string(), properties); 
+      }
+      catch (Exception e) {
+        if (e.description.compare (0, 37, "invalid first line for key/value file")) { e.display(); throw; }
+
+        DWI::Tractography::Reader mds;
+        mds.open (argument[nfile].get_string(), properties);
+        writer.total_count += to<guint> (properties["total_count"]);
+        while (mds.next (tck)) {
+          if (list.empty() || num == target) {
+            writer.append (tck);
+            ProgressBar::inc();
+            if (list.size()) next_target (list, n, target);
+          }
+          ++num;
+        }
+        mds.close();
+        continue;
+      }
+
       writer.total_count += to<guint> (properties["total_count"]);
-      while (file.next (tck)) {
-        if (list.empty() || num == target) {
+      if (list.empty()) {
+        while (reader.next (tck)) {
           writer.append (tck);
-          if (list.size()) {
-            if (target == list[n].end()) {
-              ++n;
-              if (n >= list.size())
-                throw 1;
-              target = list[n].start();
-            }
-            else target += list[n].increment();
+          ProgressBar::inc();
+        }
+      }
+      else {
+        while (target < num + int (reader.size())) {
+          // the sequential reader never matches such targets, so neither should we:
+          if (target < num) {
+            next_target (list, n, target);
+            continue;
           }
+          reader.get (target - num, tck);
+          writer.append (tck);
+          ProgressBar::inc();
+          next_target (list, n, target);
         }
-        ++num;
-        ProgressBar::inc();
       }
-      file.close();
+      num += reader.size();
+      reader.close();
     }
   }
   catch (int) { }
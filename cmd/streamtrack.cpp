@@ -44,7 +44,6 @@
 */
 
 #include <glibmm/thread.h>
-#include <queue>
 
 #include "app.h"
 #include "file/config.h"
@@ -202,12 +201,93 @@ OPTIONS = {
       "do NOT pre-compute legendre polynomial values. "
       "Warning: this will slow down the algorithm by a factor of approximately 4."),
 
+  Option ("seedgrid", "grid seeding", 
+      "seed deterministically, from the specified number of points within each voxel of the "
+      "seed mask image(s), rather than randomly. Each seed point is used once, and by default "
+      "tracking stops once all seed points have been used (or the number of tracks requested "
+      "using the -number option has been reached).")
+    .append (Argument ("number", "seeds per voxel", 
+          "the number of seeds per voxel.").type_integer (1, 1000, 1)),
+
+  Option ("rngseed", "random number generator seed", 
+      "set the seed for the random number generator. Each track is generated using its own "
+      "random number stream, derived from this seed and the index of the track, so that "
+      "the same tracks are produced regardless of the number of threads used. The seed "
+      "used is stored in the output file (default is to use the current time).")
+    .append (Argument ("seed", "seed", 
+          "the seed to use.").type_integer (0, G_MAXINT, 0)),
+
+  Option ("shard", "shard", 
+      "generate only one of several disjoint subsets (shards) of the tracks, so that "
+      "tracking can be distributed over several processes or machines. The shard is "
+      "specified as i/N, where N is the total number of shards and i is the index of "
+      "this shard (starting from zero). Each shard generates its share of the numbers of "
+      "tracks and attempts requested, from seeds that are not used by any other shard. "
+      "All shards should be run with the same options, including -rngseed, and their "
+      "outputs can then be combined using merge_tracks.")
+    .append (Argument ("spec", "shard specifier", 
+          "the shard to generate, as i/N.").type_string ()),
+
+  Option ("stats", "tracking statistics", 
+      "write a summary of the tracking process to the specified file once tracking has "
+      "completed, as a list of key: value pairs: the fate of each attempt, the reasons for "
+      "which the tracks terminated, the number of steps taken per second, and (for "
+      "probabilistic tracking) the number of candidate directions evaluated. With the "
+      "-timing option, the time spent fetching the source data and computing directions "
+      "is also reported.")
+    .append (Argument ("file", "statistics file", 
+          "the file to write the statistics to.").type_file ()),
+
+  Option ("timing", "per-step timing", 
+      "record the time spent fetching the source data and computing directions for the "
+      "statistics summary. Note this requires reading the system clock at every step, "
+      "and so may itself slow down tracking slightly."),
+
   Option::End
 };
 
 
 
 
+// number of track buffers in each tracker thread's hand-off queue
+#define TRACK_QUEUE_SIZE 256
+// time to sleep (in microseconds) when a queue is full or all queues are empty
+#define TRACK_QUEUE_WAIT 200
+
+
+
+// single-producer/single-consumer ring of pre-allocated track buffers, 
+// used to hand tracks over from one tracker thread to the writer thread
+// without locking. Buffers are recycled, so that no allocation takes
+// place once their capacity has grown to the typical track length.
+class TrackQueue {
+  public:
+    TrackQueue () : head (0), tail (0), rejected (0), finished (0) { }
+
+    // producer side:
+    bool                full () const     { return (next (g_atomic_int_get (&head)) == g_atomic_int_get (&tail)); }
+    std::vector<Point>& back ()           { return (buffer[head]); }
+    void                push ()           { g_atomic_int_set (&head, next (head)); }
+    void                reject ()         { g_atomic_int_inc (&rejected); }
+    void                done ()           { g_atomic_int_set (&finished, 1); }
+
+    // consumer side:
+    bool                empty () const    { return (g_atomic_int_get (&head) == g_atomic_int_get (&tail)); }
+    std::vector<Point>& front ()          { return (buffer[tail]); }
+    void                pop ()            { g_atomic_int_set (&tail, next (tail)); }
+    guint               num_rejected () const { return (g_atomic_int_get (&rejected)); }
+    bool                is_done () const  { return (g_atomic_int_get (&finished)); }
+
+  protected:
+    std::vector<Point> buffer[TRACK_QUEUE_SIZE];
+    volatile gint head, tail, rejected, finished;
+
+    static gint next (gint index) { return ((index+1) % TRACK_QUEUE_SIZE); }
+};
+
+
+
+
 class Threader {
   public:
     Threader (int type_index, 
@@ -216,15 +296,23 @@ class Threader {
         Tractography::Properties& properties,
         Point init_direction,
         float init_direction_tolerance,
-        Ptr<Math::Matrix>& grad) :
+        Ptr<Math::Matrix>& grad,
+        const String& statistics_file,
+        bool per_step_timing) :
       init_dir (init_direction),
       init_dir_tolerance_dp (cos (M_PI * init_direction_tolerance / 180.0)),
-      currently_running (0)
+      num_attempts (0),
+      stop (0),
+      shard_index (0),
+      num_shards (1),
+      stats_file (statistics_file),
+      timing (per_step_timing)
     {
       source.map();
       num_threads = File::Config::get_int ("NumberOfThreads", 1); 
       info ("launching " + str (num_threads) + " threads");
       trackers = new Tracker::Base* [num_threads];
+      queues = new TrackQueue [num_threads];
 
       switch (type_index) {
         case 0: 
@@ -250,6 +338,13 @@ class Threader {
         default: throw Exception ("tracking method requested is not implemented yet!");
       }
 
+      trackers[0]->precompute();
+      for (int n = 1; n < num_threads; n++) 
+        trackers[n]->share_precomputed (*trackers[0]);
+      if (timing) 
+        for (int n = 0; n < num_threads; n++) 
+          trackers[n]->enable_timing();
+
       max_num_tracks = to<guint> (properties["max_num_tracks"]);
       if (properties["max_num_attempts"].empty()) {
         max_num_attempts = 100 * max_num_tracks;
@@ -258,29 +353,74 @@ class Threader {
       else 
         max_num_attempts = to<guint> (properties["max_num_attempts"]);
 
+      if (properties["shard"].size()) {
+        std::vector<guint> V = parse_shard (properties["shard"]);
+        shard_index = V[0];
+        num_shards = V[1];
+        max_num_tracks = shard_size (max_num_tracks);
+        if (max_num_attempts) max_num_attempts = shard_size (max_num_attempts);
+        info ("generating shard " + str (shard_index) + " of " + str (num_shards) + 
+            " (" + str (max_num_tracks) + " tracks, " + str (max_num_attempts) + " attempts)");
+      }
+
       unidirectional = to<int> (properties["unidirectional"]);
       min_size = round (to<float> (properties["min_dist"]) / to<float> (properties["step_size"]));
 
       writer.create (output_file, properties);
     }
 
-    ~Threader () { for (int n = 0; n < num_threads; n++) delete trackers[n]; delete [] trackers; }
+    ~Threader () 
+    { 
+      for (int n = 0; n < num_threads; n++) delete trackers[n]; 
+      delete [] trackers; 
+      delete [] queues; 
+    }
 
     void run () {
 
-      currently_running = num_threads;
-      guint rng_seed = time (NULL);
+      info ("using random number generator seed " + str (trackers[0]->get_rng_key()));
 
+      Glib::Timer timer;
       Glib::Thread* threads[num_threads];
       for (int n = 0; n < num_threads; n++) {
-        trackers[n]->set_rng_seed (rng_seed + n);
-        threads[n] = Glib::Thread::create (sigc::bind<Tracker::Base*> (sigc::mem_fun (*this, &Threader::execute), trackers[n]), true);
+        threads[n] = Glib::Thread::create (sigc::bind<Tracker::Base*,TrackQueue*> (sigc::mem_fun (*this, &Threader::execute), trackers[n], queues+n), true);
       }
 
       write();
 
       for (int n = 0; n < num_threads; n++) threads[n]->join();
+
+      std::vector<Tracker::Statistics> stats;
+      Tracker::Statistics total;
+      for (int n = 0; n < num_threads; n++) {
+        stats.push_back (trackers[n]->statistics());
+        total += stats.back();
+      }
+
+      if (total.outcomes[Tracker::Statistics::Abandoned]) {
+        guint64 num = 0;
+        for (guint n = 0; n < Tracker::Statistics::NumOutcomes; n++) num += total.outcomes[n];
+        info ("abandoned " + str (total.outcomes[Tracker::Statistics::Abandoned]) + " of " + str (num) + 
+            " attempts early (pruning ratio " + str (total.outcomes[Tracker::Statistics::Abandoned] / double (num)) + 
+            "), as they could no longer reach all inclusion regions");
+      }
+
+      if (stats_file.size()) 
+        Tracker::Statistics::write (stats_file, stats, timer.elapsed(), timing);
     }
+
+    static std::vector<guint> parse_shard (const String& spec)
+    {
+      std::vector<String> V = split (spec, "/");
+      if (V.size() != 2) throw Exception ("invalid shard specifier \"" + spec + "\" (expected i/N)");
+      std::vector<guint> shard (2);
+      shard[0] = to<guint> (V[0]);
+      shard[1] = to<guint> (V[1]);
+      if (shard[1] < 1 || shard[0] >= shard[1]) 
+        throw Exception ("invalid shard specifier \"" + spec + "\" (expected 0 <= i < N)");
+      return (shard);
+    }
+
     
 
 
@@ -290,51 +430,69 @@ class Threader {
     const Point init_dir;
     const float init_dir_tolerance_dp;
     guint max_num_tracks, max_num_attempts, min_size;
-    int  currently_running, num_threads;
+    int  num_threads;
     bool unidirectional;
-    Glib::Cond data_ready;
-    Glib::Mutex mutex;
+    volatile gint num_attempts, stop;
+    guint shard_index, num_shards;
+    const String stats_file;
+    const bool timing;
 
     Tracker::Base** trackers;
+    TrackQueue* queues;
     Tractography::Writer writer;
 
-    std::queue<std::vector<Point>*> fifo;
 
-    void append (std::vector<Point>*& tck, bool accept)
+    // claim the next attempt (the index of which identifies the track),
+    // unless the writer has enough tracks or the maximum number of attempts 
+    // has been reached. When sharding, attempts are interleaved across the
+    // shards, so that each shard uses a distinct set of seeds:
+    bool next_attempt (guint& index) 
     {
-      mutex.lock();
-      if (accept) {
-        fifo.push (tck);
-        tck = NULL;
-        data_ready.signal();
-      }
-      else writer.total_count++;
-      mutex.unlock();
+      if (g_atomic_int_get (&stop)) return (false);
+      guint local_index = g_atomic_int_exchange_and_add (&num_attempts, 1);
+      index = local_index * num_shards + shard_index;
+      return (!max_num_attempts || local_index < max_num_attempts);
+    }
+
+    // the share of a total amount of work allocated to this shard:
+    guint shard_size (guint total) const 
+    {
+      return (total / num_shards + ( shard_index < total % num_shards ? 1 : 0 ));
     }
 
+
     void write ()
     {
-      std::vector<Point>* tck;
+      guint num_written = 0;
+      bool running;
       do {
-        mutex.lock();
-        while (currently_running > 0 && fifo.empty()) data_ready.wait (mutex);
-        if (fifo.size()) {
-          tck = fifo.front();
-          fifo.pop();
-        }
-        else tck = NULL;
-        mutex.unlock();
-
-        if (tck) {
-          if (writer.count < max_num_tracks) {
-            writer.append (*tck);
-            writer.total_count++;
-            fprintf (stderr, "\r%8u generated, %8u selected    [%3d%%]", 
-                writer.total_count, writer.count, (int) ((100.0*writer.count)/(float) max_num_tracks));
+        running = false;
+        bool idle = true;
+        guint num_rejected = 0;
+
+        for (int n = 0; n < num_threads; n++) {
+          TrackQueue& queue (queues[n]);
+          // read the done flag first, so that the final tracks of a thread
+          // that has just finished are not missed:
+          if (!queue.is_done()) running = true;
+          while (!queue.empty()) {
+            if (writer.count < max_num_tracks) {
+              writer.append (queue.front());
+              num_written++;
+            }
+            queue.pop();
+            idle = false;
           }
-          delete tck;
+          num_rejected += queue.num_rejected();
         }
-      } while (currently_running > 0);
+
+        writer.total_count = num_written + num_rejected;
+        if (writer.count >= max_num_tracks) g_atomic_int_set (&stop, 1);
+
+        if (idle) g_usleep (TRACK_QUEUE_WAIT);
+        else fprintf (stderr, "\r%8u generated, %8u selected    [%3d%%]", 
+            writer.total_count, writer.count, (int) ((100.0*writer.count)/(float) max_num_tracks));
+      } while (running);
 
       fprintf (stderr, "\r%8u generated, %8u selected    [100%%]\n", writer.total_count, writer.count);
       writer.close ();
@@ -342,37 +500,55 @@ class Threader {
 
 
 
-    void execute (Tracker::Base* tracker) 
+    void execute (Tracker::Base* tracker, TrackQueue* queue) 
     {
-      std::vector<Point>* tck = NULL;
-      while (writer.count < max_num_tracks && ( max_num_attempts ? writer.total_count < max_num_attempts : true )) {
-
-        tracker->new_seed (init_dir, init_dir_tolerance_dp);
-        Point seed_dir (tracker->direction());
-
-        if (!tck) tck = new std::vector<Point>;
-        else tck->clear();
-        tck->push_back (tracker->position());
-
-        while (tracker->next()) tck->push_back (tracker->position());
-        if (!tracker->track_excluded() && !unidirectional) {
-          reverse (tck->begin(), tck->end());
-          seed_dir[0] = -seed_dir[0];
-          seed_dir[1] = -seed_dir[1];
-          seed_dir[2] = -seed_dir[2];
-          tracker->set (tck->back(), seed_dir);
-          while (tracker->next()) tck->push_back (tracker->position());
+      Tracker::Statistics& stats (tracker->statistics());
+      Glib::Timer timer;
+      guint index;
+      while (next_attempt (index)) {
+
+        while (queue->full()) {
+          if (g_atomic_int_get (&stop)) goto finished;
+          g_usleep (TRACK_QUEUE_WAIT);
         }
 
-        append (tck, (!tracker->track_excluded() && tracker->track_included() && tck->size() > min_size));
-      }
+        {
+          if (!tracker->new_seed (init_dir, init_dir_tolerance_dp, index)) {
+            stats.outcomes[Tracker::Statistics::SeedFailed]++;
+            queue->reject();
+            continue;
+          }
+          Point seed_dir (tracker->direction());
+
+          std::vector<Point>& tck (queue->back());
+          tck.clear();
+          tck.push_back (tracker->position());
+
+          while (tracker->next()) tck.push_back (tracker->position());
+          if (!tracker->track_excluded() && !tracker->track_abandoned() && !unidirectional) {
+            reverse (tck.begin(), tck.end());
+            seed_dir[0] = -seed_dir[0];
+            seed_dir[1] = -seed_dir[1];
+            seed_dir[2] = -seed_dir[2];
+            tracker->set (tck.back(), seed_dir);
+            while (tracker->next()) tck.push_back (tracker->position());
+          }
+
+          Tracker::Statistics::Outcome outcome = Tracker::Statistics::Accepted;
+          if (tracker->track_abandoned()) outcome = Tracker::Statistics::Abandoned;
+          else if (tracker->track_excluded()) outcome = Tracker::Statistics::RejectExcluded;
+          else if (!tracker->track_included()) outcome = Tracker::Statistics::NotIncluded;
+          else if (tck.size() <= min_size) outcome = Tracker::Statistics::TooShort;
+          stats.outcomes[outcome]++;
 
-      if (tck) delete tck;
+          if (outcome == Tracker::Statistics::Accepted) queue->push();
+          else queue->reject();
+        }
+      }
 
-      mutex.lock();
-      currently_running--;
-      data_ready.signal();
-      mutex.unlock();
+finished:
+      stats.thread_time = timer.elapsed();
+      queue->done();
     }
 
 };
@@ -385,6 +561,7 @@ class Threader {
 
 
 EXECUTE {
+  if (!Glib::thread_supported()) Glib::thread_init();
 
   Tractography::Properties properties;
   properties["step_size"] = "0.2";
@@ -474,7 +651,30 @@ EXECUTE {
   opt = get_options (18); // noprecomputed
   if (opt.size()) properties["sh_precomputed"] = "0";
 
-  Glib::thread_init();
-  Threader thread (argument[0].get_int(), *argument[1].get_image(), argument[2].get_string(), properties, init_dir, init_dir_tolerance, grad);
+  opt = get_options (19); // seedgrid
+  if (opt.size()) properties["seeds_per_voxel"] = str (opt[0][0].get_int());
+
+  opt = get_options (20); // rngseed
+  if (opt.size()) properties["rng_seed"] = str (opt[0][0].get_int());
+
+  opt = get_options (21); // shard
+  if (opt.size()) {
+    Threader::parse_shard (opt[0][0].get_string());
+    if (properties["rng_seed"].empty()) 
+      throw Exception ("the -rngseed option must be supplied when generating shards");
+    properties["shard"] = opt[0][0].get_string();
+  }
+
+  String stats_file;
+  opt = get_options (22); // stats
+  if (opt.size()) stats_file = opt[0][0].get_string();
+
+  opt = get_options (23); // timing
+  bool timing = opt.size();
+
+  Image::Object& source (*argument[1].get_image());
+  source.optimise_voxel_major();
+
+  Threader thread (argument[0].get_int(), source, argument[2].get_string(), properties, init_dir, init_dir_tolerance, grad, stats_file, timing);
   thread.run();
 }
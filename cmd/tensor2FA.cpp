@@ -21,7 +21,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 #include "dwi/tensor.h"
 
 using namespace std; 
@@ -44,6 +44,29 @@ ARGUMENTS = {
 OPTIONS = { Option::End };
 
 
+class ComputeFA {
+  public:
+    ComputeFA (Image::Object& dt_obj) : dt (dt_obj) { }
+
+    void operator() (Image::Position& fa)
+    {
+      float buf[6];
+      dt.set (0, fa[0]);
+      dt.set (1, fa[1]);
+      dt.set (2, fa[2]);
+      for (dt.set(3,0); dt[3] < 6; dt.inc(3)) 
+        buf[dt[3]] = dt.value();
+      fa.value (DWI::tensor2FA (buf));
+    }
+
+  private:
+    Image::Position dt;
+};
+
+
+
+
+
 EXECUTE {
   Image::Object &dt_obj (*argument[0].get_image());
   Image::Header header (dt_obj);
@@ -57,24 +80,7 @@ EXECUTE {
   header.axes.set_ndim (3);
   header.data_type = DataType::Float32;
 
-  Image::Position dt (dt_obj);
   Image::Position fa (*argument[1].get_image (header));
-
-  float buf[6];
-
-  ProgressBar::init(fa.voxel_count(), "generating fractional anisotropy map...");
-
-  for (fa.set(2,0), dt.set(2,0); fa[2] < fa.dim(2); fa.inc(2), dt.inc(2)) {
-    for (fa.set(1,0), dt.set(1,0); fa[1] < fa.dim(1); fa.inc(1), dt.inc(1)) {
-      for (fa.set(0,0), dt.set(0,0); fa[0] < fa.dim(0); fa.inc(0), dt.inc(0)) {
-
-        for (dt.set(3,0); dt[3] < 6; dt.inc(3)) 
-          buf[dt[3]] = dt.value();
-
-        fa.value (DWI::tensor2FA (buf));
-      }
-    }
-    ProgressBar::inc();
-  }
-  ProgressBar::done();
+  ComputeFA compute_FA (dt_obj);
+  Image::threaded_loop (fa, compute_FA, "generating fractional anisotropy map...");
 }
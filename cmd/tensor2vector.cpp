@@ -21,7 +21,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 #include "math/linalg.h"
 
 using namespace std; 
@@ -44,6 +44,43 @@ ARGUMENTS = {
 OPTIONS = { Option::End };
 
 
+class ComputeVector {
+  public:
+    ComputeVector (Image::Object& dt_obj) : dt (dt_obj), V (3,3), M (3,3), eig (3, true) { }
+
+    void operator() (Image::Position& vec)
+    {
+      double ev[3];
+      dt.set (0, vec[0]);
+      dt.set (1, vec[1]);
+      dt.set (2, vec[2]);
+      dt.set (3, 0);
+
+      M(0,0) = dt.value();          dt.inc(3);
+      M(1,1) = dt.value();          dt.inc(3);
+      M(2,2) = dt.value();          dt.inc(3);
+      M(0,1) = M(1,0) = dt.value(); dt.inc(3);
+      M(0,2) = M(2,0) = dt.value(); dt.inc(3);
+      M(1,2) = M(2,1) = dt.value(); 
+
+      eig (M, ev, V);
+
+      vec.set(3,0);
+      vec.value (V(0,2)); vec.inc(3);
+      vec.value (V(1,2)); vec.inc(3);
+      vec.value (V(2,2));
+    }
+
+  private:
+    Image::Position dt;
+    Math::Matrix V, M;
+    Math::Eigen eig;
+};
+
+
+
+
+
 EXECUTE {
   Image::Object &dt_obj (*argument[0].get_image());
   Image::Header header (dt_obj);
@@ -57,40 +94,7 @@ EXECUTE {
   header.axes.dim[3] = 3;
   header.data_type = DataType::Float32;
 
-  Math::Matrix V(3,3), M(3,3);
-  double ev[3];
-
-  Math::eig_init (M, true);
-
-  Image::Position dt (dt_obj);
   Image::Position vec (*argument[1].get_image (header));
-
-  ProgressBar::init (vec.dim(0)*vec.dim(1)*vec.dim(2), "generating major eigenvector map...");
-
-  for (dt.set(2,0), vec.set(2,0); dt[2] < dt.dim(2); dt.inc(2), vec.inc(2)) {
-    for (dt.set(1,0), vec.set(1,0); dt[1] < dt.dim(1); dt.inc(1), vec.inc(1)) {
-      for (dt.set(0,0), vec.set(0,0); dt[0] < dt.dim(0); dt.inc(0), vec.inc(0)) {
-
-        dt.set(3,0);
-
-        M(0,0) = dt.value();          dt.inc(3);
-        M(1,1) = dt.value();          dt.inc(3);
-        M(2,2) = dt.value();          dt.inc(3);
-        M(0,1) = M(1,0) = dt.value(); dt.inc(3);
-        M(0,2) = M(2,0) = dt.value(); dt.inc(3);
-        M(1,2) = M(2,1) = dt.value(); 
-
-        Math::eig (M, ev, V);
-
-        vec.set(3,0);
-        vec.value (V(0,2)); vec.inc(3);
-        vec.value (V(1,2)); vec.inc(3);
-        vec.value (V(2,2));
-
-        ProgressBar::inc();
-      }
-    }
-  }
-  ProgressBar::done();
-  Math::eig_end();
+  ComputeVector compute_vector (dt_obj);
+  Image::threaded_loop (vec, compute_vector, "generating major eigenvector map...", 3);
 }
@@ -28,7 +28,7 @@
 */
 
 #include "app.h"
-#include "image/position.h"
+#include "image/threaded_loop.h"
 #include "histogram.h"
 #include "min_max.h"
 
@@ -67,6 +67,33 @@ OPTIONS = {
 };
 
 
+class Threshold {
+  public:
+    Threshold (Image::Object& in_obj, float threshold, bool binary_output, float zero_value, float one_value) :
+      in (in_obj), val (threshold), binary (binary_output), zero (zero_value), one (one_value) { }
+
+    void operator() (Image::Position& out)
+    {
+      in = out;
+      float v = in.re();
+      out.re (v > val ? (binary ? one : v) : zero);
+      if (out.is_complex()) {
+        v = in.im();
+        out.im (v > val ? (binary ? one : v) : zero);
+      }
+    }
+
+  private:
+    Image::Position in;
+    const float val;
+    const bool binary;
+    const float zero, one;
+};
+
+
+
+
+
 EXECUTE {
 
   bool use_percentage = false, optimise = true;
@@ -102,7 +129,9 @@ EXECUTE {
     header.scale = 1.0;
   }
 
-  Image::Position out (*argument[1].get_image (header));
+  Image::Object& out_obj (*argument[1].get_image (header));
+  if (out_obj.data_type() == DataType::Bit) out_obj.optimise();
+  Image::Position out (out_obj);
 
   if (use_percentage) {
     float min, max;
@@ -119,19 +148,6 @@ EXECUTE {
   float one  = invert ? zero : 1.0;
   zero = invert ? 1.0 : zero;
 
-  ProgressBar::init (out.voxel_count(), "thresholding at intensity " + str(val) + "...");
-
-  do {
-    in = out;
-    float v = in.re();
-    out.re (v > val ? (binary ? one : v) : zero);
-    if (out.is_complex()) {
-      v = in.im();
-      out.im (v > val ? (binary ? one : v) : zero);
-    }
-
-    ProgressBar::inc();
-  } while (out++);
-
-  ProgressBar::done();
+  Threshold threshold (in.image, val, binary, zero, one);
+  Image::threaded_loop (out, threshold, "thresholding at intensity " + str(val) + "...");
 }
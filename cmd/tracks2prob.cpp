@@ -38,7 +38,10 @@
 
 
 
+#include <glibmm/thread.h>
+
 #include "app.h"
+#include "file/config.h"
 #include "math/matrix.h"
 #include "dwi/tractography/file.h"
 #include "dwi/tractography/properties.h"
@@ -344,90 +347,163 @@ template<> void TrackMapper<SetVoxelDir>::voxelise (const std::vector<Point>& tc
 
 
 
-template <class T> class MapWriterBase
+// The partial track density maps are stored in cubic tiles of this size,
+// allocated only once a track enters them
+#define TILE_SIZE 16
+
+// The number of tracks read from file by each thread in one go
+#define TRACK_BATCH_SIZE 64
+
+
+
+template <typename value_type> inline void set_zero (value_type& v) { v = 0; }
+template <> inline void set_zero<Point> (Point& v) { v.zero(); }
+
+
+
+template <typename value_type> class TiledBuffer
 {
 
   public:
-    MapWriterBase (Image::Position& p, const float fraction_scaling_factor, const bool length_scaled) :
-      pos (p),
-      H (p.image.header()),
+    TiledBuffer (const Image::Header& H) :
+      nx ((H.dim(0) + TILE_SIZE - 1) / TILE_SIZE),
+      ny ((H.dim(1) + TILE_SIZE - 1) / TILE_SIZE),
+      nz ((H.dim(2) + TILE_SIZE - 1) / TILE_SIZE),
+      tiles (nx * ny * nz, (value_type*) NULL) { }
+
+    ~TiledBuffer ()
+    {
+      for (size_t n = 0; n != tiles.size(); ++n)
+        delete[] tiles[n];
+    }
+
+    value_type& operator() (const Voxel& v)
+    {
+      value_type*& tile (tiles[tile_index (v)]);
+      if (!tile) {
+        tile = new value_type[TILE_SIZE * TILE_SIZE * TILE_SIZE];
+        for (size_t n = 0; n != TILE_SIZE * TILE_SIZE * TILE_SIZE; ++n)
+          set_zero (tile[n]);
+      }
+      return (tile[voxel_index (v)]);
+    }
+
+    value_type value (const Voxel& v) const
+    {
+      const value_type* tile (tiles[tile_index (v)]);
+      if (tile) 
+        return (tile[voxel_index (v)]);
+      value_type zero;
+      set_zero (zero);
+      return (zero);
+    }
+
+    void add (TiledBuffer& partial)
+    {
+      for (size_t n = 0; n != tiles.size(); ++n) {
+        if (!partial.tiles[n]) continue;
+        if (!tiles[n]) {
+          tiles[n] = partial.tiles[n];
+          partial.tiles[n] = NULL;
+        }
+        else {
+          for (size_t i = 0; i != TILE_SIZE * TILE_SIZE * TILE_SIZE; ++i)
+            tiles[n][i] += partial.tiles[n][i];
+        }
+      }
+    }
+
+  private:
+    const size_t nx, ny, nz;
+    std::vector<value_type*> tiles;
+
+    size_t tile_index (const Voxel& v) const
+    {
+      return ((v.x / TILE_SIZE) + nx * ((v.y / TILE_SIZE) + ny * (v.z / TILE_SIZE)));
+    }
+
+    static size_t voxel_index (const Voxel& v)
+    {
+      return ((v.x % TILE_SIZE) + TILE_SIZE * ((v.y % TILE_SIZE) + TILE_SIZE * (v.z % TILE_SIZE)));
+    }
+
+    TiledBuffer (const TiledBuffer&);
+    TiledBuffer& operator= (const TiledBuffer&);
+
+};
+
+
+
+
+template <class T, typename value_type> class MapWriterBase
+{
+
+  public:
+    MapWriterBase (const Image::Header& header, const float fraction_scaling_factor, const bool length_scaled) :
+      H (header),
       scale (fraction_scaling_factor),
       lstdi (length_scaled),
-      buffer_size (H.dim(0) * H.dim(1) * H.dim(2)) { }
+      buffer (header) { }
+
+    virtual ~MapWriterBase () { }
 
     virtual void write (const T& voxels) = 0;
+    virtual void save (Image::Position& pos) = 0;
+
+    void add (MapWriterBase& partial) { buffer.add (partial.buffer); }
 
    protected:
-    Image::Position& pos;
     const Image::Header& H;
     const float scale;
     const bool lstdi;
-    const size_t buffer_size;
-
-    template <class V>
-    size_t voxel_to_index (const V& vox)
-    {
-      return (vox.x + (vox.y * H.dim(0)) + (vox.z * H.dim(0) * H.dim(1)));
-    }
+    TiledBuffer<value_type> buffer;
 
 };
 
 
 template <class value_type>
-class MapWriter : public MapWriterBase<SetVoxel>
+class MapWriter : public MapWriterBase<SetVoxel, value_type>
 {
 
   public:
-    MapWriter (Image::Position& p, const float fraction_scaling_factor, const bool length_scaled) :
-      MapWriterBase<SetVoxel> (p, fraction_scaling_factor, length_scaled),
-      buffer (new value_type[buffer_size])
-    {
-      memset(buffer, 0, buffer_size * sizeof(value_type));
-    }
-
-    ~MapWriter();
+    MapWriter (const Image::Header& header, const float fraction_scaling_factor, const bool length_scaled) :
+      MapWriterBase<SetVoxel, value_type> (header, fraction_scaling_factor, length_scaled) { }
 
     void write (const SetVoxel&);
-
-  private:
-    value_type* buffer;
+    void save (Image::Position& pos);
 
 };
 
 
 template <>
-MapWriter<uint32_t>::~MapWriter<uint32_t> ()
+void MapWriter<uint32_t>::save (Image::Position& pos)
 {
 
   ProgressBar::init (H.dim(2), "writing image... ");
-  size_t index = 0;
   for (pos.set(2,0); pos[2] < H.dim(2); pos.inc(2)) {
     for (pos.set(1,0); pos[1] < H.dim(1); pos.inc(1)) {
-      for (pos.set(0,0); pos[0] < H.dim(0); pos.inc(0), ++index)
-        pos.value (buffer[index]);
+      for (pos.set(0,0); pos[0] < H.dim(0); pos.inc(0))
+        pos.value (buffer.value (Voxel (pos[0], pos[1], pos[2])));
     }
     ProgressBar::inc();
   }
   ProgressBar::done();
-  delete[] buffer;
 
 }
 
 template <>
-MapWriter<float>::~MapWriter<float> ()
+void MapWriter<float>::save (Image::Position& pos)
 {
 
   ProgressBar::init (H.dim(2), "writing image... ");
-  size_t index = 0;
   for (pos.set(2,0); pos[2] < H.dim(2); pos.inc(2)) {
     for (pos.set(1,0); pos[1] < H.dim(1); pos.inc(1)) {
-      for (pos.set(0,0); pos[0] < H.dim(0); pos.inc(0), ++index)
-        pos.value (scale * buffer[index]);
+      for (pos.set(0,0); pos[0] < H.dim(0); pos.inc(0))
+        pos.value (scale * buffer.value (Voxel (pos[0], pos[1], pos[2])));
     }
     ProgressBar::inc();
   }
   ProgressBar::done();
-  delete[] buffer;
 
 }
 
@@ -437,47 +513,41 @@ template <>
 void MapWriter<uint32_t>::write (const SetVoxel& voxels)
 {
   for (SetVoxel::const_iterator i = voxels.begin(); i != voxels.end(); ++i)
-    ++buffer[voxel_to_index(*i)];
+    ++buffer(*i);
 }
 
 template <>
 void MapWriter<float>::write (const SetVoxel& voxels)
 {
   for (SetVoxel::const_iterator i = voxels.begin(); i != voxels.end(); ++i)
-    buffer[voxel_to_index(*i)] += lstdi ? (1.0 / float(voxels.length)) : 1.0;
+    buffer(*i) += lstdi ? (1.0 / float(voxels.length)) : 1.0;
 }
 
 
 
 
-class MapWriterColour : public MapWriterBase<SetVoxelDir>
+class MapWriterColour : public MapWriterBase<SetVoxelDir, Point>
 {
 
   public:
-    MapWriterColour (Image::Position& p, const float fraction_scaling_factor, const bool length_scaled) :
-      MapWriterBase<SetVoxelDir> (p, fraction_scaling_factor, length_scaled),
-      buffer (new Point[buffer_size])
-    {
-      for (size_t i = 0; i != buffer_size; ++i)
-        buffer[i] = Point (0.0, 0.0, 0.0);
-    }
+    MapWriterColour (const Image::Header& header, const float fraction_scaling_factor, const bool length_scaled) :
+      MapWriterBase<SetVoxelDir, Point> (header, fraction_scaling_factor, length_scaled) { }
 
-    ~MapWriterColour ()
+    void save (Image::Position& pos)
     {
       ProgressBar::init (H.dim(2), "writing colour image... ");
-      size_t index = 0;
       for (pos.set(2,0); pos[2] < H.dim(2); pos.inc(2)) {
         for (pos.set(1,0); pos[1] < H.dim(1); pos.inc(1)) {
-          for (pos.set(0,0); pos[0] < H.dim(0); pos.inc(0), ++index) {
-            pos.set(3, 0); pos.value ((buffer[index])[0]);
-            pos.inc(3);    pos.value ((buffer[index])[1]);
-            pos.inc(3);    pos.value ((buffer[index])[2]);
+          for (pos.set(0,0); pos[0] < H.dim(0); pos.inc(0)) {
+            const Point value (buffer.value (Voxel (pos[0], pos[1], pos[2])));
+            pos.set(3, 0); pos.value (value[0]);
+            pos.inc(3);    pos.value (value[1]);
+            pos.inc(3);    pos.value (value[2]);
           }
         }
         ProgressBar::inc();
       }
       ProgressBar::done();
-      delete[] buffer;
     }
 
     void write (const SetVoxelDir& voxels)
@@ -489,13 +559,91 @@ class MapWriterColour : public MapWriterBase<SetVoxelDir>
         do {
           this_voxel_dir += i->dir;
         } while ((++i) != voxels.end() && *i == *this_voxel);
-        buffer[voxel_to_index(*this_voxel)] += this_voxel_dir.normalise() * (lstdi ? (1.0 / float(voxels.length)) : 1.0);
+        buffer(*this_voxel) += this_voxel_dir.normalise() * (lstdi ? (1.0 / float(voxels.length)) : 1.0);
       }
     }
 
+};
+
+
+
+
+// Each thread reads batches of tracks from the shared reader, and maps
+// them into its own partial density map. The partial maps are summed
+// once all tracks have been processed.
+template <class T, class W> class MapThreader
+{
+
+  public:
+    MapThreader (DWI::Tractography::Reader& file, Image::Position& pos, const Math::Matrix& interp_matrix, const float fraction_scaling_factor, const bool length_scaled) :
+      reader (file),
+      output (pos)
+    {
+      num_threads = File::Config::get_int ("NumberOfThreads", 1);
+      if (num_threads < 1) num_threads = 1;
+      for (int n = 0; n < num_threads; ++n) {
+        mappers.push_back (new TrackMapper<T> (pos, interp_matrix));
+        writers.push_back (new W (pos.image.header(), fraction_scaling_factor, length_scaled));
+      }
+    }
+
+    ~MapThreader ()
+    {
+      for (int n = 0; n < num_threads; ++n) {
+        delete mappers[n];
+        delete writers[n];
+      }
+    }
+
+    void run (const size_t num_tracks, const String& message)
+    {
+      info ("launching " + str (num_threads) + " threads");
+      ProgressBar::init (num_tracks, message);
+
+      Glib::Thread* threads[num_threads];
+      for (int n = 0; n < num_threads; ++n)
+        threads[n] = Glib::Thread::create (sigc::bind<TrackMapper<T>*,W*> (sigc::mem_fun (*this, &MapThreader::execute), mappers[n], writers[n]), true);
+      for (int n = 0; n < num_threads; ++n)
+        threads[n]->join();
+
+      ProgressBar::done();
+
+      for (int n = 1; n < num_threads; ++n)
+        writers[0]->add (*writers[n]);
+      writers[0]->save (output);
+    }
 
   private:
-    Point* buffer;
+    DWI::Tractography::Reader& reader;
+    Image::Position& output;
+    int num_threads;
+    Glib::Mutex mutex;
+    std::vector<TrackMapper<T>*> mappers;
+    std::vector<W*> writers;
+
+    size_t get_tracks (std::vector< std::vector<Point> >& batch)
+    {
+      Glib::Mutex::Lock lock (mutex);
+      size_t n = 0;
+      while (n < batch.size() && reader.next (batch[n])) {
+        ++n;
+        ProgressBar::inc();
+      }
+      return (n);
+    }
+
+    void execute (TrackMapper<T>* mapper, W* writer)
+    {
+      std::vector< std::vector<Point> > batch (TRACK_BATCH_SIZE);
+      size_t num;
+      while ((num = get_tracks (batch))) {
+        for (size_t n = 0; n != num; ++n) {
+          T mapped_voxels;
+          mapper->map (batch[n], mapped_voxels);
+          writer->write (mapped_voxels);
+        }
+      }
+    }
 
 };
 
@@ -631,6 +779,7 @@ void oversample_header (Image::Header& header, const std::vector<float>& voxel_s
 
 
 EXECUTE {
+  if (!Glib::thread_supported()) Glib::thread_init();
 
   DWI::Tractography::Properties properties;
   DWI::Tractography::Reader file;
@@ -715,7 +864,6 @@ EXECUTE {
   }
 
   Math::Matrix interp_matrix (gen_interp_matrix (resample_factor));
-  std::vector<Point> tck;
 
   if (colour) {
 
@@ -729,18 +877,9 @@ EXECUTE {
     header.axes.desc[3] = "direction";
     header.comments.push_back (std::string ("coloured track density map"));
 
-    Image::Position          pos    (*argument[1].get_image (header));
-    TrackMapper<SetVoxelDir> mapper (pos, interp_matrix);
-    MapWriterColour          writer (pos, scaling_factor, lstdi);
-
-    ProgressBar::init (num_tracks, "mapping tracks to colour image... ");
-    while (file.next (tck)) {
-      SetVoxelDir mapped_voxels;
-      mapper.map (tck, mapped_voxels);
-      writer.write (mapped_voxels);
-      ProgressBar::inc();
-    }
-    ProgressBar::done();
+    Image::Position                               pos      (*argument[1].get_image (header));
+    MapThreader<SetVoxelDir, MapWriterColour>     threader (file, pos, interp_matrix, scaling_factor, lstdi);
+    threader.run (num_tracks, "mapping tracks to colour image... ");
 
   } 
   else {
@@ -748,38 +887,17 @@ EXECUTE {
     header.axes.set_ndim(3);
     header.comments.push_back (std::string (("track ") + str(fibre_fraction ? "fraction" : "count") + " map" + str (lstdi ? ", scaled by inverse track length" : "")));
 
-    Image::Position       pos    (*argument[1].get_image(header));
-    TrackMapper<SetVoxel> mapper (pos, interp_matrix);
+    Image::Position pos (*argument[1].get_image(header));
 
     if (fibre_fraction || lstdi) {
-
-      MapWriter<float> writer (pos, scaling_factor, lstdi);
-
-      ProgressBar::init (num_tracks, "mapping tracks to image... ");
-      while (file.next (tck)) {
-        SetVoxel mapped_voxels;
-        mapper.map (tck, mapped_voxels);
-        writer.write (mapped_voxels);
-        ProgressBar::inc();
-      }
-      ProgressBar::done();
-
-    } else {
-
-      MapWriter<uint32_t> writer (pos, scaling_factor, lstdi);
-
-      ProgressBar::init (num_tracks, "mapping tracks to image... ");
-      while (file.next (tck)) {
-        SetVoxel mapped_voxels;
-        mapper.map (tck, mapped_voxels);
-        writer.write (mapped_voxels);
-        ProgressBar::inc();
-      }
-      ProgressBar::done();
-
+      MapThreader<SetVoxel, MapWriter<float> > threader (file, pos, interp_matrix, scaling_factor, lstdi);
+      threader.run (num_tracks, "mapping tracks to image... ");
+    } 
+    else {
+      MapThreader<SetVoxel, MapWriter<uint32_t> > threader (file, pos, interp_matrix, scaling_factor, lstdi);
+      threader.run (num_tracks, "mapping tracks to image... ");
     }
 
-
   }
 
 }
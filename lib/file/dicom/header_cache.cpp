@@ -0,0 +1,239 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <fstream>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <glibmm/miscutils.h>
+#include <glibmm/stringutils.h>
+
+#include "file/config.h"
+#include "file/dicom/header_cache.h"
+
+#ifdef G_OS_WIN32
+#define CACHE_FILE "mrtrix_dicom_cache"
+#else
+#define CACHE_FILE ".mrtrix_dicom_cache"
+#endif
+
+#define CACHE_FIRST_LINE "mrtrix DICOM header cache 1"
+#define CACHE_NUM_FIELDS 21
+
+namespace MR {
+  namespace File {
+    namespace Dicom {
+
+      namespace {
+
+        // the cache holds one tab-separated entry per line, so tabs and
+        // newlines within the DICOM strings need to be escaped:
+        String escape (const String& s)
+        {
+          String r;
+          for (String::const_iterator c = s.begin(); c != s.end(); ++c) {
+            switch (*c) {
+              case '\\': r += "\\\\"; break;
+              case '\t': r += "\\t"; break;
+              case '\n': r += "\\n"; break;
+              case '\r': r += "\\r"; break;
+              default: r += *c;
+            }
+          }
+          return (r);
+        }
+
+        String unescape (const String& s)
+        {
+          String r;
+          for (String::const_iterator c = s.begin(); c != s.end(); ++c) {
+            if (*c == '\\' && c+1 != s.end()) {
+              ++c;
+              switch (*c) {
+                case 't': r += '\t'; break;
+                case 'n': r += '\n'; break;
+                case 'r': r += '\r'; break;
+                default: r += *c;
+              }
+            }
+            else r += *c;
+          }
+          return (r);
+        }
+
+      }
+
+
+
+
+
+      HeaderCache::HeaderCache () : modified (false)
+      {
+        if (!Config::get_bool ("DICOM.HeaderCache", true)) return;
+        filename = Config::get ("DICOM.HeaderCacheFile");
+        if (filename.empty()) filename = Glib::build_filename (Glib::get_home_dir(), CACHE_FILE);
+
+        std::ifstream in (filename.c_str());
+        if (!in) return;
+
+        String line;
+        std::getline (in, line);
+        if (line != CACHE_FIRST_LINE) {
+          info ("DICOM header cache \"" + filename + "\" is not in the expected format - ignored");
+          return;
+        }
+
+        while (std::getline (in, line)) {
+          std::vector<String> V (split (line, "\t"));
+          if (V.size() != 4 && V.size() != CACHE_NUM_FIELDS) continue;
+
+          Entry entry;
+          entry.header.filename = unescape (V[0]);
+          entry.mtime = to<gint64> (V[1]);
+          entry.size = to<gint64> (V[2]);
+          entry.failed = V[3] != "0";
+
+          if (!entry.failed) {
+            if (V.size() != CACHE_NUM_FIELDS) continue;
+            QuickScan& H (entry.header);
+            H.modality = unescape (V[4]);
+            H.patient = unescape (V[5]);
+            H.patient_ID = unescape (V[6]);
+            H.patient_DOB = unescape (V[7]);
+            H.study = unescape (V[8]);
+            H.study_ID = unescape (V[9]);
+            H.study_date = unescape (V[10]);
+            H.study_time = unescape (V[11]);
+            H.series = unescape (V[12]);
+            H.series_date = unescape (V[13]);
+            H.series_time = unescape (V[14]);
+            H.sequence = unescape (V[15]);
+            H.series_number = to<guint> (V[16]);
+            H.bits_alloc = to<guint> (V[17]);
+            H.dim[0] = to<guint> (V[18]);
+            H.dim[1] = to<guint> (V[19]);
+            H.data = to<guint> (V[20]);
+          }
+
+          entries[entry.header.filename] = entry;
+        }
+
+        debug ("read " + str (entries.size()) + " entries from DICOM header cache \"" + filename + "\"");
+      }
+
+
+
+
+
+      const HeaderCache::Entry* HeaderCache::find (const String& path, gint64 mtime, gint64 size) const
+      {
+        std::map<String,Entry>::const_iterator entry = entries.find (path);
+        if (entry == entries.end()) return (NULL);
+        if (entry->second.mtime != mtime || entry->second.size != size) return (NULL);
+        return (&entry->second);
+      }
+
+
+
+
+
+      void HeaderCache::update (const String& folder, const std::vector<Entry>& scanned)
+      {
+        if (!enabled()) return;
+
+        // all paths within folder sort between folder + '/' and folder + '0',
+        // since '0' immediately follows '/' in ASCII:
+        String prefix (folder);
+        if (prefix.empty() || prefix[prefix.size()-1] != G_DIR_SEPARATOR) prefix += G_DIR_SEPARATOR;
+        String end (prefix.substr (0, prefix.size()-1) + char (G_DIR_SEPARATOR + 1));
+        std::map<String,Entry>::iterator first = entries.lower_bound (prefix);
+        std::map<String,Entry>::iterator last = entries.lower_bound (end);
+
+        guint num_removed = 0;
+        for (std::map<String,Entry>::iterator entry = first; entry != last; ++entry) num_removed++;
+        entries.erase (first, last);
+
+        guint num_changed = 0;
+        for (guint n = 0; n < scanned.size(); n++) {
+          Entry& entry (entries[scanned[n].header.filename]);
+          if (entry.mtime != scanned[n].mtime || entry.size != scanned[n].size) num_changed++;
+          entry = scanned[n];
+        }
+
+        if (num_changed || num_removed != scanned.size()) 
+          modified = true;
+      }
+
+
+
+
+
+      void HeaderCache::save ()
+      {
+        if (!enabled() || !modified) return;
+
+        // write to a temporary file first, so that other processes never
+        // see a partially written cache:
+        String tmpname (filename + "." + str (getpid()));
+        std::ofstream out (tmpname.c_str());
+        if (!out) {
+          info ("error creating DICOM header cache \"" + filename + "\": " + Glib::strerror (errno));
+          return;
+        }
+
+        out << CACHE_FIRST_LINE << "\n";
+        for (std::map<String,Entry>::const_iterator i = entries.begin(); i != entries.end(); ++i) {
+          const Entry& entry (i->second);
+          out << escape (i->first) << "\t" << entry.mtime << "\t" << entry.size << "\t" << ( entry.failed ? "1" : "0" );
+          if (!entry.failed) {
+            const QuickScan& H (entry.header);
+            out << "\t" << escape (H.modality) 
+              << "\t" << escape (H.patient) << "\t" << escape (H.patient_ID) << "\t" << escape (H.patient_DOB) 
+              << "\t" << escape (H.study) << "\t" << escape (H.study_ID) << "\t" << escape (H.study_date) << "\t" << escape (H.study_time) 
+              << "\t" << escape (H.series) << "\t" << escape (H.series_date) << "\t" << escape (H.series_time) 
+              << "\t" << escape (H.sequence) << "\t" << H.series_number << "\t" << H.bits_alloc 
+              << "\t" << H.dim[0] << "\t" << H.dim[1] << "\t" << H.data;
+          }
+          out << "\n";
+        }
+        out.close();
+
+        if (!out) {
+          info ("error writing DICOM header cache \"" + filename + "\"");
+          g_unlink (tmpname.c_str());
+          return;
+        }
+
+#ifdef G_OS_WIN32
+        g_unlink (filename.c_str());
+#endif
+        if (g_rename (tmpname.c_str(), filename.c_str())) {
+          info ("error updating DICOM header cache \"" + filename + "\": " + Glib::strerror (errno));
+          g_unlink (tmpname.c_str());
+          return;
+        }
+
+        modified = false;
+        debug ("wrote " + str (entries.size()) + " entries to DICOM header cache \"" + filename + "\"");
+      }
+
+    }
+  }
+}
+
@@ -0,0 +1,81 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __file_dicom_header_cache_h__
+#define __file_dicom_header_cache_h__
+
+#include <map>
+#include "file/dicom/quick_scan.h"
+
+namespace MR {
+  namespace File {
+    namespace Dicom {
+
+      //! a persistent record of the DICOM headers scanned previously
+      /*! This keeps the relevant contents of the DICOM headers already
+       * scanned in a file in the user's home folder (or wherever the \c
+       * DICOM.HeaderCacheFile configuration key specifies), keyed by the
+       * full path of each file, along with its size and modification time.
+       * A file is only re-read if its size or modification time has changed.
+       * Files found not to be DICOM images are also recorded, so that they
+       * need not be checked again either.
+       *
+       * The cache can be disabled by setting the \c DICOM.HeaderCache
+       * configuration key to false. */
+      class HeaderCache {
+        public:
+          class Entry {
+            public:
+              Entry () : mtime (0), size (0), failed (true) { }
+              gint64    mtime, size;
+              bool      failed; //!< whether QuickScan::read() failed for this file
+              QuickScan header;
+          };
+
+          HeaderCache ();
+
+          bool  enabled () const { return (filename.size()); }
+
+          //! the entry for \p path, or NULL if the file has changed or was never scanned
+          /*! This can safely be called from several threads at once, as
+           * long as update() is not being called at the same time. */
+          const Entry* find (const String& path, gint64 mtime, gint64 size) const;
+
+          //! replace all entries in \p folder by those in \p scanned 
+          /*! Any entries previously recorded within \p folder (which must
+           * be a full path) and not present in \p scanned are assumed to
+           * have been deleted, and are removed from the cache. */
+          void  update (const String& folder, const std::vector<Entry>& scanned);
+
+          //! write the cache back to file, if it has been modified
+          void  save ();
+
+        protected:
+          String  filename;
+          std::map<String,Entry> entries;
+          bool    modified;
+      };
+
+    }
+  }
+}
+
+#endif
+
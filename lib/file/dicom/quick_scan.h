@@ -36,6 +36,9 @@ namespace MR {
       class QuickScan {
 
         public:
+          //! returns true if \p file_name could not be read as a DICOM image
+          /*! Any errors encountered are reported as usual: callers should
+           * use Exception::Lower to silence them if appropriate. */
           bool read (const String& file_name, bool print_DICOM_fields = false, bool print_CSA_fields = false);
 
           String      filename, modality;
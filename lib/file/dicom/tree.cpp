@@ -28,11 +28,16 @@
     15-03-2010 J-Donald Tournier <d.tournier@brain.org.au>
     * add shorten() function to reduce long filenames 
 
+    * scan DICOM folders using multiple threads, and keep a record of the
+    headers found in a persistent cache (see HeaderCache)
+
 */
 
+#include <glib/gstdio.h>
 #include <glibmm/fileutils.h>
 #include <glibmm/stringutils.h>
 #include <glibmm/miscutils.h>
+#include <glibmm/thread.h>
 
 #include "file/dicom/element.h"
 #include "file/dicom/quick_scan.h"
@@ -41,11 +46,147 @@
 #include "file/dicom/study.h"
 #include "file/dicom/patient.h"
 #include "file/dicom/tree.h"
+#include "file/dicom/header_cache.h"
+#include "file/config.h"
 
 namespace MR {
   namespace File {
     namespace Dicom {
 
+      namespace {
+
+        // scan a folder recursively using multiple threads. Each thread
+        // takes the next path from a shared queue: folders are listed and
+        // their contents added to the queue, while files are either looked
+        // up in the header cache or read. Since scanning network storage is
+        // mostly limited by latency rather than CPU, the number of threads
+        // is set independently from NumberOfThreads.
+        class Scanner {
+          public:
+            Scanner (const String& folder, const HeaderCache& header_cache) :
+              num_read (0), cache (header_cache), busy (0), num_scanned (0), finished (false) { queue.push_back (folder); }
+
+            std::vector<HeaderCache::Entry> results;
+            guint num_read;
+
+            void run ()
+            {
+              int num_threads = Config::get_int ("DICOM.ScanThreads", 8);
+              if (num_threads < 1) num_threads = 1;
+
+              // errors encountered in QuickScan::read() are not to be
+              // reported. The level offset is global, so it can only be set
+              // here, rather than within each thread:
+              Exception::Lower l (2);
+
+              std::vector<Glib::Thread*> threads (num_threads);
+              for (int n = 0; n < num_threads; n++) 
+                threads[n] = Glib::Thread::create (sigc::mem_fun (*this, &Scanner::execute), true);
+
+              // update the progress bar from this thread only, since the
+              // display may not be thread-safe (e.g. in MRView):
+              {
+                guint shown = 0;
+                Glib::Mutex::Lock lock (mutex);
+                while (!finished) {
+                  Glib::TimeVal until;
+                  until.assign_current_time();
+                  until.add_milliseconds (100);
+                  done.timed_wait (mutex, until);
+                  for (; shown < num_scanned; shown++) 
+                    ProgressBar::inc();
+                }
+              }
+
+              for (int n = 0; n < num_threads; n++) 
+                threads[n]->join();
+
+              if (error.size()) throw Exception (error);
+            }
+
+          private:
+            const HeaderCache& cache;
+            std::vector<String> queue;
+            guint busy, num_scanned;
+            bool finished;
+            String error;
+            Glib::Mutex mutex;
+            Glib::Cond work, done;
+
+            void execute ()
+            {
+              Glib::Mutex::Lock lock (mutex);
+              while (true) {
+                while (queue.empty() && busy) work.wait (mutex);
+                if (queue.empty()) {
+                  finished = true;
+                  work.broadcast();
+                  done.signal();
+                  return;
+                }
+
+                String path (queue.back());
+                queue.pop_back();
+                busy++;
+
+                lock.release();
+                process (path);
+                lock.acquire();
+
+                busy--;
+                if (queue.empty() && !busy) work.broadcast();
+              }
+            }
+
+            void process (const String& path)
+            {
+              struct_stat64 sbuf;
+              if (STAT64 (path.c_str(), &sbuf)) return;
+
+              if (S_ISDIR (sbuf.st_mode)) {
+                std::vector<String> contents;
+                try { 
+                  Glib::Dir folder (path); 
+                  String entry;
+                  while ((entry = folder.read_name()).size()) 
+                    contents.push_back (Glib::build_filename (path, entry));
+                }
+                catch (...) { 
+                  Glib::Mutex::Lock lock (mutex);
+                  if (error.empty()) error = "error opening DICOM folder \"" + path + "\": " + Glib::strerror (errno);
+                  queue.clear();
+                  return;
+                }
+
+                Glib::Mutex::Lock lock (mutex);
+                queue.insert (queue.end(), contents.begin(), contents.end());
+                work.broadcast();
+                return;
+              }
+
+              HeaderCache::Entry entry;
+              entry.mtime = sbuf.st_mtime;
+              entry.size = sbuf.st_size;
+              const HeaderCache::Entry* cached = cache.find (path, entry.mtime, entry.size);
+              if (cached) entry = *cached;
+              else entry.failed = entry.header.read (path);
+
+              Glib::Mutex::Lock lock (mutex);
+              results.push_back (entry);
+              num_scanned++;
+              if (!cached) num_read++;
+            }
+        };
+
+        bool compare_filename (const HeaderCache::Entry& a, const HeaderCache::Entry& b) 
+        {
+          return (a.header.filename < b.header.filename);
+        }
+
+      }
+
+
+
       RefPtr<Patient> Tree::find (const String& patient_name, const String& patient_ID, const String& patient_DOB)
       {
         bool match;
@@ -74,20 +215,28 @@ namespace MR {
 
       void Tree::read_dir (const String& filename)
       {
-        try { 
-          Glib::Dir folder (filename); 
-          String entry;
-          while ((entry = folder.read_name()).size()) {
-            String name (Glib::build_filename (filename, entry));
-            if (Glib::file_test (name, Glib::FILE_TEST_IS_DIR)) read_dir (name);
-            else {
-              try { read_file (name); }
-              catch (Exception) { }
-            }
-            ProgressBar::inc();
-          }
-        }
-        catch (...) { throw Exception ("error opening DICOM folder \"" + filename + "\": " + Glib::strerror (errno)); }
+        // use full paths, so that the cache entries remain valid regardless
+        // of the current working directory:
+        String folder (Glib::path_is_absolute (filename) ? filename : Glib::build_filename (Glib::get_current_dir(), filename));
+
+        // the Scanner's mutex must not be created before the thread system
+        // is initialised:
+        if (!Glib::thread_supported()) Glib::thread_init();
+
+        HeaderCache cache;
+        Scanner scanner (folder, cache);
+        scanner.run();
+
+        debug ("scanned " + str (scanner.results.size()) + " files in DICOM folder \"" + folder 
+            + "\" (" + str (scanner.num_read) + " read, " + str (scanner.results.size() - scanner.num_read) + " from cache)");
+
+        // the order in which the files were scanned is not reproducible:
+        std::sort (scanner.results.begin(), scanner.results.end(), compare_filename);
+        for (guint n = 0; n < scanner.results.size(); n++) 
+          add (scanner.results[n].header, scanner.results[n].failed);
+
+        cache.update (folder, scanner.results);
+        cache.save();
       }
 
 
@@ -97,7 +246,22 @@ namespace MR {
       void Tree::read_file (const String& filename)
       {
         QuickScan reader;
-        if (reader.read (filename)) {
+        bool failed;
+        {
+          Exception::Lower l (2);
+          failed = reader.read (filename);
+        }
+        add (reader, failed);
+      }
+
+
+
+
+
+      void Tree::add (const QuickScan& reader, bool failed)
+      {
+        const String& filename (reader.filename);
+        if (failed) {
           info ("error reading file \"" + filename + "\" - assuming not DICOM"); 
           return;
         }
@@ -32,11 +32,13 @@ namespace MR {
 
       class Series; 
       class Patient;
+      class QuickScan;
 
       class Tree : public std::vector< RefPtr<Patient> > { 
         protected:
           void    read_dir (const String& filename);
           void    read_file (const String& filename);
+          void    add (const QuickScan& reader, bool failed);
          
         public:
           String    description;
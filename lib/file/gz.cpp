@@ -0,0 +1,290 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <glib/gstdio.h>
+#include <glibmm/stringutils.h>
+#include <glibmm/thread.h>
+
+#include "file/gz.h"
+#include "file/config.h"
+#include "get_set.h"
+
+#define GZ_BLOCK_SIZE 1048576
+#define GZ_DICTIONARY_SIZE 32768
+#define GZ_BLOCKS_IN_FLIGHT_PER_THREAD 4
+
+namespace MR {
+  namespace File {
+
+    namespace {
+
+      class Block {
+        public:
+          const guint8* data;
+          gsize         size;
+          gsize         dict_size;
+          bool          last, done;
+          uLong         crc;
+          std::vector<guint8> out;
+      };
+
+
+
+      // deflate the blocks concurrently: worker threads claim the next
+      // block, while the calling thread writes out completed blocks in
+      // order. Workers never run more than a fixed number of blocks ahead
+      // of the writer, so that memory use remains bounded.
+      class Deflater {
+        public:
+          Deflater (std::vector<Block>& block_list, int compression_level, guint num_threads) : 
+            blocks (block_list), level (compression_level), window (num_threads * GZ_BLOCKS_IN_FLIGHT_PER_THREAD),
+            next (0), written (0), failed (false) { }
+
+          void execute () 
+          {
+            z_stream strm;
+            memset (&strm, 0, sizeof (z_stream));
+            if (deflateInit2 (&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+              abort();
+              return;
+            }
+
+            while (true) {
+              guint n;
+              {
+                Glib::Mutex::Lock lock (mutex);
+                while (!failed && next < blocks.size() && next >= written + window) cond.wait (mutex);
+                if (failed || next >= blocks.size()) break;
+                n = next++;
+              }
+
+              bool ok = compress (strm, blocks[n]);
+
+              Glib::Mutex::Lock lock (mutex);
+              if (!ok) failed = true;
+              blocks[n].done = true;
+              cond.broadcast();
+            }
+
+            deflateEnd (&strm);
+          }
+
+          // returns false if the operation failed:
+          bool wait_for (guint n)
+          {
+            Glib::Mutex::Lock lock (mutex);
+            while (!failed && !blocks[n].done) cond.wait (mutex);
+            return (!failed);
+          }
+
+          void release (guint n)
+          {
+            std::vector<guint8>().swap (blocks[n].out);
+            Glib::Mutex::Lock lock (mutex);
+            written = n+1;
+            cond.broadcast();
+          }
+
+          void abort () 
+          {
+            Glib::Mutex::Lock lock (mutex);
+            failed = true;
+            cond.broadcast();
+          }
+
+        protected:
+          std::vector<Block>& blocks;
+          int   level;
+          guint window, next, written;
+          bool  failed;
+          Glib::Mutex mutex;
+          Glib::Cond  cond;
+
+          bool compress (z_stream& strm, Block& block) 
+          {
+            if (deflateReset (&strm) != Z_OK) return (false);
+            if (block.dict_size) 
+              if (deflateSetDictionary (&strm, block.data - block.dict_size, block.dict_size) != Z_OK) return (false);
+
+            // room for the sync flush marker on top of the worst-case expansion:
+            block.out.resize (deflateBound (&strm, block.size) + 16);
+            strm.next_in = (Bytef*) block.data;
+            strm.avail_in = block.size;
+            strm.next_out = &block.out[0];
+            strm.avail_out = block.out.size();
+
+            int status = deflate (&strm, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (strm.avail_in || status != ( block.last ? Z_STREAM_END : Z_OK )) return (false);
+
+            block.out.resize (block.out.size() - strm.avail_out);
+            block.crc = crc32 (crc32 (0L, Z_NULL, 0), block.data, block.size);
+            return (true);
+          }
+      };
+
+
+
+      void add_blocks (std::vector<Block>& blocks, const guint8* data, gsize size) 
+      {
+        for (gsize pos = 0; pos < size; pos += GZ_BLOCK_SIZE) {
+          Block block;
+          block.data = data + pos;
+          block.size = MIN (gsize (GZ_BLOCK_SIZE), size - pos);
+          block.dict_size = MIN (gsize (GZ_DICTIONARY_SIZE), pos);
+          block.last = block.done = false;
+          block.crc = 0;
+          blocks.push_back (block);
+        }
+      }
+
+    }
+
+
+
+
+    void GZ::open (const String& fname)
+    {
+      close();
+      debug ("opening GZIP file \"" + fname + "\"...");
+      gz = gzopen (fname.c_str(), "rb");
+      if (!gz) throw Exception ("error opening GZIP file \"" + fname + "\": " + Glib::strerror (errno));
+#if ZLIB_VERNUM >= 0x1240
+      gzbuffer (gz, 262144);
+#endif
+      filename = fname;
+    }
+
+
+
+
+    void GZ::close ()
+    {
+      if (gz) gzclose (gz);
+      gz = NULL;
+      filename.clear();
+    }
+
+
+
+
+    void GZ::read (void* data, gsize count)
+    {
+      assert (gz);
+      guint8* p = (guint8*) data;
+      while (count) {
+        unsigned int n = MIN (count, gsize (G_MAXINT/2));
+        int num_read = gzread (gz, p, n);
+        if (num_read < 0) {
+          int errnum;
+          const gchar* msg = gzerror (gz, &errnum);
+          throw Exception ("error uncompressing GZIP file \"" + filename + "\": " + ( errnum == Z_ERRNO ? Glib::strerror (errno) : String (msg) ));
+        }
+        if (num_read == 0) 
+          throw Exception ("unexpected end of GZIP file \"" + filename + "\"");
+        p += num_read;
+        count -= num_read;
+      }
+    }
+
+
+
+
+    String GZ::getline ()
+    {
+      assert (gz);
+      String line;
+      gchar buf[1024];
+      while (gzgets (gz, buf, sizeof (buf))) {
+        line += buf;
+        if (line[line.size()-1] == '\n') break;
+      }
+      return (line);
+    }
+
+
+
+
+    void GZ::write (const String& fname, const guint8* header, gsize header_size, const guint8* data, gsize data_size)
+    {
+      int level = Config::get_int ("GZipLevel", 6);
+      if (level < 0 || level > 9) throw Exception ("invalid GZipLevel in configuration file (expected 0 to 9)");
+
+      int num_threads = Config::get_int ("NumberOfThreads", 1);
+      if (num_threads < 1) num_threads = 1;
+
+      std::vector<Block> blocks;
+      add_blocks (blocks, header, header_size);
+      add_blocks (blocks, data, data_size);
+      if (blocks.empty()) {
+        Block block;
+        block.data = data;
+        block.size = block.dict_size = 0;
+        block.done = false;
+        block.crc = 0;
+        blocks.push_back (block);
+      }
+      blocks.back().last = true;
+
+      info ("writing compressed data to \"" + fname + "\" (" + str (num_threads) + " thread" + ( num_threads > 1 ? "s" : "" ) + ")...");
+
+      FILE* out = g_fopen (fname.c_str(), "wb");
+      if (!out) throw Exception ("error creating file \"" + fname + "\": " + Glib::strerror (errno));
+
+      // standard GZIP header: no file name, no time stamp, Unix OS:
+      const guint8 gz_header [] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+      bool write_ok = fwrite (gz_header, sizeof (gz_header), 1, out) == 1;
+
+      if (!Glib::thread_supported()) Glib::thread_init();
+      Deflater deflater (blocks, level, num_threads);
+      std::vector<Glib::Thread*> threads (num_threads);
+      for (int n = 0; n < num_threads; n++) 
+        threads[n] = Glib::Thread::create (sigc::mem_fun (deflater, &Deflater::execute), true);
+
+      uLong crc = crc32 (0L, Z_NULL, 0);
+      guint32 total = 0;
+      bool deflate_ok = true;
+      for (guint n = 0; n < blocks.size() && write_ok; n++) {
+        if (!(deflate_ok = deflater.wait_for (n))) break;
+        if (blocks[n].out.size()) 
+          write_ok = fwrite (&blocks[n].out[0], blocks[n].out.size(), 1, out) == 1;
+        crc = crc32_combine (crc, blocks[n].crc, blocks[n].size);
+        total += blocks[n].size;
+        deflater.release (n);
+      }
+
+      if (!write_ok) deflater.abort();
+      for (int n = 0; n < num_threads; n++) threads[n]->join();
+
+      if (write_ok && deflate_ok) {
+        guint8 trailer [8];
+        putLE<guint32> (crc, trailer);
+        putLE<guint32> (total, trailer + 4);
+        write_ok = fwrite (trailer, sizeof (trailer), 1, out) == 1;
+      }
+
+      if (fclose (out)) write_ok = false;
+
+      if (!deflate_ok) throw Exception ("error compressing data for GZIP file \"" + fname + "\"");
+      if (!write_ok) throw Exception ("error writing GZIP file \"" + fname + "\": " + Glib::strerror (errno));
+    }
+
+  }
+}
+
@@ -0,0 +1,68 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __file_gz_h__
+#define __file_gz_h__
+
+#include <zlib.h>
+#include "mrtrix.h"
+
+namespace MR {
+  namespace File {
+
+    //! read access to a GZIP-compressed file
+    /*! Data are inflated straight into the buffer supplied, so that the
+     * contents of a compressed file can be loaded into memory without going
+     * through a temporary file. All errors are reported by throwing an
+     * Exception. */
+    class GZ {
+      public:
+        GZ () : gz (NULL) { }
+        GZ (const String& fname) : gz (NULL) { open (fname); }
+        ~GZ () { close(); }
+
+        void          open (const String& fname);
+        void          close ();
+        const String& name () const { return (filename); }
+
+        //! inflate exactly \a count bytes into \a data
+        void          read (void* data, gsize count);
+        //! read up to and including the next newline character
+        String        getline ();
+
+        //! compress \a header followed by \a data to the GZIP file \a fname
+        /*! The data are split into independent blocks and deflated by
+         * several threads concurrently (as given by the \c NumberOfThreads
+         * configuration key), with each block primed with the end of the
+         * previous one as its dictionary. The output is a single standard
+         * GZIP stream. The compression level is given by the \c GZipLevel
+         * configuration key (default: 6). */
+        static void   write (const String& fname, const guint8* header, gsize header_size, const guint8* data, gsize data_size);
+
+      protected:
+        String filename;
+        gzFile gz;
+    };
+
+  }
+}
+
+#endif
+
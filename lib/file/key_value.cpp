@@ -35,15 +35,37 @@ namespace MR {
 
       in.open (file.c_str(), std::ios::in | std::ios::binary);
       if (!in) throw Exception ("failed to open key/value file \"" + file + "\": " + Glib::strerror(errno));
+      stream = &in;
+      check_first_line (file, first_line);
+      filename = file;
+    }
+
+
+
+
+    void KeyValue::open_text (const String& contents, const String& file, const gchar* first_line)
+    {
+      filename.clear();
+      text.clear();
+      text.str (contents);
+      stream = &text;
+      check_first_line (file, first_line);
+      filename = file;
+    }
+
+
+
+
+    void KeyValue::check_first_line (const String& file, const gchar* first_line)
+    {
       if (first_line) {
         String sbuf;
-        getline (in, sbuf);
+        getline (*stream, sbuf);
         if (sbuf.compare (0, strlen (first_line), first_line)) {
-          in.close();
+          if (stream == &in) in.close();
           throw Exception ("invalid first line for key/value file \"" + file + "\" (expected \"" + first_line + "\")");
         }
       }
-      filename = file;
     }
 
 
@@ -52,14 +74,14 @@ namespace MR {
 
     bool KeyValue::next ()
     {
-      while (in.good()) {
+      while (stream->good()) {
         String sbuf;
-        getline (in, sbuf);
-        if (in.bad()) throw Exception ("error reading key/value file \"" + filename + "\": " + Glib::strerror (errno));
+        getline (*stream, sbuf);
+        if (stream->bad()) throw Exception ("error reading key/value file \"" + filename + "\": " + Glib::strerror (errno));
 
         sbuf = strip (sbuf.substr (0, sbuf.find_first_of ('#')));
         if (sbuf == "END") {
-          in.setstate (std::ios::eofbit);
+          stream->setstate (std::ios::eofbit);
           return (false);
         }
 
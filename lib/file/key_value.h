@@ -24,6 +24,7 @@
 #define __file_key_value_h__
 
 #include <fstream>
+#include <sstream>
 #include "mrtrix.h"
 
 namespace MR {
@@ -31,10 +32,12 @@ namespace MR {
 
     class KeyValue {
       public:
-        KeyValue () { }
-        KeyValue (const String& file, const gchar* first_line = NULL) { open (file, first_line); }
+        KeyValue () : stream (&in) { }
+        KeyValue (const String& file, const gchar* first_line = NULL) : stream (&in) { open (file, first_line); }
 
         void  open (const String& file, const gchar* first_line = NULL);
+        //! parse key/value pairs already held in memory, as read from \a file
+        void  open_text (const String& contents, const String& file, const gchar* first_line = NULL);
         bool  next ();
         void  close () { in.close(); }
 
@@ -45,6 +48,10 @@ namespace MR {
       protected:
         String K, V, filename;
         std::ifstream in;
+        std::istringstream text;
+        std::istream* stream;
+
+        void  check_first_line (const String& file, const gchar* first_line);
     };
 
   }
@@ -29,6 +29,7 @@ namespace MR {
 
     const Format::Base* Object::handlers[] = {
       new Format::MRtrix,
+      new Format::Tiled,
       new Format::MRI,
       new Format::NIfTI,
       new Format::Analyse,
@@ -42,6 +43,7 @@ namespace MR {
       ".mih",
       ".mif",
       ".mif.gz",
+      ".mit",
       ".img",
       ".nii",
       ".nii.gz",
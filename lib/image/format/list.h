@@ -45,6 +45,7 @@ namespace MR {
       DECLARE_IMAGEFORMAT (MRI);
       DECLARE_IMAGEFORMAT (XDS);
       DECLARE_IMAGEFORMAT (MRtrix);
+      DECLARE_IMAGEFORMAT (Tiled);
       DECLARE_IMAGEFORMAT (DICOM);
 
     }
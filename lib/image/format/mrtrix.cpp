@@ -25,7 +25,6 @@
 */
 
 #include <unistd.h>
-#include <zlib.h>
 #include <fcntl.h>
 #include <glib/gstdio.h>
 #include <glibmm/stringutils.h>
@@ -34,6 +33,8 @@
 #include "image/header.h"
 #include "image/mapper.h"
 #include "file/key_value.h"
+#include "file/gz.h"
+#include "image/format/mrtrix_utils.h"
 #include "image/format/list.h"
 #include "image/name_parser.h"
 
@@ -57,99 +58,28 @@ namespace MR {
       { 
         if (!Glib::str_has_suffix (H.name, ".mih") && !Glib::str_has_suffix (H.name, ".mif") && !Glib::str_has_suffix (H.name, ".mif.gz")) return (false);
 
+        // for compressed images, only the header is inflated at this
+        // stage - the data are read straight into memory further down: 
         File::KeyValue kv;
-        String gzfilename;
-	if (Glib::str_has_suffix (H.name, ".gz")) {
-          gzfilename = H.name;
-          kv.open (Mapper::gunzip (H.name, "mif"), "mrtrix image");
+        File::GZ zf;
+        String gzheader;
+        if (Glib::str_has_suffix (H.name, ".gz")) {
+          zf.open (H.name);
+          String line;
+          do {
+            line = zf.getline();
+            if (line.empty()) throw Exception ("unexpected end of file in header of image \"" + H.name + "\"");
+            gzheader += line;
+          } while (strip (line) != "END");
+          kv.open_text (gzheader, H.name, "mrtrix image");
         }
         else 
           kv.open (H.name, "mrtrix image");
 
         H.format = FormatMRtrix;
 
-        String dtype, layout, file;
-        std::vector<int> dim;
-        std::vector<float> transform, dw_scheme, vox, scaling;
-        std::vector<String> units, labels;
-
-        while (kv.next()) {
-          String key = lowercase (kv.key());
-          if (key == "dim") dim = parse_ints (kv.value());
-          else if (key == "vox") vox = parse_floats (kv.value());
-          else if (key == "layout") layout = kv.value();
-          else if (key == "datatype") dtype = kv.value();
-          else if (key == "file") file = kv.value();
-          else if (key == "scaling") scaling = parse_floats (kv.value());
-          else if (key == "comments") H.comments.push_back (kv.value());
-          else if (key == "units") units = split (kv.value(), "\\");
-          else if (key == "labels") labels = split (kv.value(), "\\");
-          else if (key == "transform") { std::vector<float> V (parse_floats (kv.value())); transform.insert (transform.end(), V.begin(), V.end()); }
-          else if (key == "dw_scheme") { std::vector<float> V (parse_floats (kv.value())); dw_scheme.insert (dw_scheme.end(), V.begin(), V.end()); }
-          else debug ("unknown key \"" + kv.key() + " in generic image header \"" + H.name + "\" - ignored");
-        }
-
-        if (dim.empty()) throw Exception ("missing \"dim\" specification for generic image \"" + H.name + "\"");
-        H.axes.set_ndim (dim.size());
-        for (guint n = 0; n < dim.size(); n++) {
-          if (dim[n] < 1) throw Exception ("invalid dimensions for generic image \"" + H.name + "\"");
-          H.axes.dim[n] = dim[n];
-        }
-
-        if (vox.empty()) throw Exception ("missing \"vox\" specification for generic image \"" + H.name + "\"");
-        for (int n = 0; n < H.axes.ndim(); n++) {
-          if (vox[n] < 0.0) throw Exception ("invalid voxel size for generic image \"" + H.name + "\"");
-          H.axes.vox[n] = vox[n];
-        }
-
-
-        if (dtype.empty()) throw Exception ("missing \"datatype\" specification for generic image \"" + H.name + "\"");
-        H.data_type.parse (dtype);
-
-
-        if (layout.empty()) throw Exception ("missing \"layout\" specification for generic image \"" + H.name + "\"");
-        std::vector<Axis> ax = parse_axes_specifier (H.axes, layout);
-        if (ax.size() != (guint) H.axes.ndim()) 
-          throw Exception ("specified layout does not match image dimensions for generic image \"" + H.name + "\"");
-
-        for (guint i = 0; i < ax.size(); i++) {
-          H.axes.axis[i] = ax[i].axis;
-          H.axes.forward[i] = ax[i].forward;
-        }
-
-        for (guint n = 0; n < MIN ((guint) H.axes.ndim(), labels.size()); n++) H.axes.desc[n] = labels[n];
-        for (guint n = 0; n < MIN ((guint) H.axes.ndim(), units.size()); n++) H.axes.units[n] = units[n];
-
-        if (transform.size()) {
-          if (transform.size() < 9) throw Exception ("invalid \"transform\" specification for generic image \"" + H.name + "\"");
-          Math::Matrix T (4,4);
-          int count = 0;
-          for (int row = 0; row < 3; row++) 
-            for (int col = 0; col < 4; col++) 
-              T(row,col) = transform[count++];
-          T(3,0) = T(3,1) = T(3,2) = 0.0; T(3,3) = 1.0;
-          H.set_transform (T);
-        }
-
-
-        if (dw_scheme.size()) {
-          if (dw_scheme.size() % 4) info ("WARNING: invalid \"dw_scheme\" specification for generic image \"" + H.name + "\" - ignored");
-          else {
-            Math::Matrix M (dw_scheme.size()/4, 4);
-            int count = 0;
-            for (guint row = 0; row < M.rows(); row++) 
-              for (guint col = 0; col < 4; col++) 
-                M(row,col) = dw_scheme[count++];
-            H.DW_scheme = M;
-          }
-        }
-
-
-        if (scaling.size()) {
-          if (scaling.size() != 2) throw Exception ("invalid \"scaling\" specification for generic image \"" + H.name + "\"");
-          H.offset = scaling[0];
-          H.scale = scaling[1];
-        }
+        std::map<String,String> other = read_mrtrix_header (kv, H);
+        String file (other["file"]);
 
         if (file.empty()) throw Exception ("missing \"file\" specification for generic image \"" + H.name + "\"");
         std::istringstream files_stream (file);
@@ -163,7 +93,21 @@ namespace MR {
 
         if (fname == ".") {
           if (offset == 0) throw Exception ("invalid offset specified for embedded generic image \"" + H.name + "\""); 
-          dmap.add_gz (kv.name(), gzfilename, offset);
+          if (zf.name().empty()) dmap.add (H.name, offset);
+          else {
+            if (offset < gzheader.size()) 
+              throw Exception ("invalid offset specified for embedded generic image \"" + H.name + "\""); 
+            std::vector<guint8> header (gzheader.begin(), gzheader.end());
+            header.resize (offset);
+            if (offset > gzheader.size()) 
+              zf.read (&header[gzheader.size()], offset - gzheader.size());
+
+            gsize msize = H.memory_footprint();
+            guint8* data = new guint8 [msize];
+            try { zf.read (data, msize); }
+            catch (...) { delete [] data; throw; }
+            dmap.add_gz (H.name, header, data, msize, false);
+          }
         }
         else {
           fname = Glib::build_filename (Glib::path_get_dirname (H.name), fname);
@@ -203,51 +147,9 @@ namespace MR {
         if (!is_temporary (H.name) && Glib::file_test (H.name, Glib::FILE_TEST_IS_REGULAR)) 
           throw Exception ("cannot create generic image file \"" + H.name + "\": file exists");
 
-        String gzfilename, filename (H.name);
-        if (Glib::str_has_suffix (H.name, ".gz")) {
-          gzfilename = H.name;
-          File::MMap fmap ("", 1024, "mif");
-          filename = fmap.name();
-        }
-
-        std::ofstream out (filename.c_str(), std::ios::out | std::ios::binary);
-        if (!out) throw Exception ("error creating file \"" + H.name + "\":" + Glib::strerror(errno));
-
+        std::ostringstream out;
         out << "mrtrix image\n";
-        out << "dim: " << H.axes.dim[0];
-        for (int n = 1; n < H.axes.ndim(); n++) out << "," << H.axes.dim[n];
-
-        out << "\nvox: " << H.axes.vox[0];
-        for (int n = 1; n < H.axes.ndim(); n++) out << "," << H.axes.vox[n];
-
-        out << "\nlayout: " << ( H.axes.forward[0] ? "+" : "-" ) << H.axes.axis[0];
-        for (int n = 1; n < H.axes.ndim(); n++) out << "," << ( H.axes.forward[n] ? "+" : "-" ) << H.axes.axis[n];
-
-        out << "\ndatatype: " << H.data_type.specifier();
-
-        out << "\nlabels: " << H.axes.desc[0];
-        for (int n = 1; n < H.axes.ndim(); n++) out << "\\" << H.axes.desc[n];
-
-        out << "\nunits: " <<  H.axes.units[0];
-        for (int n = 1; n < H.axes.ndim(); n++) out << "\\" << H.axes.units[n];
-
-        for (std::vector<String>::const_iterator i = H.comments.begin(); i != H.comments.end(); i++) 
-          out << "\ncomments: " << *i;
-
-
-        if (H.transform().is_valid()) {
-          out << "\ntransform: " << H.transform() (0,0) << "," <<  H.transform() (0,1) << "," << H.transform() (0,2) << "," << H.transform() (0,3);
-          out << "\ntransform: " << H.transform() (1,0) << "," <<  H.transform() (1,1) << "," << H.transform() (1,2) << "," << H.transform() (1,3);
-          out << "\ntransform: " << H.transform() (2,0) << "," <<  H.transform() (2,1) << "," << H.transform() (2,2) << "," << H.transform() (2,3);
-        }
-
-        if (H.offset != 0.0 || H.scale != 1.0) 
-          out << "\nscaling: " << H.offset << "," << H.scale;
-
-        if (H.DW_scheme.is_valid()) {
-          for (guint i = 0; i < H.DW_scheme.rows(); i++)
-            out << "\ndw_scheme: " << H.DW_scheme (i,0) << "," << H.DW_scheme (i,1) << "," << H.DW_scheme (i,2) << "," << H.DW_scheme (i,3);
-        }
+        write_mrtrix_header (out, H);
 
         bool single_file = !Glib::str_has_suffix (H.name, ".mih");
 
@@ -260,15 +162,28 @@ namespace MR {
         }
         else out << Glib::path_get_basename (H.name.substr (0, H.name.size()-4) + ".dat") << "\n";
 
-        out.close();
+        // compressed images are held in memory, and only written out when
+        // the image is closed:
+        if (Glib::str_has_suffix (H.name, ".gz")) {
+          String header (out.str());
+          std::vector<guint8> gzheader (header.begin(), header.end());
+          gzheader.resize (offset, 0);
+          dmap.add_gz (H.name, gzheader, new guint8 [H.memory_footprint()], H.memory_footprint(), true);
+          return;
+        }
+
+        std::ofstream outfile (H.name.c_str(), std::ios::out | std::ios::binary);
+        if (!outfile) throw Exception ("error creating file \"" + H.name + "\":" + Glib::strerror(errno));
+        outfile << out.str();
+        outfile.close();
 
         if (single_file) {
-          int fd = g_open (filename.c_str(), O_RDWR, 0755);
-          if (fd < 0) throw Exception ("error opening file \"" + filename + "\" for resizing: " + Glib::strerror(errno));
+          int fd = g_open (H.name.c_str(), O_RDWR, 0755);
+          if (fd < 0) throw Exception ("error opening file \"" + H.name + "\" for resizing: " + Glib::strerror(errno));
           int status = ftruncate (fd, offset + H.memory_footprint());
           close (fd);
-          if (status) throw Exception ("cannot resize file \"" + filename + "\": " + Glib::strerror(errno));
-          dmap.add_gz (filename, gzfilename, offset);
+          if (status) throw Exception ("cannot resize file \"" + H.name + "\": " + Glib::strerror(errno));
+          dmap.add (H.name, offset);
         }
         else dmap.add (H.name.substr (0, H.name.size()-4) + ".dat", 0, H.memory_footprint());
       }
@@ -0,0 +1,161 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "image/format/mrtrix_utils.h"
+#include "image/axis.h"
+
+namespace MR {
+  namespace Image {
+    namespace Format {
+
+      std::map<String,String> read_mrtrix_header (File::KeyValue& kv, Header& H)
+      {
+        String dtype, layout;
+        std::vector<int> dim;
+        std::vector<float> transform, dw_scheme, vox, scaling;
+        std::vector<String> units, labels;
+
+        std::map<String,String> other;
+        while (kv.next()) {
+          String key = lowercase (kv.key());
+          if (key == "dim") dim = parse_ints (kv.value());
+          else if (key == "vox") vox = parse_floats (kv.value());
+          else if (key == "layout") layout = kv.value();
+          else if (key == "datatype") dtype = kv.value();
+          else if (key == "scaling") scaling = parse_floats (kv.value());
+          else if (key == "comments") H.comments.push_back (kv.value());
+          else if (key == "units") units = split (kv.value(), "\\");
+          else if (key == "labels") labels = split (kv.value(), "\\");
+          else if (key == "transform") { std::vector<float> V (parse_floats (kv.value())); transform.insert (transform.end(), V.begin(), V.end()); }
+          else if (key == "dw_scheme") { std::vector<float> V (parse_floats (kv.value())); dw_scheme.insert (dw_scheme.end(), V.begin(), V.end()); }
+          else other[key] = kv.value();
+      }
+
+      if (dim.empty()) throw Exception ("missing \"dim\" specification for generic image \"" + H.name + "\"");
+      H.axes.set_ndim (dim.size());
+      for (guint n = 0; n < dim.size(); n++) {
+        if (dim[n] < 1) throw Exception ("invalid dimensions for generic image \"" + H.name + "\"");
+        H.axes.dim[n] = dim[n];
+      }
+
+      if (vox.empty()) throw Exception ("missing \"vox\" specification for generic image \"" + H.name + "\"");
+      for (int n = 0; n < H.axes.ndim(); n++) {
+        if (vox[n] < 0.0) throw Exception ("invalid voxel size for generic image \"" + H.name + "\"");
+        H.axes.vox[n] = vox[n];
+      }
+
+
+      if (dtype.empty()) throw Exception ("missing \"datatype\" specification for generic image \"" + H.name + "\"");
+      H.data_type.parse (dtype);
+
+
+      if (layout.empty()) throw Exception ("missing \"layout\" specification for generic image \"" + H.name + "\"");
+      std::vector<Axis> ax = parse_axes_specifier (H.axes, layout);
+      if (ax.size() != (guint) H.axes.ndim()) 
+        throw Exception ("specified layout does not match image dimensions for generic image \"" + H.name + "\"");
+
+      for (guint i = 0; i < ax.size(); i++) {
+        H.axes.axis[i] = ax[i].axis;
+        H.axes.forward[i] = ax[i].forward;
+      }
+
+      for (guint n = 0; n < MIN ((guint) H.axes.ndim(), labels.size()); n++) H.axes.desc[n] = labels[n];
+      for (guint n = 0; n < MIN ((guint) H.axes.ndim(), units.size()); n++) H.axes.units[n] = units[n];
+
+      if (transform.size()) {
+        if (transform.size() < 9) throw Exception ("invalid \"transform\" specification for generic image \"" + H.name + "\"");
+        Math::Matrix T (4,4);
+        int count = 0;
+        for (int row = 0; row < 3; row++) 
+          for (int col = 0; col < 4; col++) 
+            T(row,col) = transform[count++];
+        T(3,0) = T(3,1) = T(3,2) = 0.0; T(3,3) = 1.0;
+        H.set_transform (T);
+      }
+
+
+      if (dw_scheme.size()) {
+        if (dw_scheme.size() % 4) info ("WARNING: invalid \"dw_scheme\" specification for generic image \"" + H.name + "\" - ignored");
+        else {
+          Math::Matrix M (dw_scheme.size()/4, 4);
+          int count = 0;
+          for (guint row = 0; row < M.rows(); row++) 
+            for (guint col = 0; col < 4; col++) 
+              M(row,col) = dw_scheme[count++];
+          H.DW_scheme = M;
+        }
+      }
+
+
+      if (scaling.size()) {
+        if (scaling.size() != 2) throw Exception ("invalid \"scaling\" specification for generic image \"" + H.name + "\"");
+        H.offset = scaling[0];
+        H.scale = scaling[1];
+      }
+
+      return (other);
+      }
+
+
+
+
+
+      void write_mrtrix_header (std::ostream& out, const Header& H)
+      {
+        out << "dim: " << H.axes.dim[0];
+        for (int n = 1; n < H.axes.ndim(); n++) out << "," << H.axes.dim[n];
+
+        out << "\nvox: " << H.axes.vox[0];
+        for (int n = 1; n < H.axes.ndim(); n++) out << "," << H.axes.vox[n];
+
+        out << "\nlayout: " << ( H.axes.forward[0] ? "+" : "-" ) << H.axes.axis[0];
+        for (int n = 1; n < H.axes.ndim(); n++) out << "," << ( H.axes.forward[n] ? "+" : "-" ) << H.axes.axis[n];
+
+        out << "\ndatatype: " << H.data_type.specifier();
+
+        out << "\nlabels: " << H.axes.desc[0];
+        for (int n = 1; n < H.axes.ndim(); n++) out << "\\" << H.axes.desc[n];
+
+        out << "\nunits: " <<  H.axes.units[0];
+        for (int n = 1; n < H.axes.ndim(); n++) out << "\\" << H.axes.units[n];
+
+        for (std::vector<String>::const_iterator i = H.comments.begin(); i != H.comments.end(); i++) 
+          out << "\ncomments: " << *i;
+
+
+        if (H.transform().is_valid()) {
+          out << "\ntransform: " << H.transform() (0,0) << "," <<  H.transform() (0,1) << "," << H.transform() (0,2) << "," << H.transform() (0,3);
+          out << "\ntransform: " << H.transform() (1,0) << "," <<  H.transform() (1,1) << "," << H.transform() (1,2) << "," << H.transform() (1,3);
+          out << "\ntransform: " << H.transform() (2,0) << "," <<  H.transform() (2,1) << "," << H.transform() (2,2) << "," << H.transform() (2,3);
+      }
+
+      if (H.offset != 0.0 || H.scale != 1.0) 
+        out << "\nscaling: " << H.offset << "," << H.scale;
+
+      if (H.DW_scheme.is_valid()) {
+        for (guint i = 0; i < H.DW_scheme.rows(); i++)
+          out << "\ndw_scheme: " << H.DW_scheme (i,0) << "," << H.DW_scheme (i,1) << "," << H.DW_scheme (i,2) << "," << H.DW_scheme (i,3);
+      }
+      }
+
+    }
+  }
+}
+
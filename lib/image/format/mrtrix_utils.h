@@ -0,0 +1,47 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __image_format_mrtrix_utils_h__
+#define __image_format_mrtrix_utils_h__
+
+#include <map>
+#include "file/key_value.h"
+#include "image/header.h"
+
+namespace MR {
+  namespace Image {
+    namespace Format {
+
+      //! parse the entries common to all MRtrix-style image headers into \a H
+      /*! Any other entries (e.g. \c file) are returned, indexed by their
+       * lowercase key. */
+      std::map<String,String> read_mrtrix_header (File::KeyValue& kv, Header& H);
+
+      //! write the entries common to all MRtrix-style image headers
+      /*! Output starts with the \c dim entry, and does not include the
+       * first line or a trailing newline. */
+      void write_mrtrix_header (std::ostream& out, const Header& H);
+
+    }
+  }
+}
+
+#endif
+
@@ -20,10 +20,11 @@
 
 */
 
-#include <zlib.h>
 #include <glibmm/stringutils.h>
+#include <glibmm/fileutils.h>
 
 #include "file/nifti1.h"
+#include "file/gz.h"
 #include "image/mapper.h"
 #include "get_set.h"
 #include "image/format/list.h"
@@ -42,20 +43,25 @@ namespace MR {
         if (!(Glib::str_has_suffix (H.name, ".nii") || Glib::str_has_suffix (H.name, ".nii.gz"))) 
           return (false);
 
+        // compressed images are inflated straight into memory: 
         File::MMap fmap;
-        String gzfilename;
+        File::GZ zf;
+        std::vector<guint8> gzheader;
+        const nifti_1_header* NH;
         if (Glib::str_has_suffix (H.name, ".gz")) {
-          gzfilename = H.name;
-          fmap.init (Mapper::gunzip (H.name, "nii"));
+          zf.open (H.name);
+          gzheader.resize (352);
+          zf.read (&gzheader[0], gzheader.size());
+          NH = (const nifti_1_header*) &gzheader[0];
         }
-        else 
+        else {
           fmap.init (H.name);
+          fmap.map();
+          NH = (const nifti_1_header*) fmap.address();
+        }
 
-        fmap.map();
         H.format = FormatNIfTI;
 
-        const nifti_1_header* NH = (const nifti_1_header*) fmap.address();
-
         bool is_BE = false;
         if (get<gint32> (&NH->sizeof_hdr, is_BE) != 348) {
           is_BE = true;
@@ -237,8 +243,24 @@ namespace MR {
           }
         }
 
-        fmap.unmap();
-        dmap.add_gz (fmap, gzfilename, data_offset);
+        if (zf.name().size()) {
+          if (data_offset < gzheader.size()) 
+            throw Exception ("invalid data offset in NIfTI image \"" + H.name + "\"");
+          gsize header_size = gzheader.size();
+          gzheader.resize (data_offset);
+          if (data_offset > header_size) 
+            zf.read (&gzheader[header_size], data_offset - header_size);
+
+          gsize msize = H.memory_footprint (H.ndim());
+          guint8* data = new guint8 [msize];
+          try { zf.read (data, msize); }
+          catch (...) { delete [] data; throw; }
+          dmap.add_gz (H.name, gzheader, data, msize, false);
+        }
+        else {
+          fmap.unmap();
+          dmap.add (fmap, data_offset);
+        }
 
         return (true);
       }
@@ -285,18 +307,23 @@ namespace MR {
 
         guint msize = H.memory_footprint (H.ndim());
 
+        // compressed images are held in memory, and only written out when
+        // the image is closed:
         File::MMap fmap;
-        String gzfilename;
-        if (Glib::str_has_suffix (H.name, ".gz")) {
-          gzfilename = H.name;
-          fmap.init (String(), 352 + msize, "nii");
+        std::vector<guint8> gzheader;
+        nifti_1_header* NH;
+        bool is_gz = Glib::str_has_suffix (H.name, ".gz");
+        if (is_gz) {
+          if (Glib::file_test (H.name, Glib::FILE_TEST_EXISTS)) 
+            throw Exception ("cannot create file \"" + H.name + "\": it already exists");
+          gzheader.resize (352, 0);
+          NH = (nifti_1_header*) &gzheader[0];
         }
-        else 
+        else {
           fmap.init (H.name, 352 + msize);
-
-        fmap.map();
-
-        nifti_1_header* NH = (nifti_1_header*) fmap.address();
+          fmap.map();
+          NH = (nifti_1_header*) fmap.address();
+        }
 
         bool is_BE = H.data_type.is_big_endian();
 
@@ -414,9 +441,12 @@ namespace MR {
 
 
         strncpy ((gchar*) &NH->magic, "n+1\0", 4);
-        fmap.unmap();
 
-        dmap.add_gz (fmap, gzfilename, 352);
+        if (is_gz) dmap.add_gz (H.name, gzheader, new guint8 [msize], msize, true);
+        else {
+          fmap.unmap();
+          dmap.add (fmap, 352);
+        }
       }
 
     }
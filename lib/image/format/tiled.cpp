@@ -0,0 +1,162 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <glibmm/fileutils.h>
+#include <glibmm/stringutils.h>
+
+#include "image/header.h"
+#include "image/mapper.h"
+#include "image/tiles.h"
+#include "file/config.h"
+#include "file/key_value.h"
+#include "image/format/list.h"
+#include "image/format/mrtrix_utils.h"
+
+namespace MR {
+  namespace Image {
+    namespace Format {
+
+      namespace {
+
+        const gchar* FormatTiled = "MRtrix (tiled)";
+
+        // newly created tiled images are held in memory, and compressed
+        // to file when closed:
+        class TiledBuffer : public Mapper::Buffer {
+          public:
+            TiledBuffer (const String& filename, const std::vector<guint8>& header, const TileLayout& tile_layout, guint8* memory_buffer, gsize size) :
+              Mapper::Buffer (filename, header, memory_buffer, size), layout (tile_layout) { }
+
+            ~TiledBuffer ()
+            {
+              if (!read_only) {
+                try { TileCache::write (filename, header, layout, data); }
+                catch (Exception) { error ("error writing data to file \"" + filename + "\""); }
+              }
+            }
+
+          protected:
+            TileLayout layout;
+        };
+
+
+        std::vector<int> default_tile_dims (const Header& H)
+        {
+          std::vector<int> tiles (parse_ints (File::Config::get ("TiledImage.TileSize")));
+          if (tiles.empty()) tiles.resize (3, 32);
+          tiles.resize (H.ndim(), 1);
+          return (tiles);
+        }
+
+      }
+
+
+
+      // extension is: 
+      // mit: MRtrix Image, Tiled
+      //
+      // The header is as for the MRtrix format, with an additional "tiles"
+      // entry giving the size of the tiles along each axis. The "file"
+      // entry gives the offset of the tile index (the offsets of each
+      // compressed tile within the file, followed by the end of the last
+      // tile, as 64-bit little-endian integers), which is followed by the
+      // tiles themselves, each compressed independently using zlib.
+
+      bool Tiled::read (Mapper& dmap, Header& H) const
+      { 
+        if (!Glib::str_has_suffix (H.name, ".mit")) return (false);
+
+        File::KeyValue kv (H.name, "mrtrix tiled image");
+        H.format = FormatTiled;
+
+        std::map<String,String> other = read_mrtrix_header (kv, H);
+        kv.close();
+
+        if (other["tiles"].empty()) throw Exception ("missing \"tiles\" specification for tiled image \"" + H.name + "\"");
+        std::vector<int> tile_dims = parse_ints (other["tiles"]);
+
+        std::istringstream file_stream (other["file"]);
+        String fname;
+        gsize offset = 0;
+        file_stream >> fname >> offset;
+        if (fname != "." || offset == 0) 
+          throw Exception ("invalid \"file\" specification for tiled image \"" + H.name + "\"");
+
+        dmap.add (new TileCache (H.name, TileLayout (H, tile_dims), offset));
+        return (true);
+      }
+
+
+
+
+
+      bool Tiled::check (Header& H, int num_axes) const
+      {
+        if (!Glib::str_has_suffix (H.name, ".mit")) return (false);
+
+        H.format = FormatTiled;
+
+        H.axes.set_ndim (num_axes);
+        for (int i = 0; i < H.axes.ndim(); i++) 
+          if (H.axes.dim[i] < 1) H.axes.dim[i] = 1;
+
+        if (H.data_type.bits() < 8) {
+          info ("WARNING: tiled images cannot hold bitwise data - storing image \"" + H.name + "\" as UInt8");
+          H.data_type = DataType::UInt8;
+        }
+
+        return (true);
+      }
+
+
+
+
+
+      void Tiled::create (Mapper& dmap, const Header& H) const
+      {
+        if (Glib::file_test (H.name, Glib::FILE_TEST_IS_REGULAR)) 
+          throw Exception ("cannot create tiled image file \"" + H.name + "\": file exists");
+
+        std::vector<int> tile_dims (default_tile_dims (H));
+        TileLayout layout (H, tile_dims);
+
+        std::ostringstream out;
+        out << "mrtrix tiled image\n";
+        write_mrtrix_header (out, H);
+
+        out << "\ntiles: " << tile_dims[0];
+        for (guint n = 1; n < tile_dims.size(); n++) out << "," << tile_dims[n];
+
+        size_t offset = out.tellp();
+        offset += 20;
+        out << "\nfile: . " << offset << "\nEND\n";
+
+        String header_text (out.str());
+        std::vector<guint8> header (header_text.begin(), header_text.end());
+        header.resize (offset, 0);
+
+        gsize msize = H.memory_footprint();
+        dmap.add (new TiledBuffer (H.name, header, layout, new guint8 [msize], msize), true);
+      }
+
+    }
+  }
+}
+
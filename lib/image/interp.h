@@ -235,14 +235,14 @@ namespace MR {
       if (out_of_bounds) return (GSL_NAN);
       float val = 0.0;
       gsize os (offset);
-      if (faaa) val  = faaa * image.re (os); os += stride[2];
-      if (faab) val += faab * image.re (os); os += stride[1];
-      if (fabb) val += fabb * image.re (os); os -= stride[2];
-      if (faba) val += faba * image.re (os); os += stride[0];
-      if (fbba) val += fbba * image.re (os); os -= stride[1];
-      if (fbaa) val += fbaa * image.re (os); os += stride[2];
-      if (fbab) val += fbab * image.re (os); os += stride[1];
-      if (fbbb) val += fbbb * image.re (os);
+      if (faaa) val  = faaa * image.re (os, cursor); os += stride[2];
+      if (faab) val += faab * image.re (os, cursor); os += stride[1];
+      if (fabb) val += fabb * image.re (os, cursor); os -= stride[2];
+      if (faba) val += faba * image.re (os, cursor); os += stride[0];
+      if (fbba) val += fbba * image.re (os, cursor); os -= stride[1];
+      if (fbaa) val += fbaa * image.re (os, cursor); os += stride[2];
+      if (fbab) val += fbab * image.re (os, cursor); os += stride[1];
+      if (fbbb) val += fbbb * image.re (os, cursor);
       return (val);
     }
 
@@ -255,14 +255,14 @@ namespace MR {
       if (out_of_bounds) return (GSL_NAN);
       float val = 0.0;
       gsize os (offset);
-      if (faaa) val  = faaa * image.im (os); os += stride[2];
-      if (faab) val += faab * image.im (os); os += stride[1];
-      if (fabb) val += fabb * image.im (os); os -= stride[2];
-      if (faba) val += faba * image.im (os); os += stride[0];
-      if (fbba) val += fbba * image.im (os); os -= stride[1];
-      if (fbaa) val += fbaa * image.im (os); os += stride[2];
-      if (fbab) val += fbab * image.im (os); os += stride[1];
-      if (fbbb) val += fbbb * image.im (os);
+      if (faaa) val  = faaa * image.im (os, cursor); os += stride[2];
+      if (faab) val += faab * image.im (os, cursor); os += stride[1];
+      if (fabb) val += fabb * image.im (os, cursor); os -= stride[2];
+      if (faba) val += faba * image.im (os, cursor); os += stride[0];
+      if (fbba) val += fbba * image.im (os, cursor); os -= stride[1];
+      if (fbaa) val += fbaa * image.im (os, cursor); os += stride[2];
+      if (fbab) val += fbab * image.im (os, cursor); os += stride[1];
+      if (fbbb) val += fbbb * image.im (os, cursor);
       return (val);
     }
 
@@ -274,14 +274,14 @@ namespace MR {
       if (out_of_bounds) return (GSL_NAN);
       float val = 0.0;
       gsize os (offset);
-      if (faaa) val  = faaa * fabs (image.re (os)); os += stride[2];
-      if (faab) val += faab * fabs (image.re (os)); os += stride[1];
-      if (fabb) val += fabb * fabs (image.re (os)); os -= stride[2];
-      if (faba) val += faba * fabs (image.re (os)); os += stride[0];
-      if (fbba) val += fbba * fabs (image.re (os)); os -= stride[1];
-      if (fbaa) val += fbaa * fabs (image.re (os)); os += stride[2];
-      if (fbab) val += fbab * fabs (image.re (os)); os += stride[1];
-      if (fbbb) val += fbbb * fabs (image.re (os));
+      if (faaa) val  = faaa * fabs (image.re (os, cursor)); os += stride[2];
+      if (faab) val += faab * fabs (image.re (os, cursor)); os += stride[1];
+      if (fabb) val += fabb * fabs (image.re (os, cursor)); os -= stride[2];
+      if (faba) val += faba * fabs (image.re (os, cursor)); os += stride[0];
+      if (fbba) val += fbba * fabs (image.re (os, cursor)); os -= stride[1];
+      if (fbaa) val += fbaa * fabs (image.re (os, cursor)); os += stride[2];
+      if (fbab) val += fbab * fabs (image.re (os, cursor)); os += stride[1];
+      if (fbbb) val += fbbb * fabs (image.re (os, cursor));
       return (val);
     }
 
@@ -294,14 +294,14 @@ namespace MR {
       if (out_of_bounds) return (GSL_NAN);
       float val = 0.0;
       gsize os (offset);
-      if (faaa) val  = faaa * fabs (image.im (os)); os += stride[2];
-      if (faab) val += faab * fabs (image.im (os)); os += stride[1];
-      if (fabb) val += fabb * fabs (image.im (os)); os -= stride[2];
-      if (faba) val += faba * fabs (image.im (os)); os += stride[0];
-      if (fbba) val += fbba * fabs (image.im (os)); os -= stride[1];
-      if (fbaa) val += fbaa * fabs (image.im (os)); os += stride[2];
-      if (fbab) val += fbab * fabs (image.im (os)); os += stride[1];
-      if (fbbb) val += fbbb * fabs (image.im (os));
+      if (faaa) val  = faaa * fabs (image.im (os, cursor)); os += stride[2];
+      if (faab) val += faab * fabs (image.im (os, cursor)); os += stride[1];
+      if (fabb) val += fabb * fabs (image.im (os, cursor)); os -= stride[2];
+      if (faba) val += faba * fabs (image.im (os, cursor)); os += stride[0];
+      if (fbba) val += fbba * fabs (image.im (os, cursor)); os -= stride[1];
+      if (fbaa) val += fbaa * fabs (image.im (os, cursor)); os += stride[2];
+      if (fbab) val += fbab * fabs (image.im (os, cursor)); os += stride[1];
+      if (fbbb) val += fbbb * fabs (image.im (os, cursor));
       return (val);
     }
 
@@ -0,0 +1,115 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __image_interp_vector_h__
+#define __image_interp_vector_h__
+
+#include "image/interp.h"
+
+namespace MR {
+  namespace Image {
+
+    //! \addtogroup Image
+    // @{
+
+    //! This class provides tri-linear interpolation of all the values along the fourth axis at once.
+    /*! The values of the 8 voxels surrounding the current position are
+     * read for all volumes in one go and kept in a contiguous buffer, which
+     * is only reloaded when the position moves into a different voxel. This
+     * is much faster than Interp::value() when the same neighbourhood is
+     * sampled repeatedly, as happens during tracking. The image data must
+     * not be modified while an InterpVector is in use. For example:
+     * \code
+     * Image::InterpVector interp (image_object);
+     * float values [image_object.dim(3)];
+     * interp.R (10.2, 3.59, 54.1);
+     * if (!interp.values (values)) { ... }
+     * \endcode */
+    class InterpVector : public Interp {
+      public:
+        //! construct an InterpVector object to point to the data contained in the MR::Image::Object \p parent
+        InterpVector (Object& parent) : Interp (parent), cache (8*dim(3)) { cached[0] = cached[1] = cached[2] = -1; }
+        ~InterpVector() { }
+
+        //! get the interpolated values for all volumes along axis 3 at the current position
+        /*! \return true if the current position is out of bounds, false otherwise */
+        bool values (float* values);
+
+      protected:
+        std::vector<float> cache;
+        int cached[3];
+
+        void load ();
+    };
+
+    //! @}
+
+
+
+
+
+
+
+    inline void InterpVector::load ()
+    {
+      const int num = dim(3);
+      set (3, 0);
+      for (int c = 0; c < 8; c++) {
+        const int dx = (c >> 2) & 1, dy = (c >> 1) & 1, dz = c & 1;
+        float* p = &cache[c*num];
+        if (x[0]+dx >= dim(0) || x[1]+dy >= dim(1) || x[2]+dz >= dim(2)) {
+          for (int n = 0; n < num; n++) p[n] = 0.0;
+          continue;
+        }
+        gsize os = offset + dx*stride[0] + dy*stride[1] + dz*stride[2];
+        for (int n = 0; n < num; n++, os += stride[3]) 
+          p[n] = image.re (os, cursor);
+      }
+      cached[0] = x[0];
+      cached[1] = x[1];
+      cached[2] = x[2];
+    }
+
+
+
+
+
+    inline bool InterpVector::values (float* values)
+    {
+      if (out_of_bounds) return (true);
+      if (x[0] != cached[0] || x[1] != cached[1] || x[2] != cached[2]) load();
+
+      const int num = dim(3);
+      const float f[] = { faaa, faab, faba, fabb, fbaa, fbab, fbba, fbbb };
+      for (int n = 0; n < num; n++) values[n] = 0.0;
+      for (int c = 0; c < 8; c++) {
+        if (!f[c]) continue;
+        const float* p = &cache[c*num];
+        for (int n = 0; n < num; n++) 
+          values[n] += f[c] * p[n];
+      }
+      return (false);
+    }
+
+  }
+}
+
+#endif
+
@@ -23,12 +23,8 @@
     * use template get<T>() & put<T>() methods from lib/get_set.h
 */
 
-#include <zlib.h>
-#include <fcntl.h>
-
-#include <glib/gstdio.h>
-
 #include "image/mapper.h"
+#include "file/gz.h"
 #include "app.h"
 #include "get_set.h"
 
@@ -47,6 +43,25 @@ namespace MR {
         return (segsize);
       }
 
+
+
+      // convert a whole run of voxels in one call, so that the per-voxel
+      // conversion can be inlined into a tight loop rather than going
+      // through the get_func / put_func function pointers for each voxel:
+      template <float32 (*GET) (const void* data, gsize i)> 
+        void get_row (const void* data, float32* values, gsize count) 
+        {
+          for (gsize i = 0; i < count; i++) 
+            values[i] = GET (data, i);
+        }
+
+      template <void (*PUT) (float32 val, void* data, gsize i)> 
+        void put_row (const float32* values, void* data, gsize count) 
+        {
+          for (gsize i = 0; i < count; i++) 
+            PUT (values[i], data, i);
+        }
+
     }
 
 
@@ -59,15 +74,6 @@ namespace MR {
       if (mem && list.size()) 
         throw Exception ("Mapper destroyed before committing data to file!"); 
 
-      for (guint n = 0; n < list.size(); ++n) {
-        if (list[n].gzfilename.size()) {
-          if (!list[n].fmap.is_read_only()) 
-            gzip (list[n].fmap.name(), list[n].gzfilename);
-          debug ("deleting temporary file \"" + list[n].fmap.name() + "\"...");
-          unlink (list[n].fmap.name().c_str());
-        }
-      }
-
       if (output_name.size()) 
         std::cout << output_name << "\n";
     }
@@ -78,20 +84,39 @@ namespace MR {
 
 
 
+    Mapper::GZBuffer::~GZBuffer ()
+    {
+      if (!read_only) {
+        try { File::GZ::write (filename, header.size() ? &header[0] : NULL, header.size(), data, nbytes); }
+        catch (Exception) { error ("error writing data to file \"" + filename + "\""); }
+      }
+    }
+
+
+
+
+
+
     void Mapper::map (const Header& H)
     {
       debug ("mapping image \"" + H.name + "\"...");
       assert (list.size() || mem);
       assert (segment == NULL);
 
+      tiled = false;
+      for (guint n = 0; n < list.size(); n++) 
+        if (list[n].tiles) tiled = true;
+
+      // tiled images are decompressed on demand, unless they need to be
+      // loaded into memory anyway: 
       if (list.size() > DATAMAPPER_MAX_FILES || 
-          ( optimised && ( list.size() > 1 || H.data_type != DataType::Native )) ) {
+          ( optimised && ( list.size() > 1 || H.data_type != DataType::Native || tiled )) ) {
 
         if (H.data_type == DataType::Bit) optimised = true;
 
         info (String ("loading ") + ( optimised ? "and optimising " : "" ) + "image \"" + H.name + "\"..."); 
 
-        bool read_only = list[0].fmap.is_read_only();
+        bool read_only = list[0].is_read_only();
 
         gsize bpp = optimised ? sizeof (float32) : H.data_type.bytes();
         mem = new guint8 [bpp*H.voxel_count()];
@@ -102,23 +127,29 @@ namespace MR {
           segsize = calc_segsize (H, list.size());
 
           for (guint n = 0; n < list.size(); n++) {
-            list[n].fmap.map (); 
+            list[n].map (); 
+
+            guint8* fdata = list[n].start();
+            if (list[n].tiles) {
+              fdata = new guint8 [H.memory_footprint() / list.size()];
+              list[n].tiles->load (fdata);
+            }
 
             if (optimised) {
-              float32* data = (float32*) mem + n*segsize;
-              guint8*   fdata = list[n].start();
-              for (gsize i = 0; i < segsize; i++) 
-                data[i] = get_func (fdata, i); 
+              get_row_func (fdata, (float32*) mem + n*segsize, segsize); 
             } 
-            else memcpy (mem + n*segsize*bpp, list[n].start(), segsize*bpp);
+            else memcpy (mem + n*segsize*bpp, fdata, segsize*bpp);
 
-            list[n].fmap.unmap();
+            if (list[n].tiles) delete [] fdata;
+            list[n].unmap();
           }
         }
 
         if (temporary || read_only) list.clear();
+        tiled = false;
       }
 
+      generation++;
       if (mem) {
         segment = new guint8* [1];
         segment[0] = mem;
@@ -128,7 +159,7 @@ namespace MR {
       else {
         segment = new guint8* [list.size()];
         for (guint n = 0; n < list.size(); n++) {
-          list[n].fmap.map();
+          list[n].map();
           segment[n] = list[n].start();
         }
         segsize = calc_segsize (H, list.size());
@@ -152,17 +183,15 @@ namespace MR {
         info ("writing back data for image \"" + H.name + "\"...");
         for (guint n = 0; n < list.size(); n++) {
           try { 
-            list[n].fmap.map (); 
+            list[n].map (); 
             if (optimised) {
-              const float32* data = (const float32*) mem + n*segsize;
-              for (gsize i = 0; i < segsize; i++) 
-                put_func (data[i], list[n].start(), i); 
+              put_row_func ((const float32*) mem + n*segsize, list[n].start(), segsize); 
             } 
             else memcpy (list[n].start(), mem + n*segsize, segsize);
-            list[n].fmap.unmap();
+            list[n].unmap();
           }
           catch (...) {
-            error ("error writing data to file \"" + list[n].fmap.name() + "\""); 
+            error ("error writing data to file \"" + list[n].name() + "\""); 
           }
         }
       }
@@ -177,105 +206,102 @@ namespace MR {
 
 
 
-    void Mapper::set_data_type (DataType dt)
+    // replace the current data with the buffer supplied, which must hold
+    // count float32 values and have been allocated with new guint8[]. The
+    // Mapper takes ownership of it. Only valid for read-only images, since
+    // the data are no longer associated with the files.
+    void Mapper::use_memory (guint8* data, gsize count)
     {
-      switch (dt() & ~DataType::ComplexNumber) {
-        case DataType::Bit:        get_func = getBit;        put_func = putBit;        return;
-        case DataType::Int8:       get_func = getInt8;       put_func = putInt8;       return;
-        case DataType::UInt8:      get_func = getUInt8;      put_func = putUInt8;      return;
-        case DataType::Int16LE:    get_func = getInt16LE;    put_func = putInt16LE;    return;
-        case DataType::UInt16LE:   get_func = getUInt16LE;   put_func = putUInt16LE;   return;
-        case DataType::Int16BE:    get_func = getInt16BE;    put_func = putInt16BE;    return;
-        case DataType::UInt16BE:   get_func = getUInt16BE;   put_func = putUInt16BE;   return;
-        case DataType::Int32LE:    get_func = getInt32LE;    put_func = putInt32LE;    return;
-        case DataType::UInt32LE:   get_func = getUInt32LE;   put_func = putUInt32LE;   return;
-        case DataType::Int32BE:    get_func = getInt32BE;    put_func = putInt32BE;    return;
-        case DataType::UInt32BE:   get_func = getUInt32BE;   put_func = putUInt32BE;   return;
-        case DataType::Float32LE:  get_func = getFloat32LE;  put_func = putFloat32LE;  return;
-        case DataType::Float32BE:  get_func = getFloat32BE;  put_func = putFloat32BE;  return;
-        case DataType::Float64LE:  get_func = getFloat64LE;  put_func = putFloat64LE;  return;
-        case DataType::Float64BE:  get_func = getFloat64BE;  put_func = putFloat64BE;  return;
-        default: throw Exception ("invalid data type in image header");
+      for (guint n = 0; n < list.size(); n++) {
+        if (!list[n].is_read_only()) {
+          delete [] data;
+          throw Exception ("cannot replace data for image file \"" + list[n].name() + "\": file is writable");
+        }
       }
-    }
+      for (guint n = 0; n < list.size(); n++) 
+        if (list[n].is_mapped()) list[n].unmap();
+      list.clear();
 
+      delete [] mem;
+      delete [] segment;
+      mem = data;
+      segment = new guint8* [1];
+      segment[0] = mem;
+      segsize = count * sizeof (float32);
+      optimised = true;
+      generation++;
+    }
 
 
 
-    void Mapper::gzip (const String& original, const String& gzfile)
-    {
-      FILE* infile = fopen (original.c_str(), "rb");
-      if (!infile) 
-        throw Exception ("error opening temporary file \"" + original + "\": " + strerror(errno));
 
-      info ("writing compressed data to \"" +  gzfile + "\"...");
 
-      int fid = g_open (gzfile.c_str(), O_CREAT | O_RDWR | O_EXCL, 0755);
-      if (fid < 0) {
-        fclose (infile);
-        throw Exception ("error creating file \"" + gzfile + "\": " + Glib::strerror(errno));
+    // for tiled images, the range is limited to the run of values along
+    // the fastest axis within the current tile, since the data are only
+    // contiguous within that run:
+    void Mapper::relocate (gsize offset, Cursor& cursor) const
+    {
+      if (cursor.generation != generation) {
+        cursor.release();
+        cursor.generation = generation;
       }
 
-      gzFile outfile = gzdopen (fid, "wb6");
-      if (!outfile) {
-        fclose (infile);
-        close (fid);
-        throw Exception ("error opening GZIP file \"" + gzfile + "\" for writing");
+      gsize nseg (offset/segsize);
+      if (!tiled) {
+        cursor.data = segment[nseg];
+        cursor.first = nseg*segsize;
+        cursor.count = segsize;
+        cursor.index = 0;
+        return;
       }
 
-      char buf[BUFSIZ];
-      int numBytesRead;
-      while ((numBytesRead = fread(buf, 1, BUFSIZ, infile)) > 0) {
-        int numBytesWritten = gzwrite (outfile, buf, numBytesRead);
-        if (numBytesWritten == 0) {
-          fclose (infile);
-          gzclose (outfile);
-          throw Exception ("error writing to GZIP file \"" + gzfile + "\"");
-        }
+      TileCache& cache (*list[nseg].tiles);
+      guint tile;
+      gsize index, first;
+      cache.tile_layout().locate (offset - nseg*segsize, tile, index, first, cursor.count);
+      if (!cursor.tile || cursor.tile_id != tile) {
+        TileCache::Tile* current = cache.acquire (tile);
+        cursor.release();
+        cursor.tile = current;
+        cursor.tile_id = tile;
       }
-      fclose (infile);
-      gzclose (outfile);
-    }	
+      cursor.data = cursor.tile->data;
+      cursor.first = nseg*segsize + first;
+      cursor.index = index - (offset - cursor.first);
+    }
 
 
 
-    String Mapper::gunzip (const String& gzfile, const char* suffix)
-    {
-      info ("uncompressing file \""  + gzfile +  "\"...");
 
-      String uncompressed;
-      {
-        File::MMap fmap ("", 1024, suffix);
-        uncompressed = fmap.name();
-      }
-
-      debug ("gunzip file \"" + gzfile +  " to \""  +  uncompressed + "\"...");
 
-      gzFile infile = gzopen (gzfile.c_str(), "rb");
-      if (!infile) {
-        unlink (uncompressed.c_str());
-        throw Exception ("error opening GZIP file \"" + gzfile + "\": " + strerror (errno));
-      }
+#define MAPPER_SET_FUNCS(type) \
+      get_func = get##type; put_func = put##type; \
+      get_row_func = get_row<get##type>; put_row_func = put_row<put##type>; \
+      return
 
-      FILE* outfile = fopen (uncompressed.c_str(), "wb");
-      char buf[BUFSIZ];
-      int numBytesRead;
-      while ((numBytesRead = gzread (infile, buf, BUFSIZ)) > 0) {
-        int numBytesWritten = fwrite (buf, 1, numBytesRead, outfile);
-        if (numBytesWritten == 0) {
-          fclose (outfile);
-          gzclose (infile);
-          throw Exception ("error uncompressing file \"" + gzfile + "\"");
-        }
+    void Mapper::set_data_type (DataType dt)
+    {
+      switch (dt() & ~DataType::ComplexNumber) {
+        case DataType::Bit:        MAPPER_SET_FUNCS (Bit);
+        case DataType::Int8:       MAPPER_SET_FUNCS (Int8);
+        case DataType::UInt8:      MAPPER_SET_FUNCS (UInt8);
+        case DataType::Int16LE:    MAPPER_SET_FUNCS (Int16LE);
+        case DataType::UInt16LE:   MAPPER_SET_FUNCS (UInt16LE);
+        case DataType::Int16BE:    MAPPER_SET_FUNCS (Int16BE);
+        case DataType::UInt16BE:   MAPPER_SET_FUNCS (UInt16BE);
+        case DataType::Int32LE:    MAPPER_SET_FUNCS (Int32LE);
+        case DataType::UInt32LE:   MAPPER_SET_FUNCS (UInt32LE);
+        case DataType::Int32BE:    MAPPER_SET_FUNCS (Int32BE);
+        case DataType::UInt32BE:   MAPPER_SET_FUNCS (UInt32BE);
+        case DataType::Float32LE:  MAPPER_SET_FUNCS (Float32LE);
+        case DataType::Float32BE:  MAPPER_SET_FUNCS (Float32BE);
+        case DataType::Float64LE:  MAPPER_SET_FUNCS (Float64LE);
+        case DataType::Float64BE:  MAPPER_SET_FUNCS (Float64BE);
+        default: throw Exception ("invalid data type in image header");
       }
-
-      fclose (outfile);
-      gzclose (infile);
-
-      return uncompressed;
     }
 
-
+#undef MAPPER_SET_FUNCS
 
 
 
@@ -289,10 +315,12 @@ namespace MR {
       else if (dmap.mem) stream << "in memory at " << (void*) dmap.mem << "\n";
       stream << "files:\n";
       for (guint i = 0; i < dmap.list.size(); i++) {
-      stream << "    " << dmap.list[i].fmap.name() << ", offset " << dmap.list[i].offset << " (";
-      if (dmap.list[i].fmap.is_mapped()) stream << "mapped at " << dmap.list[i].fmap.address();
+      stream << "    " << dmap.list[i].name() << ", offset " << dmap.list[i].offset << " (";
+      if (dmap.list[i].buffer) stream << "in memory at " << (void*) dmap.list[i].start();
+      else if (dmap.list[i].tiles) stream << "tiled";
+      else if (dmap.list[i].fmap.is_mapped()) stream << "mapped at " << dmap.list[i].fmap.address();
       else stream << "unmapped";
-      stream << ( dmap.list[i].fmap.is_read_only() ? ", read-only)\n" : ", read-write)\n" );
+      stream << ( dmap.list[i].is_read_only() ? ", read-only)\n" : ", read-write)\n" );
     }
     return (stream);
   }
@@ -25,6 +25,7 @@
 
 #include "data_type.h"
 #include "file/mmap.h"
+#include "image/tiles.h"
 #include "image/header.h"
 #include "image/format/base.h"
 #include "math/complex_number.h"
@@ -38,40 +39,104 @@ namespace MR {
 
     class Mapper {
       public:
+        //! the contents of a file held in memory, committed to file when the last reference is released
+        /*! Derived classes write out the header bytes and data in their
+         * destructor, unless read-only. The memory buffer is owned by the
+         * Buffer. */
+        class Buffer {
+          public:
+            Buffer (const String& file, const std::vector<guint8>& header_bytes, guint8* memory_buffer, gsize size) :
+              filename (file), header (header_bytes), data (memory_buffer), nbytes (size), read_only (true) { }
+            virtual ~Buffer () { delete [] data; }
+
+            String               filename;
+            std::vector<guint8>  header;
+            guint8*              data;
+            gsize                nbytes;
+            bool                 read_only;
+        };
+
         void                   reset ();
         void                   add (const String& filename, gsize offset = 0, gsize desired_size_if_inexistant = 0);
         void                   add (const File::MMap& fmap, gsize offset = 0);
-        void                   add_gz (const String& filename, const String& gz_filename, gsize offset = 0, gsize desired_size_if_inexistant = 0);
-        void                   add_gz (const File::MMap& fmap, const String& gz_filename, gsize offset = 0);
+        void                   add (Buffer* buffer, bool is_new);
+        void                   add_gz (const String& gz_filename, const std::vector<guint8>& header, guint8* memory_buffer, gsize size, bool is_new);
+        void                   add (TileCache* tiles);
         void                   add (guint8* memory_buffer);
 
 
+        //! the segment most recently accessed via re() or im()
+        /*! For images spread over several segments (i.e. files), this
+         * avoids resolving the segment for every voxel accessed: the
+         * segment is only looked up again once the offset moves out of it
+         * (i.e. typically once per row at most). For tiled images, the
+         * Cursor holds on to the current tile, so that the TileCache only
+         * needs to be locked when moving to a different tile. Each Position
+         * holds its own Cursor, so that none of this state is shared
+         * between threads; copying a Cursor therefore yields an empty one. */
+        class Cursor {
+          public:
+            Cursor () : data (NULL), first (0), count (0), index (0), generation (0), tile (NULL), tile_id (0) { }
+            Cursor (const Cursor& C) : data (NULL), first (0), count (0), index (0), generation (0), tile (NULL), tile_id (0) { }
+            ~Cursor () { release(); }
+            Cursor& operator= (const Cursor& C) { release(); generation = 0; return (*this); }
+          protected:
+            guint8* data;
+            gsize   first, count, index;
+            guint   generation;
+            TileCache::Tile* tile;
+            guint   tile_id;
+
+            void    release () { if (tile) tile->unref(); tile = NULL; }
+            friend class Mapper;
+        };
+
         float32                re (gsize offset) const;
         void                   re (float32 val, gsize offset);
         float32                im (gsize offset) const;
         void                   im (float32 val, gsize offset); 
 
+        float32                re (gsize offset, Cursor& cursor) const;
+        void                   re (float32 val, gsize offset, Cursor& cursor);
+        float32                im (gsize offset, Cursor& cursor) const;
+        void                   im (float32 val, gsize offset, Cursor& cursor); 
+
         void                   set_temporary (bool temp);
         String                 output_name;
 
-
-
-        static void gzip (const String& original, const String& gzfile);
-        static String gunzip (const String& gzfile, const char* suffix);
-
       protected:
         Mapper ();
         ~Mapper ();
 
+        // the uncompressed contents of a GZIP image:
+        class GZBuffer : public Buffer {
+          public:
+            GZBuffer (const String& gz_filename, const std::vector<guint8>& header_bytes, guint8* memory_buffer, gsize size) :
+              Buffer (gz_filename, header_bytes, memory_buffer, size) { }
+            ~GZBuffer ();
+        };
+
+        // each entry is either a memory-mapped file, a file held in memory,
+        // or a tiled image decompressed on demand:
         class Entry {
           public:
             File::MMap fmap;
             gsize    offset;
+            RefPtr<Buffer> buffer;
+            RefPtr<TileCache> tiles;
             guint8*    start () const;
-            String gzfilename;
+            String     name () const                  { return (buffer ? buffer->filename : ( tiles ? tiles->name() : fmap.name() )); }
+            void       map ()                         { if (!buffer && !tiles) fmap.map(); }
+            void       unmap ()                       { if (!buffer && !tiles) fmap.unmap(); }
+            bool       is_mapped () const             { return (buffer || tiles || fmap.is_mapped()); }
+            bool       is_read_only () const          { return (buffer ? buffer->read_only : ( tiles ? true : fmap.is_read_only() )); }
+            void       set_read_only (bool read_only);
             friend std::ostream& operator<< (std::ostream& stream, const Entry& m)
             {
-              stream << "Mapper::Entry: offset = " << m.offset << ", " << m.fmap;
+              stream << "Mapper::Entry: offset = " << m.offset << ", ";
+              if (m.buffer) stream << "in memory for file \"" << m.buffer->filename << "\"";
+              else if (m.tiles) stream << "tiled image \"" << m.tiles->name() << "\"";
+              else stream << m.fmap;
               return (stream);
             }
         };
@@ -81,15 +146,22 @@ namespace MR {
         guint8**              segment;
         gsize                 segsize;
 
-        bool                  optimised, temporary, files_new;
+        bool                  optimised, temporary, files_new, tiled;
 
         void                  set_data_type (DataType dt);
         void                  set_read_only (bool read_only);
 
         Entry&                operator[] (guint index);
+        void                  add (const Entry& entry);
         
         float32                (*get_func) (const void* data, gsize i);
         void                   (*put_func) (float32 val, void* data, gsize i);
+        void                   (*get_row_func) (const void* data, float32* values, gsize count);
+        void                   (*put_row_func) (const float32* values, void* data, gsize count);
+
+        guint                  generation; //!< incremented every time the segments change, to invalidate any Cursor
+        guint8*                resolve (gsize& offset, Cursor& cursor) const;
+        void                   relocate (gsize offset, Cursor& cursor) const;
 
         static float32         getBit       (const void* data, gsize i);
         static float32         getInt8      (const void* data, gsize i);
@@ -127,6 +199,8 @@ namespace MR {
         void                   map (const Header& H);
         void                   unmap (const Header& H);
         bool                   is_mapped () const { return (segment); }
+        guint8*                address () const { return (segment && ( mem || list.size() == 1 ) ? segment[0] : NULL); }
+        void                   use_memory (guint8* data, gsize count);
 
 
         friend class Object;
@@ -147,7 +221,22 @@ namespace MR {
 
 
 
-    inline guint8* Mapper::Entry::start () const { return ((guint8*) fmap.address() + offset); }
+    inline guint8* Mapper::Entry::start () const 
+    { 
+      if (tiles) return (NULL);
+      return (( buffer ? buffer->data : (guint8*) fmap.address() ) + offset); 
+    }
+
+
+
+    inline void Mapper::Entry::set_read_only (bool read_only) 
+    { 
+      if (buffer) buffer->read_only = read_only; 
+      else if (tiles) { 
+        if (!read_only) throw Exception ("tiled image \"" + tiles->name() + "\" can only be opened read-only");
+      }
+      else fmap.set_read_only (read_only); 
+    }
 
 
     inline Mapper::Mapper () :
@@ -157,8 +246,12 @@ namespace MR {
       optimised (false),
       temporary (false),
       files_new (true),
+      tiled (false),
       get_func (NULL),
-      put_func (NULL)
+      put_func (NULL),
+      get_row_func (NULL),
+      put_row_func (NULL),
+      generation (0)
     { 
     }
 
@@ -172,7 +265,9 @@ namespace MR {
       segsize = 0; 
       get_func = NULL;
       put_func = NULL;
-      optimised = temporary = false;
+      get_row_func = NULL;
+      put_row_func = NULL;
+      optimised = temporary = tiled = false;
       files_new = true;
       output_name.clear();
       delete [] mem;
@@ -217,18 +312,46 @@ namespace MR {
 
 
 
-    inline void Mapper::add_gz (const String& filename, const String& gz_filename, gsize offset, gsize desired_size_if_inexistant)
+    inline void Mapper::add (Buffer* buffer, bool is_new)
+    {
+      Entry entry;
+      entry.buffer = buffer;
+      if (is_new) {
+        memset (buffer->data, 0, buffer->nbytes);
+        buffer->read_only = false;
+      }
+      else files_new = false;
+      entry.offset = 0;
+      list.push_back (entry);
+    }
+
+
+
+    // the data for a GZIP-compressed image are supplied uncompressed in
+    // memory; the Mapper takes ownership of the buffer. 
+    inline void Mapper::add_gz (const String& gz_filename, const std::vector<guint8>& header, guint8* memory_buffer, gsize size, bool is_new)
+    {
+      add (new GZBuffer (gz_filename, header, memory_buffer, size), is_new);
+    }
+
+
+
+    inline void Mapper::add (TileCache* tiles)
     {
-      add (filename, offset, desired_size_if_inexistant);
-      list.back().gzfilename = gz_filename;
+      Entry entry;
+      entry.tiles = tiles;
+      entry.offset = 0;
+      files_new = false;
+      list.push_back (entry);
     }
 
 
 
-    inline void Mapper::add_gz (const File::MMap& fmap, const String& gz_filename, gsize offset)
+    inline void Mapper::add (const Entry& entry)
     {
-      add (fmap, offset);
-      list.back().gzfilename = gz_filename;
+      if (entry.is_read_only()) 
+        files_new = false;
+      list.push_back (entry);
     }
 
 
@@ -254,7 +377,7 @@ namespace MR {
     inline void Mapper::set_read_only (bool read_only)
     {
       for (guint s = 0; s < list.size(); s++) {
-        list[s].fmap.set_read_only (read_only); 
+        list[s].set_read_only (read_only); 
         if (segment) segment[s] = list[s].start();
       }
     }
@@ -273,6 +396,7 @@ namespace MR {
     {
       if (optimised) return (((float32*) segment[0])[offset]);
       gssize nseg (offset/segsize);
+      if (tiled) return (list[nseg].tiles->get (get_func, offset - nseg*segsize));
       return (get_func (segment[nseg], offset - nseg*segsize)); 
     }
 
@@ -282,7 +406,8 @@ namespace MR {
 
     inline void Mapper::re (float32 val, gsize offset)
     { 
-      if (optimised) ((float32*) segment[0])[offset] = val;
+      if (optimised) { ((float32*) segment[0])[offset] = val; return; }
+      assert (!tiled);
       gssize nseg (offset/segsize);
       put_func (val, segment[nseg], offset - nseg*segsize); 
     }
@@ -295,6 +420,7 @@ namespace MR {
     { 
       if (optimised) return (((float32*) segment[0])[offset+1]);
       gssize nseg (offset/segsize);
+      if (tiled) return (list[nseg].tiles->get (get_func, offset - nseg*segsize + 1));
       return (get_func (segment[nseg], offset - nseg*segsize + 1)); 
     }
 
@@ -303,13 +429,69 @@ namespace MR {
 
     inline void Mapper::im (float32 val, gsize offset)
     { 
-      if (optimised) ((float32*) segment[0])[offset+1] = val;
+      if (optimised) { ((float32*) segment[0])[offset+1] = val; return; }
+      assert (!tiled);
       gssize nseg (offset/segsize);
       put_func (val, segment[nseg], offset - nseg*segsize + 1); 
     }
 
 
 
+    // find the segment (or tile) holding offset, and convert offset to an
+    // index within it. This relies on unsigned wraparound to detect offsets
+    // before the start of the range currently held by the cursor:
+    inline guint8* Mapper::resolve (gsize& offset, Cursor& cursor) const
+    {
+      if (cursor.generation != generation || offset - cursor.first >= cursor.count) 
+        relocate (offset, cursor);
+      offset = offset - cursor.first + cursor.index;
+      return (cursor.data);
+    }
+
+
+
+
+    inline float32 Mapper::re (gsize offset, Cursor& cursor) const 
+    {
+      if (optimised) return (((float32*) segment[0])[offset]);
+      guint8* data = resolve (offset, cursor);
+      return (get_func (data, offset)); 
+    }
+
+
+
+
+    inline void Mapper::re (float32 val, gsize offset, Cursor& cursor)
+    { 
+      if (optimised) { ((float32*) segment[0])[offset] = val; return; }
+      assert (!tiled);
+      guint8* data = resolve (offset, cursor);
+      put_func (val, data, offset); 
+    }
+
+
+
+
+    inline float32 Mapper::im (gsize offset, Cursor& cursor) const
+    { 
+      if (optimised) return (((float32*) segment[0])[offset+1]);
+      guint8* data = resolve (offset, cursor);
+      return (get_func (data, offset + 1)); 
+    }
+
+
+
+
+    inline void Mapper::im (float32 val, gsize offset, Cursor& cursor)
+    { 
+      if (optimised) { ((float32*) segment[0])[offset+1] = val; return; }
+      assert (!tiled);
+      guint8* data = resolve (offset, cursor);
+      put_func (val, data, offset + 1); 
+    }
+
+
+
     inline void Mapper::set_temporary (bool temp)                { temporary = temp; }
 
   }
@@ -33,6 +33,7 @@
 */
 
 #include "app.h"
+#include "file/config.h"
 #include "image/object.h"
 #include "image/format/list.h"
 #include "image/name_parser.h"
@@ -48,6 +49,7 @@ namespace MR {
     void Object::open (const String& imagename, bool is_read_only)
     {
       M.reset();
+      voxel_major = false;
       H.read_only = is_read_only;
 
       if (imagename == "-") getline (std::cin, H.name);
@@ -105,6 +107,7 @@ namespace MR {
     void Object::create (const String& imagename, Image::Header&template_header)
     {
       M.reset();
+      voxel_major = false;
       H = template_header;
       H.read_only = false;
       H.axes.sanitise();
@@ -184,6 +187,7 @@ namespace MR {
     void Object::concatenate (std::vector<RefPtr<Object> >& images)
     {
       M.reset();
+      voxel_major = false;
       if (!images.front() || ! images.back()) throw Exception ("cannot concatenate images: some images are NULL");
       debug ("concatenating images \"" + images.front()->name() + " -> " + images.back()->name() + "\"...");
       M.optimised = false;
@@ -212,7 +216,7 @@ namespace MR {
 
       for (std::vector<RefPtr<Object> >::iterator it = images.begin(); it != images.end(); ++it) 
         for (std::vector<Mapper::Entry>::iterator f = (*it)->M.list.begin(); f != (*it)->M.list.end(); ++f) 
-          M.add (f->fmap, f->offset);
+          M.add (*f);
 
 
       start = ref.start;
@@ -246,7 +250,7 @@ namespace MR {
       M.set_data_type (H.data_type);
       H.sanitise_transform();
 
-      if (M.list.size() == 1 && H.data_type == DataType::Native) M.optimised = true;
+      if (M.list.size() == 1 && !M.list[0].tiles && H.data_type == DataType::Native) M.optimised = true;
 
       debug ("setting up data increments for \"" + H.name + "\"...");
 
@@ -289,6 +293,98 @@ namespace MR {
 
 
 
+    void Object::map ()
+    {
+      if (is_mapped()) return;
+      M.map (H);
+      if (voxel_major) load_voxel_major();
+    }
+
+
+
+
+
+    // Request that the data be held in memory as float32, with all the values
+    // along axis 3 stored contiguously for each voxel. This only applies to
+    // read-only, real-valued images with more than 3 dimensions, and must be
+    // invoked before the image is first accessed.
+    void Object::optimise_voxel_major ()
+    {
+      if (!File::Config::get_bool ("VoxelMajorLoad", true)) return;
+      if (ndim() < 4 || dim(3) < 2 || !H.read_only) return;
+      if (is_complex()) {
+        debug ("image \"" + H.name + "\" is complex - voxel-major layout ignored");
+        return;
+      }
+      if (is_mapped()) {
+        debug ("image \"" + H.name + "\" already mapped - voxel-major layout ignored");
+        return;
+      }
+      voxel_major = true;
+    }
+
+
+
+
+
+    void Object::load_voxel_major ()
+    {
+      if (is_complex() || !H.read_only) {
+        debug ("image \"" + H.name + "\" is complex or writable - voxel-major layout ignored");
+        return;
+      }
+
+      info ("loading image \"" + H.name + "\" in voxel-major order..."); 
+
+      gssize new_stride [MRTRIX_MAX_NDIMS];
+      gssize mult = dim(3);
+      new_stride[3] = 1;
+      for (int i = 0; i < ndim(); i++) {
+        if (i == 3) continue;
+        new_stride[i] = mult;
+        mult *= gssize (dim(i));
+      }
+
+      gsize count = voxel_count();
+      guint8* buffer = new guint8 [count*sizeof(float32)];
+      float32* data = (float32*) buffer;
+
+      // iterate in the order of the axes, which for most images 
+      // matches the order of the data in the file:
+      int x [MRTRIX_MAX_NDIMS];
+      memset (x, 0, MRTRIX_MAX_NDIMS*sizeof(int));
+      gsize os = start, ns = 0;
+      for (gsize i = 0; i < count; i++) {
+        data[ns] = M.re (os);
+        for (int axis = 0; axis < ndim(); axis++) {
+          if (++x[axis] < dim(axis)) { 
+            os += stride[axis]; 
+            ns += new_stride[axis]; 
+            break; 
+          }
+          os -= stride[axis] * gssize (dim(axis)-1);
+          ns -= new_stride[axis] * gssize (dim(axis)-1);
+          x[axis] = 0;
+        }
+      }
+
+      M.use_memory (buffer, count);
+      start = 0;
+      memcpy (stride, new_stride, ndim()*sizeof(gssize));
+
+      if (App::log_level > 2) {
+        String string ("data increments reset to voxel-major order with stride = [ ");
+        for (int i = 0; i < ndim(); i++) string += str (stride[i]) + " "; 
+        debug (string + "]");
+      }
+    }
+
+
+
+
+
+
+
     std::ostream& operator<< (std::ostream& stream, const Object& obj)
     {
       stream << "Image object: \"" << obj.name() << "\" [ ";
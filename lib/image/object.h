@@ -35,6 +35,7 @@ namespace MR {
   namespace Image {
 
     class Interp;
+    class InterpVector;
     class Position;
 
     /*! \defgroup Image Image access
@@ -45,7 +46,7 @@ namespace MR {
     
     class Object {
       public:
-        Object () : start (0) { memset (stride, 0, MRTRIX_MAX_NDIMS*sizeof(gssize)); }
+        Object () : start (0), voxel_major (false) { memset (stride, 0, MRTRIX_MAX_NDIMS*sizeof(gssize)); }
         ~Object () { info ("closing image \"" + H.name + "\"..."); M.unmap (H); }
 
         const Header&        header () const         { return (H); }
@@ -54,8 +55,8 @@ namespace MR {
         void                 create (const String& imagename, Header &template_header);
         void                 concatenate (std::vector<RefPtr<Object> >& images);
 
-        void                 map ()                  { if (!is_mapped()) M.map (H); }
-        void                 unmap ()                { if (is_mapped()) M.unmap (H); }
+        void                 map ();
+        void                 unmap ()                { if (is_mapped() && !voxel_major) M.unmap (H); }
         bool                 is_mapped () const      { return (M.is_mapped()); }
 
         int                  dim (guint index) const { return (H.axes.dim[index]); } 
@@ -108,6 +109,12 @@ namespace MR {
         void                 set_transform (const Math::Matrix& T) { H.set_transform (T); }
 
         void                 optimise () { M.optimised = true; }
+        void                 optimise_voxel_major ();
+
+        //! the address of the image data if held in a single contiguous segment, NULL otherwise
+        void*                address ()              { map(); return (M.address()); }
+        //! the type of the values as stored in memory
+        DataType             storage_type () const   { return (M.optimised ? DataType (DataType::Native) : H.data_type); }
 
         friend std::ostream& operator<< (std::ostream& stream, const Object& obj);
 
@@ -118,8 +125,10 @@ namespace MR {
         Mapper               M;
         gsize                start;
         gssize               stride[MRTRIX_MAX_NDIMS];
+        bool                 voxel_major;
 
         void                 setup ();
+        void                 load_voxel_major ();
 
         float32              scale_from_storage (float32 val) const { return (H.offset + H.scale * val); }
         float32              scale_to_storage (float32 val) const   { return ((val - H.offset) / H.scale); }
@@ -130,7 +139,14 @@ namespace MR {
         float                im (gsize offset) const                { return (scale_from_storage (M.im (offset))); }
         void                 im (gsize offset, float val)           { M.im (scale_to_storage (val), offset); }
 
+        float                re (gsize offset, Mapper::Cursor& cursor) const       { return (scale_from_storage (M.re (offset, cursor))); }
+        void                 re (gsize offset, float val, Mapper::Cursor& cursor)  { M.re (scale_to_storage (val), offset, cursor); }
+
+        float                im (gsize offset, Mapper::Cursor& cursor) const       { return (scale_from_storage (M.im (offset, cursor))); }
+        void                 im (gsize offset, float val, Mapper::Cursor& cursor)  { M.im (scale_to_storage (val), offset, cursor); }
+
         friend class Interp;
+        friend class InterpVector;
         friend class Dialog::File;
         friend class Position;
         friend class Header;
@@ -39,7 +39,7 @@ namespace MR {
       public:
         //! construct a Position object to point to the data contained in the MR::Image::Object \p parent
         /*! All coordinates will be initialised to zero. */
-        explicit Position (Object& parent) : image (parent), offset (image.start), stride (image.stride) { memset (x, 0, ndim()*sizeof(int)); image.map(); }
+        explicit Position (Object& parent) : image (parent), stride (image.stride) { image.map(); offset = image.start; memset (x, 0, ndim()*sizeof(int)); }
 
         Object&     image; //!< The MR::Image::Object containing the image data.
 
@@ -114,18 +114,18 @@ namespace MR {
         void        value (float val)        { re (val); }
 
         //! %get the real component of the voxel at the current position
-        float       re () const              { return (image.re (offset)); }
+        float       re () const              { return (image.re (offset, cursor)); }
 
         //! %set the real component of the voxel at the current position
-        void        re (float val)           { image.re (offset, val); }
+        void        re (float val)           { image.re (offset, val, cursor); }
 
         //! %get the imaginary component of the voxel at the current position
         /*! \note No check is performed to ensure the image is actually complex. Calling this function on real-valued data will produce undefined results */
-        float       im () const              { return (image.im (offset)); }
+        float       im () const              { return (image.im (offset, cursor)); }
 
         //! %set the imaginary component of the voxel at the current position
         /*! \note No check is performed to ensure the image is actually complex. Calling this function on real-valued data will produce undefined results */
-        void        im (float val)           { image.im (offset, val); }
+        void        im (float val)           { image.im (offset, val, cursor); }
 
         //! %get the complex value stored at the current position
         /*! \note No check is performed to ensure the image is actually complex. Calling this function on real-valued data will produce undefined results */
@@ -150,6 +150,7 @@ namespace MR {
         int       x[MRTRIX_MAX_NDIMS]; //!< the current image coordinates
         gsize     offset; //!< the offset in memory to the current voxel
         const gssize* stride; //!< the offset in memory between adjacent image voxels along each axis
+        mutable Mapper::Cursor cursor; //!< the data segment most recently accessed
 
         friend class Entry;
         friend std::ostream& operator<< (std::ostream& stream, const Position& pos);
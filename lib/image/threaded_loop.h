@@ -0,0 +1,181 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __image_threaded_loop_h__
+#define __image_threaded_loop_h__
+
+#include <glibmm/thread.h>
+
+#include "ptr.h"
+#include "file/config.h"
+#include "image/position.h"
+
+namespace MR {
+  namespace Image {
+
+    //! \addtogroup Image
+    // @{
+
+    //! This class runs a functor over all voxels of an image using multiple threads.
+    /*! The image is processed one row (i.e. a line along axis 0) at a time,
+     * with rows handed out in order to whichever thread is free next, so
+     * that each thread works on a contiguous region of the data. The number
+     * of threads is given by the \c NumberOfThreads configuration key. 
+     *
+     * The functor is invoked as \c func(pos) for each voxel, where \c pos
+     * is a Position on the reference image set to the current voxel. Each
+     * additional thread operates on its own copy of the functor, so any
+     * Position or workspace it holds is private to that thread. The functor
+     * must therefore be copy-constructible, and must not write to voxels
+     * outside the current one. Note that images stored as bit data should
+     * be optimised before being written to from multiple threads.
+     *
+     * Only the first \p num_axes axes of the reference image are looped
+     * over; the position along any remaining axes is left unchanged. If \p
+     * row_wise is set, the functor is instead invoked once per row, with the
+     * position set to the start of the row, and is responsible for
+     * processing the whole row itself (see threaded_row_loop()). For
+     * example:
+     * \code
+     * class Square {
+     *   public:
+     *     Square (Image::Object& input) : in (input) { }
+     *     void operator() (Image::Position& out) { in = out; out.value (in.value() * in.value()); }
+     *   private:
+     *     Image::Position in;
+     * };
+     *
+     * Image::Position out (output_object);
+     * Square square (input_object);
+     * Image::threaded_loop (out, square, "squaring...");
+     * \endcode */
+    template <class Functor> class ThreadedLoop {
+      public:
+        ThreadedLoop (const Position& reference, guint num_axes = MRTRIX_MAX_NDIMS, bool row_wise = false) : 
+          ref (reference), 
+          naxes (MIN (num_axes, guint (reference.ndim()))),
+          per_row (row_wise),
+          num_rows (1),
+          next_row (0),
+          threaded (false)
+        { 
+          for (guint axis = 1; axis < naxes; axis++) 
+            num_rows *= ref.dim (axis);
+
+          // the mutex must not be created before the thread system is
+          // initialised:
+          if (!Glib::thread_supported()) Glib::thread_init();
+          mutex = new Glib::Mutex;
+        }
+
+        void run (Functor& func, const String& message)
+        {
+          int num_threads = File::Config::get_int ("NumberOfThreads", 1);
+          if (num_threads < 1) num_threads = 1;
+          next_row = 0;
+          threaded = num_threads > 1;
+
+          ProgressBar::init (num_rows, message);
+
+          if (threaded) {
+            info ("launching " + str (num_threads) + " threads");
+
+            std::vector<Functor*> funcs;
+            std::vector<Glib::Thread*> threads;
+            for (int n = 1; n < num_threads; n++) {
+              funcs.push_back (new Functor (func));
+              threads.push_back (Glib::Thread::create (sigc::bind (sigc::mem_fun (*this, &ThreadedLoop<Functor>::execute), funcs.back()), true));
+            }
+
+            execute (&func);
+
+            for (guint n = 0; n < threads.size(); n++) {
+              threads[n]->join();
+              delete funcs[n];
+            }
+          }
+          else execute (&func);
+
+          ProgressBar::done();
+        }
+
+      private:
+        const Position ref;
+        const guint naxes;
+        const bool per_row;
+        gint num_rows;
+        volatile gint next_row;
+        bool threaded;
+        Ptr<Glib::Mutex> mutex;
+
+        void execute (Functor* func)
+        {
+          Position pos (ref);
+          gint row;
+          while ((row = g_atomic_int_exchange_and_add (&next_row, 1)) < num_rows) {
+            for (guint axis = 1; axis < naxes; axis++) {
+              pos.set (axis, row % pos.dim (axis));
+              row /= pos.dim (axis);
+            }
+
+            pos.set (0,0);
+            if (per_row) (*func) (pos);
+            else for (; pos[0] < pos.dim(0); pos.inc(0)) 
+              (*func) (pos);
+
+            if (threaded) {
+              Glib::Mutex::Lock lock (*mutex);
+              ProgressBar::inc();
+            }
+            else ProgressBar::inc();
+          }
+        }
+    };
+
+
+
+    //! run \p func over all voxels of the reference image using multiple threads
+    /*! This is a convenience wrapper around the ThreadedLoop class. */
+    template <class Functor> inline void threaded_loop (const Position& reference, Functor& func, const String& message, guint num_axes = MRTRIX_MAX_NDIMS)
+    {
+      ThreadedLoop<Functor> loop (reference, num_axes);
+      loop.run (func, message);
+    }
+
+
+
+
+    //! run \p func over all rows of the reference image using multiple threads
+    /*! The functor is invoked once per row (i.e. line along axis 0), with
+     * the position set to the first voxel in the row. This allows operations
+     * to be vectorised over a whole row at a time. */
+    template <class Functor> inline void threaded_row_loop (const Position& reference, Functor& func, const String& message, guint num_axes = MRTRIX_MAX_NDIMS)
+    {
+      ThreadedLoop<Functor> loop (reference, num_axes, true);
+      loop.run (func, message);
+    }
+
+    //! @}
+
+  }
+}
+
+#endif
+
@@ -0,0 +1,392 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <zlib.h>
+#include <glib/gstdio.h>
+#include <glibmm/stringutils.h>
+
+#include "image/tiles.h"
+#include "image/header.h"
+#include "file/config.h"
+
+namespace MR {
+  namespace Image {
+
+    namespace {
+
+      // process all tiles concurrently, each thread claiming the next 
+      // tile from a shared counter:
+      class TileThreads {
+        public:
+          TileThreads (guint num_tiles) : next (0), ntiles (num_tiles) { }
+          virtual ~TileThreads () { }
+
+          void run ()
+          {
+            int num_threads = File::Config::get_int ("NumberOfThreads", 1);
+            if (num_threads < 1) num_threads = 1;
+            if (guint (num_threads) > ntiles) num_threads = ntiles;
+
+            std::vector<Glib::Thread*> threads (num_threads);
+            for (int n = 0; n < num_threads; n++) 
+              threads[n] = Glib::Thread::create (sigc::mem_fun (*this, &TileThreads::execute), true);
+            for (int n = 0; n < num_threads; n++) 
+              threads[n]->join();
+
+            if (error.size()) throw Exception (error);
+          }
+
+        protected:
+          virtual void process (guint tile) = 0;
+
+        private:
+          gint   next;
+          guint  ntiles;
+          String error;
+          Glib::Mutex mutex;
+
+          void execute ()
+          {
+            gint tile;
+            while ((tile = g_atomic_int_exchange_and_add (&next, 1)) < gint (ntiles)) {
+              try { process (tile); }
+              catch (Exception& E) {
+                Glib::Mutex::Lock lock (mutex);
+                if (error.empty()) error = E.description;
+              }
+            }
+          }
+      };
+
+
+
+      class TileLoader : public TileThreads {
+        public:
+          TileLoader (const TileCache& tile_cache, const TileLayout& tile_layout, guint8* image_data) : 
+            TileThreads (tile_layout.num_tiles()), cache (tile_cache), layout (tile_layout), data (image_data) { }
+
+        protected:
+          const TileCache&  cache;
+          const TileLayout& layout;
+          guint8* data;
+
+          void process (guint tile) 
+          {
+            std::vector<guint8> buffer (layout.tile_bytes (tile));
+            cache.inflate (tile, &buffer[0]);
+            layout.scatter (tile, &buffer[0], data);
+          }
+      };
+
+
+
+      class TileCompressor : public TileThreads {
+        public:
+          TileCompressor (const TileLayout& tile_layout, const guint8* image_data, int compression_level) : 
+            TileThreads (tile_layout.num_tiles()), compressed (tile_layout.num_tiles()), 
+            layout (tile_layout), data (image_data), level (compression_level) { }
+
+          std::vector<std::vector<guint8> > compressed;
+
+        protected:
+          const TileLayout& layout;
+          const guint8* data;
+          int level;
+
+          void process (guint tile) 
+          {
+            std::vector<guint8> buffer (layout.tile_bytes (tile));
+            layout.gather (tile, &buffer[0], data);
+
+            std::vector<guint8>& out (compressed[tile]);
+            uLongf size = compressBound (buffer.size());
+            out.resize (size);
+            if (compress2 (&out[0], &size, &buffer[0], buffer.size(), level) != Z_OK) 
+              throw Exception ("error compressing tile " + str (tile));
+            out.resize (size);
+          }
+      };
+
+    }
+
+
+
+
+
+    TileLayout::TileLayout (const Header& H, const std::vector<int>& tile_dims) :
+      dim (H.ndim()), 
+      size (H.ndim()), 
+      count (H.ndim()),
+      ntiles (1),
+      cpx (H.data_type.is_complex() ? 2 : 1),
+      voxel_bytes (H.data_type.bytes())
+    {
+      if (H.data_type.bits() < 8) 
+        throw Exception ("tiled images cannot hold bitwise data (image \"" + H.name + "\")");
+      if (tile_dims.size() != dim.size()) 
+        throw Exception ("tile dimensions do not match those of image \"" + H.name + "\"");
+
+      for (guint i = 0; i < dim.size(); i++) {
+        guint r = H.axes.axis[i];
+        if (r >= dim.size()) throw Exception ("invalid data layout for tiled image \"" + H.name + "\"");
+        dim[r] = H.axes.dim[i];
+        size[r] = CLAMP (gsize (tile_dims[i] < 1 ? 1 : tile_dims[i]), gsize (1), dim[r]);
+      }
+
+      for (guint r = 0; r < dim.size(); r++) {
+        count[r] = (dim[r] + size[r] - 1) / size[r];
+        ntiles *= count[r];
+      }
+    }
+
+
+
+
+    void TileLayout::extent (guint tile, std::vector<gsize>& start, std::vector<gsize>& extent) const
+    {
+      start.resize (dim.size());
+      extent.resize (dim.size());
+      for (guint r = 0; r < dim.size(); r++) {
+        start[r] = (tile % count[r]) * size[r];
+        extent[r] = MIN (size[r], dim[r] - start[r]);
+        tile /= count[r];
+      }
+    }
+
+
+
+
+    gsize TileLayout::tile_bytes (guint tile) const 
+    {
+      std::vector<gsize> start, ext;
+      extent (tile, start, ext);
+      gsize nbytes = voxel_bytes;
+      for (guint r = 0; r < dim.size(); r++) nbytes *= ext[r];
+      return (nbytes);
+    }
+
+
+
+
+    void TileLayout::locate (gsize offset, guint& tile, gsize& index) const 
+    {
+      gsize voxel = offset / cpx;
+      gsize tile_stride = 1, index_stride = 1;
+      tile = 0;
+      index = 0;
+      for (guint r = 0; r < dim.size(); r++) {
+        gsize pos = voxel % dim[r];
+        voxel /= dim[r];
+        gsize t = pos / size[r];
+        tile += t * tile_stride;
+        tile_stride *= count[r];
+        pos -= t * size[r];
+        index += pos * index_stride;
+        index_stride *= MIN (size[r], dim[r] - t * size[r]);
+      }
+      index = index * cpx + offset % cpx;
+    }
+
+
+
+
+    void TileLayout::locate (gsize offset, guint& tile, gsize& index, gsize& first, gsize& count) const 
+    {
+      locate (offset, tile, index);
+      gsize pos = (offset / cpx) % dim[0];
+      gsize t = pos / size[0];
+      first = offset - (pos - t * size[0]) * cpx - offset % cpx;
+      count = MIN (size[0], dim[0] - t * size[0]) * cpx;
+    }
+
+
+
+
+    // the data are copied one row (i.e. one run along the fastest axis) at a time:
+    void TileLayout::copy (guint tile, guint8* tile_data, guint8* image_data, bool to_tile) const
+    {
+      std::vector<gsize> start, ext, pos (dim.size(), 0);
+      extent (tile, start, ext);
+      gsize row = ext[0] * voxel_bytes;
+
+      while (true) {
+        gsize offset = start[0], stride = dim[0];
+        for (guint r = 1; r < dim.size(); r++) {
+          offset += (start[r] + pos[r]) * stride;
+          stride *= dim[r];
+        }
+        guint8* image_row = image_data + offset * voxel_bytes;
+        if (to_tile) memcpy (tile_data, image_row, row);
+        else memcpy (image_row, tile_data, row);
+        tile_data += row;
+
+        guint r = 1;
+        for (; r < dim.size(); r++) {
+          if (++pos[r] < ext[r]) break;
+          pos[r] = 0;
+        }
+        if (r >= dim.size()) break;
+      }
+    }
+
+
+
+
+
+
+
+    TileCache::TileCache (const String& file, const TileLayout& tile_layout, gsize index_offset) :
+      filename (file),
+      fmap (file),
+      layout (tile_layout),
+      tiles (tile_layout.num_tiles(), (Tile*) NULL),
+      lru_pos (tile_layout.num_tiles()),
+      cached (0),
+      capacity (gsize (File::Config::get_int ("TiledImage.CacheSize", 256)) << 20),
+      last (tile_layout.num_tiles())
+    {
+      // the mutex must not be created before the thread system is
+      // initialised:
+      if (!Glib::thread_supported()) Glib::thread_init();
+      mutex = new Glib::Mutex;
+
+      fmap.map();
+      gsize num = layout.num_tiles() + 1;
+      if (index_offset + num*sizeof (guint64) > fmap.size()) 
+        throw Exception ("tile index extends beyond the end of image \"" + filename + "\"");
+
+      index.resize (num);
+      const guint8* p = (const guint8*) fmap.address() + index_offset;
+      for (gsize n = 0; n < num; n++) {
+        guint64 val;
+        memcpy (&val, p + n*sizeof (guint64), sizeof (guint64));
+        index[n] = GUINT64_FROM_LE (val);
+      }
+
+      if (index[0] < index_offset + num*sizeof (guint64) || index[num-1] > fmap.size()) 
+        throw Exception ("invalid tile index in image \"" + filename + "\"");
+      for (gsize n = 1; n < num; n++) 
+        if (index[n] < index[n-1]) 
+          throw Exception ("invalid tile index in image \"" + filename + "\"");
+
+      debug ("tiled image \"" + filename + "\" opened with " + str (layout.num_tiles()) + " tiles, cache size " + str (capacity >> 20) + " MB");
+    }
+
+
+
+
+    TileCache::~TileCache ()
+    {
+      for (guint n = 0; n < tiles.size(); n++) 
+        if (tiles[n]) tiles[n]->unref();
+    }
+
+
+
+
+    TileCache::Tile* TileCache::fetch (guint tile)
+    {
+      if (tiles[tile]) {
+        if (tile != last) {
+          lru.splice (lru.begin(), lru, lru_pos[tile]);
+          last = tile;
+        }
+        return (tiles[tile]);
+      }
+
+      gsize nbytes = layout.tile_bytes (tile);
+      while (lru.size() && cached + nbytes > capacity) {
+        guint oldest = lru.back();
+        lru.pop_back();
+        cached -= layout.tile_bytes (oldest);
+        tiles[oldest]->unref();
+        tiles[oldest] = NULL;
+      }
+
+      Tile* data = new Tile (nbytes);
+      try { inflate (tile, data->data); }
+      catch (...) { data->unref(); throw; }
+
+      tiles[tile] = data;
+      cached += nbytes;
+      lru.push_front (tile);
+      lru_pos[tile] = lru.begin();
+      last = tile;
+      return (data);
+    }
+
+
+
+
+    void TileCache::inflate (guint tile, guint8* tile_data) const
+    {
+      uLongf nbytes = layout.tile_bytes (tile);
+      if (uncompress (tile_data, &nbytes, (const Bytef*) fmap.address() + index[tile], index[tile+1] - index[tile]) != Z_OK ||
+          nbytes != layout.tile_bytes (tile)) 
+        throw Exception ("error decompressing tile " + str (tile) + " of image \"" + filename + "\"");
+    }
+
+
+
+
+    void TileCache::load (guint8* image_data)
+    {
+      info ("loading tiled image \"" + filename + "\"...");
+      TileLoader loader (*this, layout, image_data);
+      loader.run();
+    }
+
+
+
+
+
+    void TileCache::write (const String& filename, const std::vector<guint8>& header, const TileLayout& layout, const guint8* data)
+    {
+      int level = File::Config::get_int ("GZipLevel", 6);
+      if (level < 0 || level > 9) throw Exception ("invalid GZipLevel in configuration file (expected 0 to 9)");
+
+      info ("compressing tiles for image \"" + filename + "\"...");
+      if (!Glib::thread_supported()) Glib::thread_init();
+      TileCompressor compressor (layout, data, level);
+      compressor.run();
+
+      gsize num = layout.num_tiles() + 1;
+      std::vector<guint64> index (num);
+      index[0] = header.size() + num*sizeof (guint64);
+      for (gsize n = 1; n < num; n++) 
+        index[n] = index[n-1] + compressor.compressed[n-1].size();
+      for (gsize n = 0; n < num; n++) 
+        index[n] = GUINT64_TO_LE (index[n]);
+
+      FILE* out = g_fopen (filename.c_str(), "wb");
+      if (!out) throw Exception ("error creating file \"" + filename + "\": " + Glib::strerror (errno));
+
+      bool write_ok = fwrite (&header[0], header.size(), 1, out) == 1;
+      write_ok = write_ok && fwrite (&index[0], sizeof (guint64), num, out) == num;
+      for (gsize n = 0; n < num-1 && write_ok; n++) 
+        write_ok = fwrite (&compressor.compressed[n][0], compressor.compressed[n].size(), 1, out) == 1;
+      if (fclose (out)) write_ok = false;
+
+      if (!write_ok) throw Exception ("error writing tiled image \"" + filename + "\": " + Glib::strerror (errno));
+    }
+
+  }
+}
+
@@ -0,0 +1,150 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __image_tiles_h__
+#define __image_tiles_h__
+
+#include <list>
+#include <glibmm/thread.h>
+#include "ptr.h"
+#include "file/mmap.h"
+
+namespace MR {
+  namespace Image {
+
+    class Header;
+
+    //! the layout of image data stored as independently compressed tiles
+    /*! Tiles are defined along the axes in the order in which the data are
+     * stored, with tiles along the image edges truncated as required. The
+     * data within each tile are also stored in that order. */
+    class TileLayout {
+      public:
+        TileLayout () : ntiles (0), cpx (1), voxel_bytes (0) { }
+        //! \a tile_dims gives the size of the tiles along each image axis
+        TileLayout (const Header& H, const std::vector<int>& tile_dims);
+
+        guint   num_tiles () const { return (ntiles); }
+        //! the uncompressed size of the tile, in bytes
+        gsize   tile_bytes (guint tile) const;
+
+        //! find the tile holding the value at \a offset (as used by the Mapper) and its index within the tile
+        void    locate (gsize offset, guint& tile, gsize& index) const;
+        //! as locate(), also providing the offset \a first and number of values \a count of the contiguous run (along the fastest axis) holding \a offset within the tile
+        void    locate (gsize offset, guint& tile, gsize& index, gsize& first, gsize& count) const;
+
+        //! copy the data for \a tile from the full image into \a tile_data
+        void    gather (guint tile, guint8* tile_data, const guint8* image_data) const { copy (tile, tile_data, (guint8*) image_data, true); }
+        //! copy \a tile_data into the full image
+        void    scatter (guint tile, const guint8* tile_data, guint8* image_data) const { copy (tile, (guint8*) tile_data, image_data, false); }
+
+      protected:
+        std::vector<gsize> dim, size, count;
+        guint ntiles, cpx;
+        gsize voxel_bytes;
+
+        void    extent (guint tile, std::vector<gsize>& start, std::vector<gsize>& extent) const;
+        void    copy (guint tile, guint8* tile_data, guint8* image_data, bool to_tile) const;
+    };
+
+
+
+
+    //! read access to tiled image data, with decompressed tiles kept in an LRU cache
+    /*! Tiles are only decompressed when a value within them is accessed,
+     * so that the cost of reading part of a large image is proportional to
+     * the size of the region read. The size of the cache is given (in MB)
+     * by the \c TiledImage.CacheSize configuration key (default: 256). 
+     * Access is serialised, so that the cache can be shared between 
+     * threads. */
+    class TileCache {
+      public:
+        //! a decompressed tile
+        /*! Tiles are reference-counted, so that a tile evicted from the
+         * cache remains valid for as long as it is held elsewhere (i.e. by
+         * a Mapper::Cursor). */
+        class Tile {
+          public:
+            Tile (gsize nbytes) : data (new guint8 [nbytes]), refcount (1) { }
+            guint8* const data;
+            void    ref ()   { g_atomic_int_inc (&refcount); }
+            void    unref () { if (g_atomic_int_dec_and_test (&refcount)) delete this; }
+          private:
+            ~Tile () { delete [] data; }
+            volatile gint refcount;
+        };
+
+        //! the tile index (num_tiles()+1 file offsets) is located at \a index_offset in \a filename
+        TileCache (const String& filename, const TileLayout& tile_layout, gsize index_offset);
+        ~TileCache ();
+
+        const String& name () const { return (filename); }
+
+        const TileLayout& tile_layout () const { return (layout); }
+
+        float32 get (float32 (*get_func) (const void* data, gsize i), gsize offset)
+        {
+          guint tile;
+          gsize i;
+          layout.locate (offset, tile, i);
+          Glib::Mutex::Lock lock (*mutex);
+          return (get_func (fetch (tile)->data, i));
+        }
+
+        //! return \a tile, with an additional reference held on behalf of the caller
+        Tile*   acquire (guint tile)
+        {
+          Glib::Mutex::Lock lock (*mutex);
+          Tile* t = fetch (tile);
+          t->ref();
+          return (t);
+        }
+
+        //! decompress all the data into \a image_data 
+        void    load (guint8* image_data);
+        //! decompress \a tile into \a tile_data, bypassing the cache
+        void    inflate (guint tile, guint8* tile_data) const;
+
+        //! write \a data as a tiled image to \a filename, following the \a header bytes 
+        /*! The tile index is placed immediately after the header, and the
+         * tiles are compressed concurrently using \c NumberOfThreads threads,
+         * at the level given by the \c GZipLevel configuration key. */
+        static void write (const String& filename, const std::vector<guint8>& header, const TileLayout& tile_layout, const guint8* data);
+
+      protected:
+        String     filename;
+        File::MMap fmap;
+        TileLayout layout;
+        std::vector<guint64> index;
+        std::vector<Tile*>   tiles;
+        std::list<guint>     lru;
+        std::vector<std::list<guint>::iterator> lru_pos;
+        gsize      cached, capacity;
+        guint      last;
+        Ptr<Glib::Mutex> mutex;
+
+        Tile*      fetch (guint tile);
+    };
+
+  }
+}
+
+#endif
+
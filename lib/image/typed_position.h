@@ -0,0 +1,123 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __image_typed_position_h__
+#define __image_typed_position_h__
+
+#include "get_set.h"
+#include "image/position.h"
+
+namespace MR {
+  namespace Image {
+
+    //! \addtogroup Image
+    // @{
+
+    //! This class provides direct access to image data stored as values of type \p T
+    /*! It can be used in place of a MR::Image::Position for real-valued
+     * images held in a single contiguous segment in native byte order. Values
+     * are read and written directly as type \p T, avoiding the per-voxel
+     * function call and segment lookup performed by the generic Mapper.
+     * Instances are normally created via MR::Image::dispatch(). */
+    template <typename T> class TypedPosition : public Position {
+      public:
+        explicit TypedPosition (Object& parent) : 
+          Position (parent), 
+          data ((T*) image.address()),
+          scale (image.scale()),
+          bias (image.offset()) { assert (data); }
+
+        float       value () const           { return (re()); }
+        void        value (float val)        { re (val); }
+
+        float       re () const              { return (bias + scale * float (data[offset])); }
+        void        re (float val)           { data[offset] = T ((val - bias) / scale); }
+
+        float       im () const              { return (0.0); }
+        void        im (float val)           { }
+
+        void        get (OutputType format, float& val, float& val_im)
+        {
+          switch (format) {
+            case Default:   val = re(); return;
+            case Real:      val = re(); return;
+            case Imaginary: val = 0.0; return;
+            case Magnitude: val = fabs (re()); return;
+            case Phase:     val = re() < 0.0 ? M_PI : 0.0; return;
+            case RealImag:  val = re(); val_im = 0.0; return;
+          }
+          assert (false);
+        }
+
+      protected:
+        T*          data;
+        const float scale, bias;
+    };
+
+
+
+    //! invoke \p func with the most efficient Position type for the image \p parent
+    /*! \p func must provide a templated operator() accepting any Position
+     * type, for example:
+     * \code
+     * class Sum {
+     *   public:
+     *     Sum () : sum (0.0) { }
+     *     template <class P> void operator() (P& pos) { do { sum += pos.value(); } while (pos++); }
+     *     double sum;
+     * };
+     *
+     * Sum sum;
+     * Image::dispatch (image_object, sum);
+     * \endcode
+     * This will be invoked with a TypedPosition for real-valued data of the
+     * common data types held in native byte order in a single segment, and
+     * with a generic Position otherwise. */
+    template <class Functor> inline void dispatch (Object& parent, Functor& func)
+    {
+      parent.map();
+      const DataType dt (parent.storage_type());
+
+      if (parent.address() && !dt.is_complex() && 
+          ( dt.bytes() == 1 || dt.is_big_endian() == MRTRIX_IS_BIG_ENDIAN )) {
+        switch (dt() & ~(DataType::LittleEndian | DataType::BigEndian)) {
+          case DataType::Int8:    { TypedPosition<gint8>   pos (parent); func (pos); return; }
+          case DataType::UInt8:   { TypedPosition<guint8>  pos (parent); func (pos); return; }
+          case DataType::Int16:   { TypedPosition<gint16>  pos (parent); func (pos); return; }
+          case DataType::UInt16:  { TypedPosition<guint16> pos (parent); func (pos); return; }
+          case DataType::Int32:   { TypedPosition<gint32>  pos (parent); func (pos); return; }
+          case DataType::UInt32:  { TypedPosition<guint32> pos (parent); func (pos); return; }
+          case DataType::Float32: { TypedPosition<float32> pos (parent); func (pos); return; }
+          case DataType::Float64: { TypedPosition<float64> pos (parent); func (pos); return; }
+          default: break;
+        }
+      }
+
+      Position pos (parent);
+      func (pos);
+    }
+
+    //! @}
+
+  }
+}
+
+#endif
+
@@ -124,6 +124,47 @@ namespace MR {
 
 
 
+    Eigen::Eigen (guint size, bool compute_eigenvectors) : n (size), vectors (compute_eigenvectors) { allocate(); }
+    Eigen::Eigen (const Eigen& E) : n (E.n), vectors (E.vectors) { allocate(); }
+
+    Eigen::~Eigen ()
+    {
+      if (work) gsl_eigen_symm_free (work);
+      if (vwork) gsl_eigen_symmv_free (vwork);
+      gsl_vector_free (eigen_values);
+    }
+
+    void Eigen::allocate ()
+    {
+      eigen_values = gsl_vector_alloc (n);
+      work = NULL;
+      vwork = NULL;
+      if (vectors) vwork = gsl_eigen_symmv_alloc (n);
+      else work = gsl_eigen_symm_alloc (n);
+    }
+
+    void Eigen::operator() (Matrix& src, double* evals)
+    {
+      assert (work);
+      gsl_eigen_symm (src.get_gsl_matrix(), eigen_values, work);
+      gsl_sort_vector (eigen_values);
+      for (guint i = 0; i < n; i++)
+        evals[i] = gsl_vector_get (eigen_values, i);
+    }
+
+    void Eigen::operator() (Matrix& src, double* evals, Matrix& evec)
+    {
+      assert (vwork);
+      gsl_eigen_symmv (src.get_gsl_matrix(), eigen_values, evec.get_gsl_matrix(), vwork);
+      gsl_eigen_symmv_sort (eigen_values, evec.get_gsl_matrix(), GSL_EIGEN_SORT_VAL_ASC);
+      for (guint i = 0; i < n; i++)
+        evals[i] = gsl_vector_get (eigen_values, i);
+    }
+
+
+
+
+
     void eig_init (Matrix& src, bool compute_eigenvectors)
     {
       if (src.rows() != src.columns()) 
@@ -24,6 +24,7 @@
 #define __math_linalg_h__
 
 #include <gsl/gsl_linalg.h>
+#include <gsl/gsl_eigen.h>
 
 #include "math/vector.h"
 #include "math/matrix.h"
@@ -65,6 +66,33 @@ namespace MR {
     void QR_solve (Matrix& A, Vector& tau, Vector& b, Vector& x);
     void QR_LS_solve (Matrix& A, Vector& b, Vector& x, Vector& residuals);
 
+    //! Eigen-decomposition of symmetric matrices of a given size
+    /*! Unlike eig_init(), eig() and eig_end(), each instance holds its own
+     * workspace, so that separate instances can be used concurrently. */
+    class Eigen {
+      public:
+        Eigen (guint size, bool compute_eigenvectors);
+        Eigen (const Eigen& E);
+        ~Eigen ();
+
+        void      operator() (Matrix& src, double* evals);
+        void      operator() (Matrix& src, double* evals, Matrix& evec);
+
+      protected:
+        guint                       n;
+        bool                        vectors;
+        gsl_vector*                 eigen_values;
+        gsl_eigen_symm_workspace*   work;
+        gsl_eigen_symmv_workspace*  vwork;
+
+        void      allocate ();
+
+      private:
+        Eigen& operator= (const Eigen& E);
+    };
+
+
+
     void eig_init (Matrix& src, bool compute_eigenvectors);
     void eig (Matrix& src, Vector& evals);
     void eig (Matrix& src, double* evals);
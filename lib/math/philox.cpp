@@ -0,0 +1,121 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "math/philox.h"
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+namespace MR {
+  namespace Math {
+
+    namespace {
+
+      class PhiloxState {
+        public:
+          guint32 key[2], counter[4], output[4];
+          guint index;
+      };
+
+      inline void mulhilo (guint32 a, guint32 b, guint32& hi, guint32& lo)
+      {
+        guint64 product = guint64 (a) * guint64 (b);
+        hi = product >> 32;
+        lo = product;
+      }
+
+      void philox_generate (PhiloxState* state)
+      {
+        guint32 c[4] = { state->counter[0], state->counter[1], state->counter[2], state->counter[3] };
+        guint32 k[2] = { state->key[0], state->key[1] };
+
+        for (guint round = 0; round < PHILOX_ROUNDS; round++) {
+          if (round) { k[0] += PHILOX_W0; k[1] += PHILOX_W1; }
+          guint32 hi0, lo0, hi1, lo1;
+          mulhilo (PHILOX_M0, c[0], hi0, lo0);
+          mulhilo (PHILOX_M1, c[2], hi1, lo1);
+          c[0] = hi1 ^ c[1] ^ k[0];
+          c[1] = lo1;
+          c[2] = hi0 ^ c[3] ^ k[1];
+          c[3] = lo0;
+        }
+
+        for (guint n = 0; n < 4; n++) state->output[n] = c[n];
+        state->index = 0;
+
+        // the first two counter words index the blocks within the stream:
+        if (!++state->counter[0]) ++state->counter[1];
+      }
+
+      void philox_set_state (PhiloxState* state, guint64 key, guint64 stream)
+      {
+        state->key[0] = key;
+        state->key[1] = key >> 32;
+        state->counter[0] = state->counter[1] = 0;
+        state->counter[2] = stream;
+        state->counter[3] = stream >> 32;
+        state->index = 4;
+      }
+
+      void philox_set (void* vstate, unsigned long seed)
+      {
+        philox_set_state ((PhiloxState*) vstate, seed, 0);
+      }
+
+      unsigned long philox_get (void* vstate)
+      {
+        PhiloxState* state = (PhiloxState*) vstate;
+        if (state->index >= 4) philox_generate (state);
+        return (state->output[state->index++]);
+      }
+
+      double philox_get_double (void* vstate)
+      {
+        return (philox_get (vstate) / 4294967296.0);
+      }
+
+      const gsl_rng_type philox_type = {
+        "philox4x32-10",
+        0xFFFFFFFFUL,
+        0,
+        sizeof (PhiloxState),
+        &philox_set,
+        &philox_get,
+        &philox_get_double
+      };
+
+    }
+
+
+    const gsl_rng_type* gsl_rng_philox4x32 = &philox_type;
+
+
+    void philox_set_stream (gsl_rng* generator, guint64 key, guint64 stream)
+    {
+      assert (generator->type == gsl_rng_philox4x32);
+      philox_set_state ((PhiloxState*) generator->state, key, stream);
+    }
+
+  }
+}
+
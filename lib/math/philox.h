@@ -0,0 +1,48 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __math_philox_h__
+#define __math_philox_h__
+
+#include <gsl/gsl_rng.h>
+
+#include "mrtrix.h"
+
+namespace MR {
+  namespace Math {
+
+    //! Philox4x32-10 counter-based random number generator, as a GSL generator type
+    /*! Each block of four 32-bit outputs is a keyed bijection of a 128-bit
+     * counter (Salmon et al., SC'11), so that any number of independent
+     * streams can be selected directly from a key and a stream index, with
+     * no setup cost and no dependence on the order in which they are used.
+     * Use philox_set_stream() to select a stream; gsl_rng_set() sets the
+     * key and selects stream zero. */
+    extern const gsl_rng_type* gsl_rng_philox4x32;
+
+    //! select stream \p stream of the generator keyed by \p key
+    /*! \p generator must have been allocated with type gsl_rng_philox4x32. */
+    void philox_set_stream (gsl_rng* generator, guint64 key, guint64 stream);
+
+  }
+}
+
+#endif
+
@@ -27,6 +27,7 @@
 #include <gsl/gsl_randist.h>
 
 #include "math/vector.h"
+#include "math/philox.h"
 
 namespace MR {
   namespace Math {
@@ -44,6 +45,19 @@ namespace MR {
 
         void      set_seed (guint seed)            { gsl_rng_set (generator, seed); }
 
+        //! switch to stream \p stream of the counter-based generator keyed by \p key
+        /*! The sequence produced depends only on \p key and \p stream, so that
+         * e.g. a per-item stream can be selected to make results independent
+         * of the order in which items are processed. */
+        void      set_stream (guint64 key, guint64 stream) 
+        { 
+          if (generator->type != gsl_rng_philox4x32) {
+            gsl_rng_free (generator);
+            generator = gsl_rng_alloc (gsl_rng_philox4x32);
+          }
+          philox_set_stream (generator, key, stream); 
+        }
+
 
         gsl_rng*  operator() ()                    { return (generator); }
 
@@ -61,6 +75,27 @@ namespace MR {
     };
 
 
+    //! draw integers in the range [0, N-1] according to the weights supplied
+    /*! This uses Walker's alias method, as implemented in GSL, so that each
+     * sample requires constant time regardless of N. The table itself is
+     * not modified when sampling, and can be shared between threads, each
+     * with its own RNG. */
+    class Discrete {
+      public:
+        Discrete (const std::vector<double>& weights) : table (gsl_ran_discrete_preproc (weights.size(), &weights[0])) { }
+        ~Discrete () { gsl_ran_discrete_free (table); }
+
+        guint     operator() (RNG& rng) const      { return (gsl_ran_discrete (rng(), table)); }
+
+      protected:
+        gsl_ran_discrete_t* table;
+
+      private:
+        Discrete (const Discrete& D);
+        Discrete& operator= (const Discrete& D);
+    };
+
+
     inline float cauchy (float x, float s) { x /= s; return (1.0 / (1.0 + x*x)); }
 
 
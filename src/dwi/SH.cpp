@@ -37,6 +37,10 @@
 #include <gsl/gsl_sf_legendre.h>
 #include "image/position.h"
 #include "image/interp.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "math/matrix.h"
 #include "dwi/SH.h"
 
@@ -321,6 +325,70 @@ namespace MR {
 
 
 
+      // Evaluates the SH series for a batch of directions, 4 at a time. The
+      // interpolated Legendre coefficients for each group of 4 directions are
+      // interleaved so that each (l,m) term can be accumulated for all 4
+      // directions in one SSE operation, and cos(m*az) & sin(m*az) are obtained
+      // by recurrence rather than by calling the trigonometric functions.
+      void value_precomputed (float* amplitudes, const float *values, const Point* unit_dirs, int num)
+      {
+#ifdef __SSE__
+        float legendre [4*num_legendre_coefs];
+        float cos_az [4], sin_az [4], result [4];
+
+        for (int n = 0; n < num; n += 4) {
+
+          for (int k = 0; k < 4; k++) {
+            const Point& dir (unit_dirs[n+k < num ? n+k : num-1]);
+            PrecomputedFraction f;
+            calc_index_fractions (f, acos (dir[2]));
+            const float* p2 = f.f2 ? f.p2 : f.p1;
+            for (int i = 0; i < num_legendre_coefs; i++)
+              legendre[4*i+k] = f.f1*f.p1[i] + f.f2*p2[i];
+
+            float r = sqrt (dir[0]*dir[0] + dir[1]*dir[1]);
+            if (r > 0.0) { cos_az[k] = dir[0]/r; sin_az[k] = dir[1]/r; }
+            else { cos_az[k] = 1.0; sin_az[k] = 0.0; }
+          }
+
+          __m128 val = _mm_setzero_ps();
+          for (int l = 0; l <= lmax_legendre; l+=2)
+            val = _mm_add_ps (val, _mm_mul_ps (_mm_set1_ps (values[index(l,0)]), _mm_loadu_ps (legendre + 4*index_mpos(l,0))));
+
+          const __m128 caz1 = _mm_loadu_ps (cos_az);
+          const __m128 two_caz1 = _mm_add_ps (caz1, caz1);
+          __m128 caz = caz1, saz = _mm_loadu_ps (sin_az);
+          __m128 caz_prev = _mm_set1_ps (1.0), saz_prev = _mm_setzero_ps();
+
+          for (int m = 1; m <= lmax_legendre; m++) {
+            for (int l = 2*((m+1)/2); l <= lmax_legendre; l+=2) {
+              __m128 tmp = _mm_loadu_ps (legendre + 4*index_mpos(l,m));
+              __m128 term = _mm_add_ps (
+                  _mm_mul_ps (_mm_set1_ps (values[index(l,m)]), caz),
+                  _mm_mul_ps (_mm_set1_ps (values[index(l,-m)]), saz));
+              val = _mm_add_ps (val, _mm_mul_ps (tmp, term));
+            }
+
+            __m128 caz_next = _mm_sub_ps (_mm_mul_ps (two_caz1, caz), caz_prev);
+            __m128 saz_next = _mm_sub_ps (_mm_mul_ps (two_caz1, saz), saz_prev);
+            caz_prev = caz; saz_prev = saz;
+            caz = caz_next; saz = saz_next;
+          }
+
+          _mm_storeu_ps (result, val);
+          for (int k = 0; k < 4 && n+k < num; k++)
+            amplitudes[n+k] = result[k];
+        }
+#else
+        for (int n = 0; n < num; n++)
+          amplitudes[n] = value_precomputed (values, unit_dirs[n]);
+#endif
+      }
+
+
+
+
+
       float get_peak (const float* SH, int lmax, Point& unit_init_dir, bool precomputed)
       {
         float amplitude, dSH_del, dSH_daz, d2SH_del2, d2SH_deldaz, d2SH_daz2;
@@ -66,6 +66,7 @@ namespace MR {
 
       void precompute (int lmax, int num = 256);
       float value_precomputed (const float *values, const Point& unit_dir);
+      void value_precomputed (float* amplitudes, const float *values, const Point* unit_dirs, int num);
 
       void delta (Coefs& SH, float azimuth, float elevation, int lmax);
 
@@ -0,0 +1,101 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "dwi/sdeconv/batch.h"
+
+namespace MR {
+  namespace DWI {
+    namespace SH {
+
+      CSDeconvBatch::CSDeconvBatch (const CSDeconv::Common& common, guint max_voxels) : P (common) 
+      {
+        allocate (max_voxels);
+      }
+
+
+
+      CSDeconvBatch::CSDeconvBatch (const CSDeconvBatch& batch) : P (batch.P) 
+      {
+        allocate (batch.capacity());
+      }
+
+
+
+      CSDeconvBatch::~CSDeconvBatch () 
+      {
+        for (guint n = 0; n < voxels.size(); n++) 
+          delete voxels[n];
+      }
+
+
+
+      void CSDeconvBatch::allocate (guint max_voxels)
+      {
+        voxels.resize (max_voxels);
+        for (guint n = 0; n < max_voxels; n++) 
+          voxels[n] = new CSDeconv (P);
+        niter.resize (max_voxels);
+        active.reserve (max_voxels);
+        F.allocate (max_voxels, P.HR_trans.columns());
+        HR_amps.allocate (max_voxels, P.HR_trans.rows());
+      }
+
+
+
+
+      void CSDeconvBatch::run (guint num_voxels, int max_iterations)
+      {
+        assert (num_voxels <= capacity());
+        active.clear();
+        for (guint n = 0; n < num_voxels; n++) {
+          active.push_back (n);
+          niter[n] = 0;
+        }
+
+        for (int iter = 0; iter < max_iterations && active.size(); iter++) {
+
+          // gather the current FODs of the active voxels into the leading rows of F:
+          for (guint n = 0; n < active.size(); n++) {
+            const Math::Vector& f (voxels[active[n]]->FOD());
+            for (guint i = 0; i < f.size(); i++) 
+              F(n,i) = f[i];
+          }
+
+          gsl_matrix_view Fv = gsl_matrix_submatrix (F.get_gsl_matrix(), 0, 0, active.size(), F.columns());
+          gsl_matrix_view Av = gsl_matrix_submatrix (HR_amps.get_gsl_matrix(), 0, 0, active.size(), HR_amps.columns());
+          if (gsl_blas_dgemm (CblasNoTrans, CblasTrans, 1.0, &Fv.matrix, P.HR_trans.get_gsl_matrix(), 0.0, &Av.matrix)) 
+            throw Exception ("matrix");
+
+          // advance each voxel, and compact the list to those not yet converged:
+          guint num_active = 0;
+          for (guint n = 0; n < active.size(); n++) {
+            if (voxels[active[n]]->iterate (&HR_amps(n,0))) 
+              niter[active[n]] = iter+1;
+            else 
+              active[num_active++] = active[n];
+          }
+          active.resize (num_active);
+        }
+      }
+
+    }
+  }
+}
+
@@ -0,0 +1,80 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __dwi_SH_sdeconv_batch_h__
+#define __dwi_SH_sdeconv_batch_h__
+
+#include "dwi/sdeconv/constrained.h"
+
+namespace MR {
+  namespace DWI {
+    namespace SH {
+
+      //! constrained spherical deconvolution of a batch of voxels at a time
+      /*! The amplitudes of the current FODs of all voxels still being
+       * processed are computed using a single matrix-matrix product per
+       * iteration, rather than one matrix-vector product per voxel. Voxels
+       * that have converged are removed from the batch after each
+       * iteration.
+       *
+       * Each slot in the batch keeps its own CSDeconv instance, so that
+       * warm-starting a slot (see CSDeconv::set()) uses the negative set of
+       * the voxel previously processed in that same slot. To seed each voxel
+       * from the one processed just before it, the voxels need to be
+       * processed one at a time through the same slot. */
+      class CSDeconvBatch
+      {
+        public:
+          CSDeconvBatch (const CSDeconv::Common& common, guint max_voxels);
+          CSDeconvBatch (const CSDeconvBatch& batch);
+          ~CSDeconvBatch ();
+
+          guint     capacity () const                         { return (voxels.size()); }
+
+          //! set the DW signals for the voxel in slot \p index
+          void      set (guint index, const Math::Vector& DW_signals, bool warm_start = false) { voxels[index]->set (DW_signals, warm_start); }
+
+          //! iterate the first \p num_voxels slots until convergence, or until \p max_iterations is reached
+          void      run (guint num_voxels, int max_iterations);
+
+          const Math::Vector& FOD (guint index) const         { return (voxels[index]->FOD()); }
+
+          //! the number of iterations required for slot \p index to converge, or zero if it failed to converge
+          int       iterations (guint index) const            { return (niter[index]); }
+
+        protected:
+          const CSDeconv::Common&  P;
+          std::vector<CSDeconv*>   voxels;
+          std::vector<int>         niter;
+          std::vector<guint>       active;
+          Math::Matrix             F, HR_amps;
+
+          void      allocate (guint max_voxels);
+
+        private:
+          CSDeconvBatch& operator= (const CSDeconvBatch& batch);
+      };
+
+    }
+  }
+}
+
+#endif
+
@@ -73,18 +73,27 @@ namespace MR {
 
       CSDeconv::CSDeconv (const CSDeconv::Common& common) : P (common) 
       {
-        M2.allocate (P.fconv.rows() + P.HR_trans.rows(), P.HR_trans.columns());
-        for (guint row = 0; row < P.fconv.rows(); row++) {
-          for (guint col = 0; col < P.fconv.columns(); col++)
-            M2(row,col) = P.fconv(row,col);
-          for (guint col = P.fconv.columns(); col < P.HR_trans.columns(); col++)
-            M2(row,col) = 0.0;
-        }
-
         S.allocate (P.fconv.rows());
-        S_padded.zero (M2.rows());
+        S_padded.zero (P.fconv.rows() + P.HR_trans.rows());
         init_F.allocate (P.fconv.columns());
         F.allocate (P.HR_trans.columns());
+
+        const guint n = P.HR_trans.columns();
+        AtA.allocate (n, n);
+        AtA.zero();
+        for (guint i = 0; i < P.fconv.columns(); i++) 
+          for (guint j = 0; j <= i; j++) {
+            double val = 0.0;
+            for (guint m = 0; m < P.fconv.rows(); m++) 
+              val += P.fconv(m,i) * P.fconv(m,j);
+            AtA(i,j) = AtA(j,i) = val;
+          }
+
+        L.allocate (n, n);
+        Atb.zero (n);
+        work.allocate (n);
+        constrained.assign (P.HR_trans.rows(), false);
+        factorised = converged = false;
       }
 
 
@@ -92,7 +101,11 @@ namespace MR {
 
 
 
-      void CSDeconv::set (const Math::Vector& DW_signals)
+      // If warm_start is set and the previous call converged, the solution is
+      // initialised using the negative set (and hence the factorisation)
+      // from the previous call, rather than from the linear deconvolution.
+      // This is typically already the correct set for neighbouring voxels. 
+      void CSDeconv::set (const Math::Vector& DW_signals, bool warm_start)
       {
         guint n;
         for (n = 0; n < S.size(); n++)
@@ -105,6 +118,16 @@ namespace MR {
 
         HR_amps.multiply (P.HR_trans, F);
         threshold = P.threshold * HR_amps.mean();
+
+        for (guint i = 0; i < P.fconv.columns(); i++) {
+          Atb[i] = 0.0;
+          for (guint m = 0; m < S.size(); m++)
+            Atb[i] += P.fconv(m,i) * S[m];
+        }
+
+        if (warm_start && factorised && converged) solve();
+        else factorised = false;
+        converged = false;
       }
 
 
@@ -112,13 +135,35 @@ namespace MR {
 
 
 
+      // The constrained least-squares problem is solved via its normal
+      // equations, (AtA + lambda^2 sum_n h_n h_n^T) F = Atb, where the h_n are
+      // the rows of HR_trans for the currently negative directions. Since
+      // only a handful of directions typically enter or leave the negative
+      // set between iterations, the Cholesky factor is maintained using
+      // rank-1 updates and downdates rather than recomputed each time. 
       bool CSDeconv::iterate()
       {
-        neg.clear();
         HR_amps.multiply (P.HR_trans, F);
-        for (guint n = 0; n < HR_amps.size(); n++)
-          if (HR_amps[n] < threshold)
-            neg.push_back (n);
+        return (iterate (&HR_amps[0]));
+      }
+
+
+
+      // as iterate(), with the amplitudes of the current FOD along the
+      // HR_trans directions already computed (see CSDeconvBatch):
+      bool CSDeconv::iterate (const double* HR_amplitudes)
+      {
+        neg.clear();
+        added.clear();
+        removed.clear();
+        for (guint n = 0; n < P.HR_trans.rows(); n++) {
+          bool is_neg = HR_amplitudes[n] < threshold;
+          if (is_neg) neg.push_back (n);
+          if (is_neg != constrained[n]) {
+            if (is_neg) added.push_back (n);
+            else removed.push_back (n);
+          }
+        }
 
         if (P.fconv.rows() + neg.size() < P.HR_trans.columns()) {
           error ("not enough negative directions! failed to converge.");
@@ -126,6 +171,122 @@ namespace MR {
           return (true);
         }
 
+        // same constraints as the previous solve, so F would not change:
+        if (factorised && added.empty() && removed.empty()) 
+          return (converged = true);
+
+        for (guint n = 0; n < added.size(); n++) constrained[added[n]] = true;
+        for (guint n = 0; n < removed.size(); n++) constrained[removed[n]] = false;
+
+        // recompute the factorisation from scratch if that is cheaper than
+        // the rank-1 updates, or if a downdate fails:
+        bool ok = factorised && added.size() + removed.size() <= neg.size();
+        if (ok) {
+          for (guint n = 0; n < added.size() && ok; n++) ok = update (added[n], true);
+          for (guint n = 0; n < removed.size() && ok; n++) ok = update (removed[n], false);
+        }
+        if (!ok) ok = factorise();
+
+        if (!ok) {
+          factorised = false;
+          return (QR_iterate());
+        }
+
+        factorised = true;
+        for (guint n = 0; n < F.size(); n++) work[n] = F[n];
+        solve();
+
+        for (guint n = 0; n < F.size(); n++) 
+          if (F[n] != work[n]) return (false);
+        return (converged = true);
+      }
+
+
+
+
+      bool CSDeconv::factorise ()
+      {
+        const guint n = L.rows();
+        const double lambda2 = P.lambda * P.lambda;
+
+        for (guint i = 0; i < n; i++) 
+          for (guint j = 0; j <= i; j++) 
+            L(i,j) = AtA(i,j);
+
+        for (guint m = 0; m < neg.size(); m++) {
+          const double* h = &P.HR_trans (neg[m], 0);
+          for (guint i = 0; i < n; i++) {
+            const double v = lambda2 * h[i];
+            for (guint j = 0; j <= i; j++) 
+              L(i,j) += v * h[j];
+          }
+        }
+
+        for (guint j = 0; j < n; j++) {
+          double d = L(j,j);
+          for (guint k = 0; k < j; k++) d -= L(j,k) * L(j,k);
+          if (d <= 0.0) return (false);
+          L(j,j) = sqrt (d);
+          for (guint i = j+1; i < n; i++) {
+            double v = L(i,j);
+            for (guint k = 0; k < j; k++) v -= L(i,k) * L(j,k);
+            L(i,j) = v / L(j,j);
+          }
+        }
+
+        return (true);
+      }
+
+
+
+      // rank-1 update (or downdate) of L with lambda * h_direction:
+      bool CSDeconv::update (int direction, bool add)
+      {
+        const guint n = L.rows();
+        for (guint i = 0; i < n; i++) 
+          work[i] = P.lambda * P.HR_trans (direction, i);
+
+        for (guint k = 0; k < n; k++) {
+          const double Lkk = L(k,k);
+          double r2 = add ? Lkk*Lkk + work[k]*work[k] : Lkk*Lkk - work[k]*work[k];
+          if (r2 <= 0.0) return (false);
+          const double r = sqrt (r2);
+          const double c = r / Lkk;
+          const double s = work[k] / Lkk;
+          L(k,k) = r;
+          for (guint i = k+1; i < n; i++) {
+            L(i,k) = add ? (L(i,k) + s*work[i]) / c : (L(i,k) - s*work[i]) / c;
+            work[i] = c*work[i] - s*L(i,k);
+          }
+        }
+
+        return (true);
+      }
+
+
+
+      void CSDeconv::solve ()
+      {
+        const guint n = L.rows();
+        for (guint i = 0; i < n; i++) {
+          double v = Atb[i];
+          for (guint k = 0; k < i; k++) v -= L(i,k) * F[k];
+          F[i] = v / L(i,i);
+        }
+        for (int i = n-1; i >= 0; i--) {
+          double v = F[i];
+          for (guint k = i+1; k < n; k++) v -= L(k,i) * F[k];
+          F[i] = v / L(i,i);
+        }
+      }
+
+
+
+
+      // fallback for ill-conditioned systems: solve the full least-squares
+      // problem by QR decomposition, as was done originally.
+      bool CSDeconv::QR_iterate ()
+      {
         Math::Matrix M (P.fconv.rows()+neg.size(), P.HR_trans.columns());
         for (guint n = 0; n < P.fconv.columns(); n++) 
           for (guint m = 0; m < P.fconv.rows(); m++) 
@@ -143,11 +304,12 @@ namespace MR {
         for (guint n = 0; n < S.size(); n++)
           vec[n] = S[n];
 
-        HR_amps.copy (F);
+        for (guint n = 0; n < F.size(); n++) work[n] = F[n];
         Math::QR_LS_solve (M, vec, F, buf);
-        HR_amps.sub (F);
 
-        return (HR_amps.norm2() == 0.0);
+        for (guint n = 0; n < F.size(); n++) 
+          if (F[n] != work[n]) return (false);
+        return (true);
       }
 
 
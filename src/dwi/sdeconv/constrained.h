@@ -45,8 +45,9 @@ namespace MR {
           CSDeconv (const Common& common);
           virtual ~CSDeconv() { }
 
-          void      set (const Math::Vector& DW_signals);
+          void      set (const Math::Vector& DW_signals, bool warm_start = false);
           bool      iterate();
+          bool      iterate (const double* HR_amplitudes);
 
           const Math::Vector& FOD () const         { return (F); }
           const Math::Vector& signals () const     { return (S); }
@@ -55,10 +56,23 @@ namespace MR {
         protected:
           const Common&      P;
           double             threshold;
-          Math::Matrix       M2;
           Math::Vector       S, F, init_F, S_padded, HR_amps, buf, vec;
           std::vector<int>   neg;
 
+          // Cholesky factor of the normal equations for the current set of
+          // constrained directions, updated incrementally between iterations:
+          Math::Matrix       AtA, L;
+          Math::Vector       Atb, work;
+          std::vector<bool>  constrained;
+          std::vector<int>   added, removed;
+          bool               factorised;
+          bool               converged; //!< whether the last call to iterate() converged
+
+          bool      factorise ();
+          bool      update (int direction, bool add);
+          void      solve ();
+          bool      QR_iterate ();
+
       };
 
     }
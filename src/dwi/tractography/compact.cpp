@@ -0,0 +1,265 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <glibmm/stringutils.h>
+#include "dwi/tractography/compact.h"
+
+// number of tracks per block in compact tracks files
+#define TRACK_COMPACT_BLOCK_SIZE 256
+// size of the block header (number of tracks & size of payload)
+#define TRACK_COMPACT_BLOCK_HEADER (2*sizeof (guint32))
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Compact {
+
+        namespace {
+          // the largest quantised step, or -1 if the track cannot be quantised:
+          gint32 max_step (const std::vector<Point>& tck, float quantum)
+          {
+            for (guint n = 0; n < tck.size(); n++) 
+              if (!gsl_finite (tck[n][0]) || !gsl_finite (tck[n][1]) || !gsl_finite (tck[n][2])) 
+                return (-1);
+
+            gint32 max = 0;
+            Point p (tck[0]);
+            for (guint n = 1; n < tck.size(); n++) {
+              for (guint i = 0; i < 3; i++) {
+                float d = round ((tck[n][i] - p[i]) / quantum);
+                if (fabs (d) > G_MAXINT16) return (-1);
+                gint32 step = gint32 (d);
+                p[i] += quantum * float (step);
+                if (ABS (step) > max) max = ABS (step);
+              }
+            }
+            return (max);
+          }
+
+          template <typename T> inline void put_steps (const std::vector<Point>& tck, float quantum, guint8* data)
+          {
+            Point p (tck[0]);
+            for (guint n = 1; n < tck.size(); n++) {
+              for (guint i = 0; i < 3; i++) {
+                T step = T (round ((tck[n][i] - p[i]) / quantum));
+                p[i] += quantum * float (step);
+                putLE<T> (step, data);
+                data += sizeof (T);
+              }
+            }
+          }
+
+          template <typename T> inline const guint8* get_steps (const guint8* data, guint num, float quantum, std::vector<Point>& tck)
+          {
+            Point p (tck.back());
+            for (guint n = 1; n < num; n++) {
+              p[0] += quantum * float (getLE<T> (data, 0));
+              p[1] += quantum * float (getLE<T> (data, 1));
+              p[2] += quantum * float (getLE<T> (data, 2));
+              tck.push_back (p);
+              data += 3*sizeof (T);
+            }
+            return (data);
+          }
+
+          template <> inline void put_steps<gint8> (const std::vector<Point>& tck, float quantum, guint8* data)
+          {
+            Point p (tck[0]);
+            for (guint n = 1; n < tck.size(); n++) {
+              for (guint i = 0; i < 3; i++) {
+                gint8 step = gint8 (round ((tck[n][i] - p[i]) / quantum));
+                p[i] += quantum * float (step);
+                *(data++) = guint8 (step);
+              }
+            }
+          }
+
+          template <> inline const guint8* get_steps<gint8> (const guint8* data, guint num, float quantum, std::vector<Point>& tck)
+          {
+            const gint8* d = (const gint8*) data;
+            Point p (tck.back());
+            for (guint n = 1; n < num; n++) {
+              p[0] += quantum * float (d[0]);
+              p[1] += quantum * float (d[1]);
+              p[2] += quantum * float (d[2]);
+              tck.push_back (p);
+              d += 3;
+            }
+            return ((const guint8*) d);
+          }
+        }
+
+
+
+
+        void encode (const std::vector<Point>& tck, float quantum, std::vector<guint8>& buffer)
+        {
+          const gsize start = buffer.size();
+          if (tck.empty()) {
+            buffer.resize (start + sizeof (guint32));
+            putLE<guint32> (0, &buffer[start]);
+            return;
+          }
+
+          gint32 max = max_step (tck, quantum);
+          Encoding encoding = max < 0 ? Float32 : ( max > G_MAXINT8 ? Int16 : Int8 );
+          guint32 header = guint32 (tck.size()) | ( guint32 (encoding) << 30 );
+
+          buffer.resize (start + sizeof (guint32));
+          putLE<guint32> (header, &buffer[start]);
+          buffer.resize (start + size (&buffer[start]));
+          guint8* data = &buffer[start + sizeof (guint32)];
+
+          if (encoding == Float32) {
+            for (guint n = 0; n < tck.size(); n++) 
+              for (guint i = 0; i < 3; i++) 
+                putLE<float32> (tck[n][i], data, 3*n+i);
+            return;
+          }
+
+          for (guint i = 0; i < 3; i++) putLE<float32> (tck[0][i], data, i);
+          data += 3*sizeof (float32);
+          if (encoding == Int8) put_steps<gint8> (tck, quantum, data);
+          else put_steps<gint16> (tck, quantum, data);
+        }
+
+
+
+
+        const guint8* decode (const guint8* data, float quantum, std::vector<Point>& tck)
+        {
+          tck.clear();
+          guint32 header = getLE<guint32> (data);
+          guint num = header & 0x3FFFFFFFU;
+          data += sizeof (guint32);
+          if (!num) return (data);
+
+          if ((header >> 30) == Float32) {
+            for (guint n = 0; n < num; n++) 
+              tck.push_back (Point (getLE<float32> (data, 3*n), getLE<float32> (data, 3*n+1), getLE<float32> (data, 3*n+2)));
+            return (data + 3*num*sizeof (float32));
+          }
+
+          tck.push_back (Point (getLE<float32> (data, 0), getLE<float32> (data, 1), getLE<float32> (data, 2)));
+          data += 3*sizeof (float32);
+          if ((header >> 30) == Int8) return (get_steps<gint8> (data, num, quantum, tck));
+          return (get_steps<gint16> (data, num, quantum, tck));
+        }
+
+      }
+
+
+
+
+
+      void CompactWriter::create (const String& file, const Properties& properties, float tolerance)
+      {
+        // use the quantum exactly as it will be read back from the header:
+        quantum = to<float> (str (Compact::quantum (tolerance)));
+        if (!(quantum > 0.0)) throw Exception ("invalid tolerance for compact tracks file");
+        tracks_per_block = TRACK_COMPACT_BLOCK_SIZE;
+
+        out.open (file.c_str(), std::ios::out | std::ios::binary);
+        if (!out) throw Exception ("error creating tracks file \"" + file + "\": " + Glib::strerror (errno));
+
+        out << "mrtrix tracks\nEND\n";
+        for (Properties::const_iterator i = properties.begin(); i != properties.end(); ++i) 
+          if (!Compact::is_layout_property (i->first))
+            out << i->first << ": " << i->second << "\n";
+
+        for (std::vector<String>::const_iterator i = properties.comments.begin(); i != properties.comments.end(); ++i)
+          out << "comment: " << *i << "\n";
+   
+        for (std::vector<RefPtr<ROI> >::const_iterator i = properties.roi.begin(); i != properties.roi.end(); ++i)
+          out << "roi: " << (*i)->specification() << "\n";
+
+        out << "encoding: delta\nquantum: " << str (quantum) << "\ntracks_per_block: " << tracks_per_block << "\n";
+        // leave room for the counts and the index offset:
+        data_offset = goffset(out.tellp()) + 128;
+        out << "file: . " << data_offset << "\n";
+        out << "count: ";
+        count_offset = out.tellp();
+        out << "\nEND\n";
+        out.seekp (0);
+        out << "mrtrix tracks    ";
+        end_offset = data_offset;
+
+        blocks.clear();
+        buffer.assign (TRACK_COMPACT_BLOCK_HEADER, 0);
+        num_in_block = 0;
+
+        flush();
+      }
+
+
+
+
+      void CompactWriter::flush ()
+      {
+        // write the block (if not empty), followed by an empty block to 
+        // terminate the data, overwriting the terminator of the previous
+        // flush, all in a single write:
+        gsize block_size = 0;
+        if (num_in_block) {
+          putLE<guint32> (num_in_block, &buffer[0]);
+          putLE<guint32> (buffer.size() - TRACK_COMPACT_BLOCK_HEADER, &buffer[sizeof (guint32)]);
+          blocks.push_back (end_offset);
+          block_size = buffer.size();
+          buffer.resize (block_size + TRACK_COMPACT_BLOCK_HEADER, 0);
+        }
+        else buffer.assign (TRACK_COMPACT_BLOCK_HEADER, 0);
+
+        out.seekp (end_offset);
+        out.write ((const char*) &buffer[0], buffer.size());
+        end_offset += block_size;
+
+        buffer.assign (TRACK_COMPACT_BLOCK_HEADER, 0);
+        num_in_block = 0;
+
+        if (!out.good())
+          throw Exception ("error writing to tracks file: " + Glib::strerror(errno));
+      }
+
+
+
+
+      void CompactWriter::close ()
+      {
+        if (num_in_block) flush();
+
+        goffset index_offset = end_offset + TRACK_COMPACT_BLOCK_HEADER;
+        std::vector<guint64> index (blocks.size());
+        for (gsize n = 0; n < blocks.size(); n++) index[n] = GUINT64_TO_LE (blocks[n]);
+        out.seekp (index_offset);
+        if (index.size()) out.write ((const char*) &index[0], index.size()*sizeof (guint64));
+
+        out.seekp (count_offset);
+        out << count << "\ntotal_count: " << total_count << "\nindex: " << index_offset << "\nEND\n";
+
+        if (!out.good())
+          throw Exception ("error writing to tracks file: " + Glib::strerror(errno));
+
+        out.close();
+      }
+
+    }
+  }
+}
+
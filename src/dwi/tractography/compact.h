@@ -0,0 +1,159 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __dwi_tractography_compact_h__
+#define __dwi_tractography_compact_h__
+
+#include <fstream>
+
+#include "point.h"
+#include "get_set.h"
+#include "dwi/tractography/properties.h"
+
+/*
+   Compact (delta-encoded) tracks format:
+
+   The header is a standard tracks file header, with the entries:
+     encoding: delta
+     quantum: <step of the quantisation grid, in mm>
+     tracks_per_block: <number of tracks per block>
+     index: <offset of the block index within the data file>
+   and no datatype entry (so that it cannot be mistaken for a
+   floating-point tracks file).
+
+   The data consist of a sequence of blocks, each holding
+   tracks_per_block tracks (except for the last), and terminated
+   by an empty block:
+     block header:   guint32 number of tracks, guint32 size of payload (in bytes)
+     payload:        the encoded tracks
+
+   Each track is stored as:
+     guint32 number of points n, with the encoding in the top two bits
+     (0: gint8 steps, 1: gint16 steps, 2: float32 points), followed by
+     - for float32: the 3n coordinates
+     - otherwise: the 3 float32 coordinates of the first point, followed
+       by the 3(n-1) quantised differences between each point and the 
+       reconstruction of the previous one.
+
+   The block index follows the terminating block, and consists of one
+   guint64 offset (from the start of the data file) per block. If it
+   is missing (e.g. if the file was not closed properly), the blocks 
+   can be found by following the block headers.
+
+   All values are stored little-endian.
+*/
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Compact {
+
+        //! the encodings that can be used for each track
+        enum Encoding { Int8 = 0, Int16 = 1, Float32 = 2 };
+
+        //! the quantisation step required for a maximum (Euclidean) error of \p tolerance
+        inline float quantum (float tolerance) { return (2.0 * tolerance / M_SQRT3); }
+
+        //! append the encoded track to \p buffer 
+        void encode (const std::vector<Point>& tck, float quantum, std::vector<guint8>& buffer);
+
+        //! the number of bytes used by the encoded track at \p data 
+        inline gsize size (const guint8* data)
+        {
+          guint32 header = getLE<guint32> (data);
+          gsize n = header & 0x3FFFFFFFU;
+          if (!n) return (sizeof (guint32));
+          switch (header >> 30) {
+            case Int8:  return (sizeof (guint32) + 3*sizeof (float32) + 3*(n-1)*sizeof (gint8));
+            case Int16: return (sizeof (guint32) + 3*sizeof (float32) + 3*(n-1)*sizeof (gint16));
+            default:    return (sizeof (guint32) + 3*n*sizeof (float32));
+          }
+        }
+
+        //! true if the encoded track at \p data lies entirely within the \p available bytes
+        inline bool fits (const guint8* data, gsize available)
+        {
+          return (available >= sizeof (guint32) && size (data) <= available);
+        }
+
+        //! decode the track at \p data into \p tck, and return the location of the next track
+        const guint8* decode (const guint8* data, float quantum, std::vector<Point>& tck);
+
+        //! true for the header entries that describe the layout of the data, rather than the tracks
+        /*! These are written by the writers themselves, and should not be
+         * copied over from the properties of an input file. */
+        inline bool is_layout_property (const String& key)
+        {
+          return (key == "count" || key == "total_count" || key == "encoding" || 
+              key == "quantum" || key == "tracks_per_block" || key == "index");
+        }
+
+        //! true if the tracks file properties specify the compact format
+        inline bool is_compact (const Properties& properties) 
+        {
+          Properties::const_iterator i = properties.find ("encoding");
+          if (i == properties.end()) return (false);
+          if (i->second != "delta") 
+            throw Exception ("unknown encoding \"" + i->second + "\" for tracks file");
+          return (true);
+        }
+      }
+
+
+
+
+      //! writes tracks in the compact format
+      /*! Each point is stored to within \p tolerance (in mm) of its
+       * original position. A block is written to file each time it is
+       * filled, and the file is left correctly terminated after each
+       * block. */
+      class CompactWriter {
+        public:
+          CompactWriter () : count (0), total_count (0), quantum (0.0), tracks_per_block (0), num_in_block (0) { }
+
+          void create (const String& file, const Properties& properties, float tolerance);
+
+          void append (const std::vector<Point>& tck)
+          {
+            Compact::encode (tck, quantum, buffer);
+            count++;
+            if (++num_in_block >= tracks_per_block) flush();
+          }
+
+          void flush ();
+          void close ();
+
+          guint count, total_count;
+
+        protected:
+          std::ofstream  out;
+          float          quantum;
+          guint          tracks_per_block, num_in_block;
+          goffset        count_offset, data_offset, end_offset;
+          std::vector<guint8> buffer;
+          std::vector<guint64> blocks;
+      };
+
+    }
+  }
+}
+
+#endif
+
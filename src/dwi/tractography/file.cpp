@@ -26,70 +26,94 @@
 */
 
 #include <glibmm/stringutils.h>
+#include "file/config.h"
 #include "dwi/tractography/file.h"
 
+#define TRACK_WRITER_DEFAULT_BUFFER_SIZE 16
+// size of chunks used when copying track data across files (in points)
+#define TRACK_COPY_CHUNK_SIZE (1024*1024)
+
 
 namespace MR {
   namespace DWI {
     namespace Tractography {
 
-      void Reader::open (const String& file, Properties& properties)
+      void read_header (const String& file, Properties& properties, DataType& dtype, String& data_file, goffset& offset)
       {
         properties.clear();
         dtype = DataType::Undefined;
-
-        try {
-          Exception::Lower s (1);
-          File::KeyValue kv (file, "mrtrix tracks");
-          String data_file;
-
-          while (kv.next()) {
-            String key = lowercase (kv.key());
-            if (key == "roi") {
-              try {
-                std::vector<String> V (split (kv.value()));
-                if (V.size() != 2) throw 1;
-                ROI::Type type;
-
-                V[0] = lowercase (V[0]);
-                if (V[0] == "seed") type = ROI::Seed;
-                else if (V[0] == "include") type = ROI::Include;
-                else if (V[0] == "exclude") type = ROI::Exclude;
-                else if (V[0] == "mask") type = ROI::Mask;
-                else throw 1;
-
-                properties.roi.push_back (RefPtr<ROI> (new ROI (type, V[1])));
-              }
-              catch (...) {
-                error ("WARNING: invalid ROI specification in tracks file \"" + file + "\" - ignored");
-              }
+        offset = 0;
+
+        File::KeyValue kv (file, "mrtrix tracks");
+        String files_spec;
+
+        while (kv.next()) {
+          String key = lowercase (kv.key());
+          if (key == "roi") {
+            try {
+              std::vector<String> V (split (kv.value()));
+              if (V.size() != 2) throw 1;
+              ROI::Type type;
+
+              V[0] = lowercase (V[0]);
+              if (V[0] == "seed") type = ROI::Seed;
+              else if (V[0] == "include") type = ROI::Include;
+              else if (V[0] == "exclude") type = ROI::Exclude;
+              else if (V[0] == "mask") type = ROI::Mask;
+              else throw 1;
+
+              properties.roi.push_back (RefPtr<ROI> (new ROI (type, V[1])));
+            }
+            catch (...) {
+              error ("WARNING: invalid ROI specification in tracks file \"" + file + "\" - ignored");
             }
-            else if (key == "comment") properties.comments.push_back (kv.value());
-            else if (key == "file") data_file = kv.value();
-            else if (key == "datatype") dtype.parse (kv.value()); 
-            else properties[key] = kv.value();
           }
+          else if (key == "comment") properties.comments.push_back (kv.value());
+          else if (key == "file") files_spec = kv.value();
+          else if (key == "datatype") dtype.parse (kv.value()); 
+          else properties[key] = kv.value();
+        }
 
+        if (!Compact::is_compact (properties)) {
           if (dtype == DataType::Undefined) throw Exception ("no datatype specified for tracks file \"" + file + "\"");
           if (dtype != DataType::Float32LE && dtype != DataType::Float32BE)
             throw Exception ("only supported datatype for tracks file are Float32LE or Float32BE (in tracks file \"" + file + "\")");
+        }
+
+        if (files_spec.empty()) throw Exception ("missing \"files\" specification for tracks file \"" + file + "\"");
+
+        std::istringstream files_stream (files_spec);
+        files_stream >> data_file;
+        if (files_stream.good()) {
+          try { files_stream >> offset; }
+          catch (...) { throw Exception ("invalid offset specified for file \"" + data_file + "\" in tracks file \"" + file + "\""); }
+        }
+
+        if (data_file != ".") data_file = Glib::build_filename (Glib::path_get_dirname (file), data_file);
+        else data_file = file;
+      }
+
+
 
-          if (data_file.empty()) throw Exception ("missing \"files\" specification for tracks file \"" + file + "\"");
 
-          std::istringstream files_stream (data_file);
-          String fname;
-          files_stream >> fname;
-          goffset offset = 0;
-          if (files_stream.good()) {
-            try { files_stream >> offset; }
-            catch (...) { throw Exception ("invalid offset specified for file \"" + fname + "\" in tracks file \"" + file + "\""); }
-          }
 
-          if (fname != ".") fname = Glib::build_filename (Glib::path_get_dirname (file), fname);
-          else fname = file;
+      void Reader::open (const String& file, Properties& properties)
+      {
+        try {
+          Exception::Lower s (1);
+          String data_file;
+          goffset offset;
+          read_header (file, properties, dtype, data_file, offset);
+
+          quantum = 0.0;
+          block_remaining = 0;
+          if (Compact::is_compact (properties)) {
+            quantum = to<float> (properties["quantum"]);
+            if (!(quantum > 0.0)) throw Exception ("invalid quantum in compact tracks file \"" + file + "\"");
+          }
 
-          in.open (fname.c_str(), std::ios::in | std::ios::binary);
-          if (!in) throw Exception ("error opening tracks data file \"" + fname + "\": " + Glib::strerror(errno));
+          in.open (data_file.c_str(), std::ios::in | std::ios::binary);
+          if (!in) throw Exception ("error opening tracks data file \"" + data_file + "\": " + Glib::strerror(errno));
           in.seekg (offset);
         }
         catch (Exception e) {
@@ -116,6 +140,8 @@ namespace MR {
           return (true);
         }
 
+        if (quantum > 0.0) return (next_compact (tck));
+
         if (!in.is_open()) return (false);
         do {
           Point p = get_next_point();
@@ -140,6 +166,39 @@ namespace MR {
 
 
 
+      bool Reader::next_compact (std::vector<Point>& tck)
+      {
+        while (!block_remaining) {
+          if (!in.is_open()) return (false);
+          guint32 header[2];
+          in.read ((char*) header, sizeof (header));
+          guint num = getLE<guint32> (header, 0);
+          if (!in.good() || !num) {
+            in.close();
+            return (false);
+          }
+          block.resize (getLE<guint32> (header, 1));
+          if (block.size()) in.read ((char*) &block[0], block.size());
+          if (!in.good()) {
+            error ("WARNING: compact tracks file is truncated");
+            in.close();
+            return (false);
+          }
+          block_pos = 0;
+          block_remaining = num;
+        }
+
+        if (!Compact::fits (&block[0] + block_pos, block.size() - block_pos)) 
+          throw Exception ("compact tracks file is corrupt (track extends beyond the end of its block)");
+        block_pos = Compact::decode (&block[0] + block_pos, quantum, tck) - &block[0];
+        block_remaining--;
+        return (true);
+      }
+
+
+
+
+
       void Reader::close ()
       {
         if (mds) mds = NULL;
@@ -159,8 +218,11 @@ namespace MR {
         if (!out) throw Exception ("error creating tracks file \"" + file + "\": " + Glib::strerror (errno));
 
         out << "mrtrix tracks\nEND\n";
+        // the counts are written on closing, and neither they nor the layout
+        // of a compact input file should be carried over:
         for (Properties::const_iterator i = properties.begin(); i != properties.end(); ++i) 
-          out << i->first << ": " << i->second << "\n";
+          if (!Compact::is_layout_property (i->first))
+            out << i->first << ": " << i->second << "\n";
 
         for (std::vector<String>::const_iterator i = properties.comments.begin(); i != properties.comments.end(); ++i)
           out << "comment: " << *i << "\n";
@@ -177,7 +239,99 @@ namespace MR {
         out.seekp (0);
         out << "mrtrix tracks    ";
         out.seekp (data_offset);
-        write_next_point (Point (GSL_POSINF, GSL_POSINF, GSL_POSINF));
+        end_offset = data_offset;
+
+        int buffer_size = File::Config::get_int ("TrackWriterBufferSize", TRACK_WRITER_DEFAULT_BUFFER_SIZE);
+        if (buffer_size < 1) buffer_size = 1;
+        buffer_capacity = buffer_size * (1024*1024 / sizeof (float));
+        buffer.clear();
+        buffer.reserve (buffer_capacity + 3);
+
+        flush();
+      }
+
+
+
+
+      void Writer::flush ()
+      {
+        // terminate the data with an infinite point, overwriting the
+        // terminator of the previous flush, all in a single write:
+        add_point (Point (GSL_POSINF, GSL_POSINF, GSL_POSINF));
+
+        out.seekp (end_offset);
+        out.write ((const char*) &buffer[0], buffer.size()*sizeof(float));
+        end_offset += (buffer.size()-3)*sizeof(float);
+        buffer.clear();
+
+        if (!out.good())
+          throw Exception ("error writing to tracks file: " + Glib::strerror(errno));
+      }
+
+
+
+
+      guint Writer::append_file (const String& file)
+      {
+        Properties properties;
+        DataType in_dtype;
+        String data_file;
+        goffset offset;
+        read_header (file, properties, in_dtype, data_file, offset);
+
+        // compact files need to be decoded:
+        if (Compact::is_compact (properties)) {
+          Reader reader;
+          reader.open (file, properties);
+          std::vector<Point> tck;
+          guint num = 0;
+          while (reader.next (tck)) {
+            append (tck);
+            num++;
+          }
+          reader.close();
+          flush();
+          return (num);
+        }
+
+        std::ifstream in (data_file.c_str(), std::ios::in | std::ios::binary);
+        if (!in) throw Exception ("error opening tracks data file \"" + data_file + "\": " + Glib::strerror(errno));
+        in.seekg (offset);
+
+        if (buffer.size()) flush();
+        const bool swap = in_dtype != dtype;
+
+        std::vector<float> chunk (3*TRACK_COPY_CHUNK_SIZE);
+        guint num = 0;
+        bool finished = false;
+        out.seekp (end_offset);
+
+        while (!finished && in.good()) {
+          in.read ((char*) &chunk[0], chunk.size()*sizeof(float));
+          gsize num_values = 3 * (in.gcount() / (3*sizeof(float)));
+
+          // count the tracks and stop at the terminator:
+          for (gsize n = 0; n < num_values; n += 3) {
+            if (swap) {
+              chunk[n] = ByteOrder::swap (chunk[n]);
+              chunk[n+1] = ByteOrder::swap (chunk[n+1]);
+              chunk[n+2] = ByteOrder::swap (chunk[n+2]);
+            }
+            if (gsl_isnan (chunk[n])) num++;
+            else if (gsl_isinf (chunk[n])) {
+              num_values = n;
+              finished = true;
+              break;
+            }
+          }
+
+          out.write ((const char*) &chunk[0], num_values*sizeof(float));
+          end_offset += num_values*sizeof(float);
+        }
+
+        count += num;
+        flush();
+        return (num);
       }
 
 
@@ -185,6 +339,7 @@ namespace MR {
 
       void Writer::close ()
       {
+        if (buffer.size()) flush();
         out.seekp (count_offset);
         out << count << "\ntotal_count: " << total_count << "\nEND\n";
 
@@ -29,13 +29,26 @@
 #include "file/key_value.h"
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/mds.h"
+#include "dwi/tractography/compact.h"
 
 namespace MR {
   namespace DWI {
     namespace Tractography {
 
+      //! parse the header of a tracks file
+      /*! On return, \p data_file and \p offset hold the location of the
+       * track data. Throws an Exception if the file is not a valid tracks
+       * file. */
+      void read_header (const String& file, Properties& properties, DataType& dtype, String& data_file, goffset& offset);
+
+
+      //! reads tracks sequentially from a tracks file
+      /*! Files in the compact format (see compact.h) and in the older MDS
+       * format are also supported. */
       class Reader {
         public:
+          Reader () : count (0), quantum (0.0), block_pos (0), block_remaining (0) { }
+
           void open (const String& file, Properties& properties);
           bool next (std::vector<Point>& tck);
           void close ();
@@ -46,6 +59,14 @@ namespace MR {
           DataType       dtype;
           guint          count;
 
+          // compact format only (quantum is zero otherwise):
+          float          quantum;
+          std::vector<guint8> block;
+          gsize          block_pos;
+          guint          block_remaining;
+
+          bool next_compact (std::vector<Point>& tck);
+
           Point get_next_point ()
           { 
             using namespace ByteOrder;
@@ -62,28 +83,32 @@ namespace MR {
 
       class Writer {
         public:
-          Writer () : count (0), total_count (0), dtype (DataType::Float32) { dtype.set_byte_order_native(); }
+          Writer () : count (0), total_count (0), dtype (DataType::Float32), buffer_capacity (0) { dtype.set_byte_order_native(); }
 
           void create (const String& file, const Properties& properties);
+
+          //! add a track to the output file
+          /*! Tracks are serialised into an in-memory buffer, which is
+           * written to file in a single operation whenever it exceeds the
+           * size set by the TrackWriterBufferSize configuration entry (in
+           * MB, default is 16). The file is always left correctly
+           * terminated after each flush. */
           void append (const std::vector<Point>& tck)
           {
-            goffset current (out.tellp());
-            current -= 3*sizeof(float);
-            if (tck.size()) {
-              for (std::vector<Point>::const_iterator i = tck.begin()+1; i != tck.end(); ++i) write_next_point (*i);
-              write_next_point (Point (GSL_NAN, GSL_NAN, GSL_NAN));
-            }
-            write_next_point (Point (GSL_POSINF, GSL_POSINF, GSL_POSINF));
-            goffset end (out.tellp());
-            out.seekp (current);
-            write_next_point (tck.size() ? tck[0] : Point (GSL_NAN, GSL_NAN, GSL_NAN));
-            out.seekp (end);
-
-            if (!out.good())
-              throw Exception ("error writing to tracks file: " + Glib::strerror(errno));
-            
+            for (std::vector<Point>::const_iterator i = tck.begin(); i != tck.end(); ++i) add_point (*i);
+            add_point (Point (GSL_NAN, GSL_NAN, GSL_NAN));
             count++;
+            if (buffer.size() >= buffer_capacity) flush();
           }
+          //! append all tracks from the tracks file \p file
+          /*! The track data are copied directly to the output file in a
+           * single sequential pass, without being decoded into individual
+           * tracks (they are only byte-swapped if necessary; files in the
+           * compact format are decoded). Returns the number of tracks
+           * appended, which are added to \a count. */
+          guint append_file (const String& file);
+
+          void flush ();
           void close ();
 
           guint count, total_count;
@@ -91,15 +116,15 @@ namespace MR {
         protected:
           std::ofstream  out;
           DataType dtype;
-          goffset  count_offset;
+          goffset  count_offset, end_offset;
+          std::vector<float> buffer;
+          gsize    buffer_capacity;
 
-          void write_next_point (const Point& p) 
+          void add_point (const Point& p) 
           {
             using namespace ByteOrder;
-            float x[3];
-            if (dtype == DataType::Float32LE) { x[0] = LE(p[0]); x[1] = LE(p[1]); x[2] = LE(p[2]); }
-            else { x[0] = BE(p[0]); x[1] = BE(p[1]); x[2] = BE(p[2]); }
-            out.write ((const char*) x, 3*sizeof(float));
+            if (dtype == DataType::Float32LE) { buffer.push_back (LE(p[0])); buffer.push_back (LE(p[1])); buffer.push_back (LE(p[2])); }
+            else { buffer.push_back (BE(p[0])); buffer.push_back (BE(p[1])); buffer.push_back (BE(p[2])); }
           }
       };
 
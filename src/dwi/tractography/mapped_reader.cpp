@@ -0,0 +1,251 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <fstream>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <glibmm/stringutils.h>
+#include "dwi/tractography/mapped_reader.h"
+
+#define TRACK_INDEX_MAGIC "mrtrix track index\n"
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+
+      void MappedReader::open (const String& file, Properties& properties, bool use_index_file)
+      {
+        close();
+
+        String data_file;
+        goffset offset;
+        read_header (file, properties, dtype, data_file, offset);
+        native = ( dtype == DataType::Native );
+
+        if (Compact::is_compact (properties)) {
+          native = false;
+          fmap.init (data_file);
+          fmap.map();
+          open_compact (file, properties, offset);
+          debug ("mapped compact tracks file \"" + file + "\" with " + str (size()) + " tracks");
+          return;
+        }
+
+        struct_stat64 sbuf;
+        if (STAT64 (data_file.c_str(), &sbuf)) 
+          throw Exception ("cannot stat tracks data file \"" + data_file + "\": " + Glib::strerror (errno));
+
+        fmap.init (data_file);
+        if (gsize (offset) > fmap.size()) 
+          throw Exception ("invalid offset for data in tracks file \"" + file + "\"");
+        fmap.map();
+        data = (const float*) ((const guint8*) fmap.address() + offset);
+
+        const gsize num_points = (fmap.size() - offset) / (3*sizeof (float));
+        const String index_file (file + ".idx");
+        if (use_index_file && load_index (index_file, sbuf.st_mtime, num_points)) 
+          debug ("read track index from file \"" + index_file + "\"");
+        else {
+          build_index (num_points);
+          if (use_index_file) save_index (index_file, sbuf.st_mtime);
+        }
+
+        debug ("mapped tracks file \"" + file + "\" with " + str (size()) + " tracks");
+      }
+
+
+
+
+
+      void MappedReader::close ()
+      {
+        if (fmap.is_mapped()) fmap.unmap();
+        fmap = File::MMap();
+        data = NULL;
+        offsets.clear();
+        current = 0;
+        bytes = cursor = NULL;
+        quantum = 0.0;
+        num_tracks = tracks_per_block = cursor_index = 0;
+        blocks.clear();
+      }
+
+
+
+
+
+      void MappedReader::open_compact (const String& file, Properties& properties, goffset offset)
+      {
+        bytes = (const guint8*) fmap.address();
+        quantum = to<float> (properties["quantum"]);
+        tracks_per_block = to<guint> (properties["tracks_per_block"]);
+        if (!(quantum > 0.0) || !tracks_per_block) 
+          throw Exception ("invalid parameters in compact tracks file \"" + file + "\"");
+
+        if (properties["index"].size() && properties["count"].size()) {
+          num_tracks = to<guint> (properties["count"]);
+          gsize index = to<gsize> (properties["index"]);
+          gsize num_blocks = (num_tracks + tracks_per_block - 1) / tracks_per_block;
+          if (index + num_blocks*sizeof (guint64) <= fmap.size()) {
+            for (gsize n = 0; n < num_blocks; n++) 
+              blocks.push_back (GUINT64_FROM_LE (((const guint64*) (bytes + index))[n]));
+            return;
+          }
+          error ("WARNING: invalid block index in compact tracks file \"" + file + "\" - rebuilding");
+          blocks.clear();
+        }
+
+        // no index (the file was not closed properly): follow the block headers
+        num_tracks = 0;
+        gsize pos = offset;
+        while (pos + 2*sizeof (guint32) <= fmap.size()) {
+          guint num = getLE<guint32> (bytes + pos, 0);
+          gsize block_size = 2*sizeof (guint32) + getLE<guint32> (bytes + pos, 1);
+          if (!num || pos + block_size > fmap.size()) break;
+          if (num_tracks % tracks_per_block) 
+            throw Exception ("unexpected block size in compact tracks file \"" + file + "\"");
+          blocks.push_back (pos);
+          num_tracks += num;
+          pos += block_size;
+        }
+      }
+
+
+
+
+
+      void MappedReader::get_compact (guint index, std::vector<Point>& tck) const
+      {
+        gsize start = blocks[index / tracks_per_block];
+        if (start + 2*sizeof (guint32) > fmap.size() || 
+            start + 2*sizeof (guint32) + getLE<guint32> (bytes + start, 1) > fmap.size()) 
+          throw Exception ("compact tracks file is corrupt (block extends beyond the end of the file)");
+        const guint8* end = bytes + start + 2*sizeof (guint32) + getLE<guint32> (bytes + start, 1);
+
+        const guint8* p = cursor;
+        if (!p || index != cursor_index || index % tracks_per_block == 0) {
+          p = bytes + start + 2*sizeof (guint32);
+          for (guint n = 0; n < index % tracks_per_block; n++) {
+            if (!Compact::fits (p, end - p)) break;
+            p += Compact::size (p);
+          }
+        }
+        if (p > end || !Compact::fits (p, end - p)) 
+          throw Exception ("compact tracks file is corrupt (track extends beyond the end of its block)");
+        cursor = Compact::decode (p, quantum, tck);
+        cursor_index = index+1;
+      }
+
+
+
+
+
+      void MappedReader::get (guint index, std::vector<Point>& tck) const
+      {
+        assert (index < size());
+        if (quantum > 0.0) {
+          get_compact (index, tck);
+          return;
+        }
+        tck.clear();
+        for (gsize n = 3*offsets[index]; n < 3*(offsets[index+1]-1); n += 3) 
+          tck.push_back (Point (value (n), value (n+1), value (n+2)));
+      }
+
+
+
+
+
+      void MappedReader::build_index (gsize num_points)
+      {
+        offsets.clear();
+        offsets.push_back (0);
+        for (gsize n = 0; n < num_points; n++) {
+          float x = value (3*n);
+          if (gsl_isinf (x)) break;
+          if (gsl_isnan (x)) offsets.push_back (n+1);
+        }
+      }
+
+
+
+
+
+      // the index is only validated by the size and modification time of the
+      // data, so also check that it is consistent with the data:
+      bool MappedReader::load_index (const String& index_file, time_t mtime, gsize num_points)
+      {
+        std::ifstream in (index_file.c_str(), std::ios::in | std::ios::binary);
+        if (!in) return (false);
+
+        char magic[sizeof (TRACK_INDEX_MAGIC)];
+        in.read (magic, sizeof (TRACK_INDEX_MAGIC));
+        if (!in.good() || memcmp (magic, TRACK_INDEX_MAGIC, sizeof (TRACK_INDEX_MAGIC))) return (false);
+
+        guint64 file_size, num;
+        gint64 file_mtime;
+        in.read ((char*) &file_size, sizeof (guint64));
+        in.read ((char*) &file_mtime, sizeof (gint64));
+        in.read ((char*) &num, sizeof (guint64));
+        if (!in.good() || file_size != fmap.size() || file_mtime != gint64 (mtime) || num == 0 || num > num_points+1) return (false);
+
+        std::vector<guint64> V (num);
+        in.read ((char*) &V[0], num*sizeof (guint64));
+        if (!in.good() || V[0] != 0 || V[num-1] > num_points) return (false);
+        for (gsize n = 1; n < num; n++) 
+          if (V[n] <= V[n-1]) return (false);
+
+        offsets.assign (V.begin(), V.end());
+        return (true);
+      }
+
+
+
+
+
+      void MappedReader::save_index (const String& index_file, time_t mtime) const
+      {
+        std::ofstream out (index_file.c_str(), std::ios::out | std::ios::binary);
+        if (!out) {
+          debug ("unable to create track index file \"" + index_file + "\": " + Glib::strerror (errno));
+          return;
+        }
+
+        guint64 file_size (fmap.size()), num (offsets.size());
+        gint64 file_mtime (mtime);
+        std::vector<guint64> V (offsets.begin(), offsets.end());
+
+        out.write (TRACK_INDEX_MAGIC, sizeof (TRACK_INDEX_MAGIC));
+        out.write ((const char*) &file_size, sizeof (guint64));
+        out.write ((const char*) &file_mtime, sizeof (gint64));
+        out.write ((const char*) &num, sizeof (guint64));
+        out.write ((const char*) &V[0], num*sizeof (guint64));
+
+        if (!out.good()) {
+          debug ("error writing track index file \"" + index_file + "\"");
+          out.close();
+          g_unlink (index_file.c_str());
+        }
+      }
+
+    }
+  }
+}
+
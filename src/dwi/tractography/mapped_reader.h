@@ -0,0 +1,143 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __dwi_tractography_mapped_reader_h__
+#define __dwi_tractography_mapped_reader_h__
+
+#include "point.h"
+#include "file/mmap.h"
+#include "dwi/tractography/file.h"
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+
+      //! provides random access to the tracks stored in a tracks file
+      /*! The track data are memory-mapped, and the offset of the first
+       * point of each track is indexed when the file is opened. If \p
+       * use_index_file is set (it is not by default), the index is read
+       * from (or saved to) the sidecar file "<tracks>.idx", provided the
+       * size and modification time of the data match those recorded. Since
+       * the modification time is only recorded to the nearest second, this
+       * should only be used for files that are known not to change.
+       *
+       * Only MRtrix tracks files are supported, not the legacy MDS format:
+       * in that case, open() throws the same Exception as read_header().
+       *
+       * When the data are stored in native byte order, tracks can be
+       * retrieved using operator[]() as a Track, which refers directly to
+       * the mapped data without any copy. Otherwise, get() or next() must
+       * be used, which convert the data into a std::vector<Point>. 
+       *
+       * Files in the compact format (see compact.h) are also supported,
+       * using get() or next(). No index file is needed in this case: the
+       * block containing a track is found using the block index stored
+       * in the file, and the preceding tracks in the block are skipped
+       * using their headers. Note that get() then keeps track of the
+       * position of the following track to speed up sequential access,
+       * and so cannot be invoked concurrently from different threads. */
+      class MappedReader {
+        public:
+          class Track {
+            public:
+              Track (const Point* start, guint num_points) : p (start), n (num_points) { }
+
+              guint         size () const                  { return (n); }
+              bool          empty () const                 { return (n == 0); }
+              const Point&  operator[] (guint index) const { return (p[index]); }
+              const Point*  begin () const                 { return (p); }
+              const Point*  end () const                   { return (p+n); }
+
+            protected:
+              const Point* p;
+              guint n;
+          };
+
+          MappedReader () : data (NULL), native (true), current (0), 
+            bytes (NULL), quantum (0.0), num_tracks (0), tracks_per_block (0), cursor (NULL), cursor_index (0) { }
+
+          void open (const String& file, Properties& properties, bool use_index_file = false);
+          void close ();
+
+          //! the number of tracks in the file
+          guint size () const        
+          { 
+            if (quantum > 0.0) return (num_tracks);
+            return (offsets.size() ? offsets.size()-1 : 0); 
+          }
+          //! true if the data can be accessed without byte-swapping
+          bool  is_native () const   { return (native); }
+
+          Track operator[] (guint index) const 
+          {
+            assert (native);
+            assert (index < size());
+            return (Track ((const Point*) data + offsets[index], offsets[index+1] - offsets[index] - 1));
+          }
+
+          void  get (guint index, std::vector<Point>& tck) const;
+
+          //! sequential access, with the same behaviour as Reader::next()
+          bool  next (std::vector<Point>& tck) 
+          {
+            if (current >= size()) { tck.clear(); return (false); }
+            get (current++, tck);
+            return (true);
+          }
+
+          //! move the position for sequential access to the track specified
+          void  seek (guint index)   { current = index; }
+
+        protected:
+          File::MMap          fmap;
+          const float*        data;
+          DataType            dtype;
+          bool                native;
+          guint               current;
+          std::vector<gsize>  offsets;
+
+          // compact format only (quantum is zero otherwise):
+          const guint8*       bytes;
+          float               quantum;
+          guint               num_tracks, tracks_per_block;
+          std::vector<gsize>  blocks;
+          mutable const guint8* cursor;
+          mutable guint       cursor_index;
+
+          float value (gsize index) const 
+          { 
+            using namespace ByteOrder;
+            return (dtype == DataType::Float32LE ? LE (data[index]) : BE (data[index]));
+          }
+
+          void  open_compact (const String& file, Properties& properties, goffset offset);
+          void  get_compact (guint index, std::vector<Point>& tck) const;
+
+          void  build_index (gsize num_points);
+          bool  load_index (const String& index_file, time_t mtime, gsize num_points);
+          void  save_index (const String& index_file, time_t mtime) const;
+      };
+
+    }
+  }
+}
+
+#endif
+
@@ -40,6 +40,8 @@
 
 */
 
+#include <map>
+
 #include "dwi/tractography/tracker/base.h"
 
 namespace MR {
@@ -54,9 +56,16 @@ namespace MR {
           step_size (0.1),
           threshold (0.1),
           num_points (0),
+          seeds_per_voxel (0),
+          rng_key (0),
           no_mask_interp (false), 
           stop_when_included (false),
-          entered_inclusion (false)
+          entered_inclusion (false),
+          abandoned (false),
+          unidirectional (false),
+          reverse_pending (false),
+          termination (Statistics::Threshold),
+          timing (false)
         {
           if (props["step_size"].empty()) props["step_size"] = str (step_size); step_size = to<float> (props["step_size"]); 
           if (props["threshold"].empty()) props["threshold"] = str (threshold); else threshold = to<float> (props["threshold"]); 
@@ -69,6 +78,8 @@ namespace MR {
           if (props["no_mask_interp"].empty()) { no_mask_interp = false; props["no_mask_interp"] = "0"; } 
           else no_mask_interp = to<bool> (props["no_mask_interp"]);
 
+          if (props["unidirectional"].size()) unidirectional = to<int> (props["unidirectional"]);
+
           float max_dist = 200.0;
           if (props["max_dist"].empty()) props["max_dist"] = str(max_dist); else max_dist = to<float> (props["max_dist"]);
           num_max = round (max_dist/step_size);
@@ -106,6 +117,24 @@ namespace MR {
 
           for (std::vector<Sphere>::const_iterator i = spheres.seed.begin(); i != spheres.seed.end(); ++i) total_seed_volume += i->volume; 
           for (std::vector<Mask>::const_iterator i = masks.seed.begin(); i != masks.seed.end(); ++i) total_seed_volume += i->volume;
+
+          if (props["rng_seed"].empty()) props["rng_seed"] = str (time (NULL));
+          rng_key = to<guint64> (props["rng_seed"]);
+
+          if (props["seeds_per_voxel"].size()) {
+            seeds_per_voxel = to<guint> (props["seeds_per_voxel"]);
+            if (spheres.seed.size()) 
+              throw Exception ("grid seeding can only be used with image seed regions");
+            guint num_seeds = 0;
+            for (std::vector<Mask>::const_iterator i = masks.seed.begin(); i != masks.seed.end(); ++i) num_seeds += i->num_voxels;
+            num_seeds *= seeds_per_voxel;
+
+            // each attempt uses the grid seed with the same index, so tracking 
+            // stops once they have all been used:
+            if (props["max_num_tracks"].empty()) props["max_num_tracks"] = str (num_seeds);
+            guint max_num_attempts = props["max_num_attempts"].empty() ? 0 : to<guint> (props["max_num_attempts"]);
+            if (!max_num_attempts || max_num_attempts > num_seeds) props["max_num_attempts"] = str (num_seeds);
+          }
         }
 
 
@@ -115,21 +144,40 @@ namespace MR {
 
 
 
-        void Base::new_seed (const Point& seed_dir, const float init_dir_tolerance_dp)
+        // Each track draws from its own random number stream, keyed by the RNG
+        // seed and the track index, so that track n is the same regardless of
+        // the number of threads or the order in which tracks are generated.
+        // In grid seeding mode, track n uses grid seed n; returns false if 
+        // that seed cannot be used.
+        bool Base::new_seed (const Point& seed_dir, const float init_dir_tolerance_dp, guint64 track_index)
         {
-          excluded = false;
+          rng.set_stream (rng_key, track_index);
+          excluded = abandoned = false;
           for (std::vector<Sphere>::iterator i = spheres.include.begin(); i != spheres.include.end(); ++i) i->included = false;
           for (std::vector<Mask>::iterator i = masks.include.begin(); i != masks.include.end(); ++i) i->included = false;
 
           Point seed_point;
+          if (seeds_per_voxel) {
+            assert (seed_grid);
+            seed_point = seed_grid->get (track_index, masks.seed);
+            stats.num_seeds++;
+            if (!seed_point || not_in_mask (seed_point)) return (false);
+            if (set (seed_point, seed_dir)) return (false);
+            if (seed_dir.valid() && seed_dir.dot (dir) < init_dir_tolerance_dp) return (false);
+            init_reaches();
+            return (true);
+          }
+
 set_loop:
           do { 
             seed_point = gen_seed(); 
+            stats.num_seeds++;
           } while (not_in_mask (seed_point));
           if (!set (seed_point, seed_dir)) {
-            if (!seed_dir) return;
-            if (seed_dir.dot (dir) >= init_dir_tolerance_dp)
-              return;
+            if (!seed_dir || seed_dir.dot (dir) >= init_dir_tolerance_dp) {
+              init_reaches();
+              return (true);
+            }
           }
           goto set_loop;
         }
@@ -137,43 +185,480 @@ set_loop:
 
 
 
+        // record which inclusion ROIs the reverse pass may reach from the seed:
+        void Base::init_reaches ()
+        {
+          reverse_pending = !unidirectional;
+          if (!roi_lookup || !roi_lookup->num_include()) return;
+          seed_reaches.resize (roi_lookup->num_include());
+          gssize voxel = roi_lookup->voxel (pos);
+          for (guint n = 0; n < seed_reaches.size(); n++) 
+            seed_reaches[n] = voxel < 0 || roi_lookup->distance (voxel, n) <= num_max * step_size;
+        }
+
+
+
+
 
         bool Base::next () 
         {
-          if (excluded) return (false);
-          if (stop_when_included && entered_inclusion) return (false);
-          if (num_points >= num_max) return (false);
-          if (next_point()) return (false);
+          if (excluded || abandoned) return (false);
+          if (stop_when_included && entered_inclusion) return (terminate (Statistics::Included));
+          if (num_points >= num_max) return (terminate (Statistics::MaxLength));
+
+          termination = Statistics::Threshold;
+          if (timing) {
+            double start = timer.elapsed();
+            bool stop = next_point();
+            stats.direction_time += timer.elapsed() - start;
+            if (stop) return (terminate (termination));
+          }
+          else if (next_point()) return (terminate (termination));
           pos += step_size * dir; 
-          if (not_in_mask (pos)) return (false);
 
-          for (std::vector<Sphere>::iterator i = spheres.exclude.begin(); i != spheres.exclude.end(); ++i) { 
-            if (i->contains (pos)) { 
-              excluded = true;
-              return (false); 
-            } 
+          gssize voxel = roi_lookup ? roi_lookup->voxel (pos) : -1;
+          const ROILookup::Entry* roi = voxel < 0 ? NULL : &roi_lookup->entry (voxel);
+          if (not_in_mask (pos, roi)) return (terminate (Statistics::MaskExit));
+
+          if (in_exclude (pos, roi)) {
+            excluded = true;
+            return (terminate (Statistics::Excluded));
           }
 
-          for (std::vector<Mask>::iterator i = masks.exclude.begin(); i != masks.exclude.end(); ++i) {
-            if (i->contains (pos)) {
-              excluded = true; 
-              return (false); 
+          num_points++;
+          stats.num_steps++;
+          update_included (pos, roi);
+
+          if (voxel >= 0 && roi_lookup->num_include() && !can_reach_includes (voxel)) {
+            abandoned = true;
+            return (terminate (Statistics::Unreachable));
+          }
+
+          return (true);
+        }
+
+
+
+
+        void Base::precompute ()
+        {
+          if (spheres.mask.size() || masks.mask.size() || 
+              spheres.exclude.size() || masks.exclude.size() || 
+              spheres.include.size() || masks.include.size()) 
+            roi_lookup = new ROILookup (source, spheres, masks);
+
+          std::vector<double> volumes;
+          for (std::vector<Sphere>::const_iterator i = spheres.seed.begin(); i != spheres.seed.end(); ++i) volumes.push_back (i->volume);
+          for (std::vector<Mask>::iterator i = masks.seed.begin(); i != masks.seed.end(); ++i) {
+            volumes.push_back (i->volume);
+            i->seeding = new SeedVoxels (*i);
+          }
+
+          if (seeds_per_voxel) {
+            seed_grid = new SeedGrid (masks.seed, seeds_per_voxel);
+            info ("grid seeding using " + str (seed_grid->size()) + " seeds");
+          }
+          else seed_selector = new Math::Discrete (volumes);
+        }
+
+
+
+        void Base::share_precomputed (const Base& tracker)
+        {
+          roi_lookup = tracker.roi_lookup;
+          seed_selector = tracker.seed_selector;
+          seed_grid = tracker.seed_grid;
+          for (guint n = 0; n < masks.seed.size(); n++) 
+            masks.seed[n].seeding = tracker.masks.seed[n].seeding;
+        }
+
+
+
+
+        Base::SeedVoxels::SeedVoxels (Mask& mask)
+        {
+          Image::Interp& i (mask.i);
+          std::vector<double> weights;
+
+          int lower[3], upper[3];
+          for (guint n = 0; n < 3; n++) {
+            lower[n] = int (mask.lower[n] + 0.5);
+            upper[n] = int (mask.upper[n] - 0.5);
+          }
+
+          for (int z = lower[2]; z <= upper[2]; z++) {
+            for (int y = lower[1]; y <= upper[1]; y++) {
+              for (int x = lower[0]; x <= upper[0]; x++) {
+                i.set (0,x); i.set (1,y); i.set (2,z);
+                if (i.Image::Position::value() >= 0.5) 
+                  grid.push_back (Point (x, y, z));
+
+                // range of values that can contribute to the interpolated value within the voxel:
+                float vmin = GSL_POSINF, vmax = GSL_NEGINF;
+                for (i.set (2, MAX (z-1, 0)); i[2] <= MIN (z+1, i.dim(2)-1); i.inc(2)) {
+                  for (i.set (1, MAX (y-1, 0)); i[1] <= MIN (y+1, i.dim(1)-1); i.inc(1)) {
+                    for (i.set (0, MAX (x-1, 0)); i[0] <= MIN (x+1, i.dim(0)-1); i.inc(0)) {
+                      float val = i.Image::Position::value();
+                      if (vmin > val) vmin = val;
+                      if (vmax < val) vmax = val;
+                    }
+                  }
+                }
+                if (!(vmax >= 0.5)) continue;
+
+                // voxel entirely within the mask, otherwise estimate its partial volume 
+                // by sub-sampling (keeping a small non-zero weight, since part of it may
+                // still lie within the mask):
+                float weight = 1.0;
+                if (!(vmin >= 0.5)) {
+                  guint count = 0;
+                  for (guint k = 0; k < 64; k++) {
+                    i.P (Point (x + ((k&3)+0.5)/4.0 - 0.5, y + (((k>>2)&3)+0.5)/4.0 - 0.5, z + ((k>>4)+0.5)/4.0 - 0.5));
+                    if (i.value() >= 0.5) count++;
+                  }
+                  weight = MAX (count, 0.5) / 64.0;
+                }
+
+                voxels.push_back (Point (x, y, z));
+                weights.push_back (weight);
+              }
             }
           }
 
-          num_points++;
+          sampler = new Math::Discrete (weights);
+        }
 
-          for (std::vector<Sphere>::iterator i = spheres.include.begin(); i != spheres.include.end(); ++i) 
-            if (!i->included)
-              if (i->contains (pos)) 
-                i->included = entered_inclusion = true;
 
-          for (std::vector<Mask>::iterator i = masks.include.begin(); i != masks.include.end(); ++i) 
-            if (!i->included) 
-              if (i->contains (pos)) 
-                i->included = entered_inclusion = true;
 
-          return (true);
+
+        Base::SeedGrid::SeedGrid (const std::vector<Mask>& seed_masks, guint seeds_per_voxel) :
+          per_voxel (seeds_per_voxel)
+        {
+          offsets.push_back (0);
+          for (std::vector<Mask>::const_iterator i = seed_masks.begin(); i != seed_masks.end(); ++i) {
+            if (!i->seeding) 
+              throw Exception ("grid seeding requires precomputed seed voxel lists");
+            offsets.push_back (offsets.back() + i->seeding->grid.size());
+          }
+        }
+
+
+
+        Point Base::SeedGrid::get (guint64 index, std::vector<Mask>& seed_masks) const
+        {
+          if (index >= size()) return (Point::Invalid);
+
+          guint voxel = index / per_voxel, k = index % per_voxel;
+          guint m = 0;
+          while (voxel >= offsets[m+1]) m++;
+          Point p (seed_masks[m].seeding->grid[voxel - offsets[m]]);
+
+          // seeds within each voxel are placed on a Halton sequence, so that
+          // they are evenly spread for any number of seeds per voxel:
+          if (per_voxel > 1) {
+            const guint base[] = { 2, 3, 5 };
+            for (guint n = 0; n < 3; n++) {
+              float f = 1.0, r = 0.0;
+              for (guint j = k+1; j; j /= base[n]) {
+                f /= base[n];
+                r += f * (j % base[n]);
+              }
+              p[n] += r - 0.5;
+            }
+          }
+
+          return (seed_masks[m].i.P2R (p));
+        }
+
+
+
+
+        namespace {
+
+          // relative safety margin used when classifying voxels, to allow for
+          // round-off in the transforms:
+          const float ROI_MARGIN = 1e-3;
+
+          class ROIRef {
+            public:
+              ROIRef (int category_index, Base::Sphere* roi_sphere, Base::Mask* roi_mask, int roi_index) : 
+                category (category_index), sphere (roi_sphere), mask (roi_mask), index (roi_index) { }
+              int category;
+              Base::Sphere* sphere;
+              Base::Mask* mask;
+              int index;
+              int lower[3], upper[3];
+              bool outside;
+          };
+
+          enum { Out = 0, In = 1, Test = 2 };
+
+          void get_voxel_bounds (ROIRef& roi, const Point* corners, const Image::Interp& source)
+          {
+            Point lo (GSL_POSINF, GSL_POSINF, GSL_POSINF), hi (GSL_NEGINF, GSL_NEGINF, GSL_NEGINF);
+            for (guint k = 0; k < 8; k++) {
+              Point p (source.R2P (corners[k]));
+              for (guint n = 0; n < 3; n++) {
+                if (lo[n] > p[n]) lo[n] = p[n];
+                if (hi[n] < p[n]) hi[n] = p[n];
+              }
+            }
+            roi.outside = false;
+            for (guint n = 0; n < 3; n++) {
+              roi.lower[n] = MAX (int (floor (lo[n]+0.5)) - 1, 0);
+              roi.upper[n] = MIN (int (floor (hi[n]+0.5)) + 1, source.dim(n)-1);
+              if (lo[n] < ROI_MARGIN - 0.5 || hi[n] > source.dim(n) - 0.5 - ROI_MARGIN) roi.outside = true;
+            }
+          }
+
+
+
+          // squared Euclidean distance transform along one axis, using the
+          // lower envelope of parabolas (Felzenszwalb & Huttenlocher, 2004):
+          void distance_transform (float* f, int num, gsize stride, double spacing2, 
+              std::vector<double>& g, std::vector<int>& v, std::vector<double>& z)
+          {
+            for (int q = 0; q < num; q++) g[q] = f[q*stride];
+
+            int k = 0;
+            v[0] = 0;
+            z[0] = GSL_NEGINF;
+            z[1] = GSL_POSINF;
+            for (int q = 1; q < num; q++) {
+              double s;
+              do {
+                s = ((g[q] + spacing2*q*q) - (g[v[k]] + spacing2*v[k]*v[k])) / (2.0*spacing2*(q - v[k]));
+                if (s > z[k]) break;
+              } while (--k >= 0);
+              k++;
+              v[k] = q;
+              z[k] = k ? s : GSL_NEGINF;
+              z[k+1] = GSL_POSINF;
+            }
+
+            k = 0;
+            for (int q = 0; q < num; q++) {
+              while (z[k+1] < q) k++;
+              f[q*stride] = spacing2 * (q - v[k]) * (q - v[k]) + g[v[k]];
+            }
+          }
+
+          int classify (const Base::Sphere& sphere, const Point* corners)
+          {
+            bool all_in = true;
+            Point centre (0.0, 0.0, 0.0);
+            for (guint k = 0; k < 8; k++) {
+              if (dist2 (sphere.p, corners[k]) >= sphere.r2 * (1.0 - ROI_MARGIN)) all_in = false;
+              centre += corners[k];
+            }
+            if (all_in) return (In);
+
+            centre *= 0.125;
+            float half_diagonal = 0.0;
+            for (guint k = 0; k < 8; k++) 
+              half_diagonal = MAX (half_diagonal, dist (centre, corners[k]));
+            if (dist (centre, sphere.p) >= sphere.r * (1.0 + ROI_MARGIN) + half_diagonal) return (Out);
+
+            return (Test);
+          }
+
+          int classify (Base::Mask& mask, const Point* corners)
+          {
+            Point lo (GSL_POSINF, GSL_POSINF, GSL_POSINF), hi (GSL_NEGINF, GSL_NEGINF, GSL_NEGINF);
+            for (guint k = 0; k < 8; k++) {
+              Point p (mask.i.R2P (corners[k]));
+              for (guint n = 0; n < 3; n++) {
+                if (lo[n] > p[n]) lo[n] = p[n];
+                if (hi[n] < p[n]) hi[n] = p[n];
+              }
+            }
+
+            bool inside = true;
+            int a[3], b[3];
+            for (guint n = 0; n < 3; n++) {
+              lo[n] -= ROI_MARGIN;
+              hi[n] += ROI_MARGIN;
+              if (hi[n] < mask.lower[n] || lo[n] >= mask.upper[n]) return (Out);
+              if (lo[n] < mask.lower[n] || hi[n] >= mask.upper[n]) inside = false;
+
+              // range of voxels that can contribute to the value of any point
+              // within the region, restricted to the bounding box of the ROI:
+              float l = MAX (lo[n], mask.lower[n]), h = MIN (hi[n], mask.upper[n]);
+              if (mask.no_interp) { a[n] = int (floor (l+0.5)); b[n] = int (floor (h+0.5)); }
+              else { a[n] = int (floor (l)); b[n] = int (floor (h)) + 1; }
+              a[n] = MAX (a[n], 0);
+              b[n] = MIN (b[n], mask.i.dim(n)-1);
+            }
+
+            float vmin = GSL_POSINF, vmax = GSL_NEGINF;
+            for (mask.i.set (2, a[2]); mask.i[2] <= b[2]; mask.i.inc(2)) {
+              for (mask.i.set (1, a[1]); mask.i[1] <= b[1]; mask.i.inc(1)) {
+                for (mask.i.set (0, a[0]); mask.i[0] <= b[0]; mask.i.inc(0)) {
+                  float val = mask.i.Image::Position::value();
+                  if (gsl_isnan (val)) return (Test);
+                  if (vmin > val) vmin = val;
+                  if (vmax < val) vmax = val;
+                }
+              }
+            }
+
+            if (mask.no_interp) {
+              if (vmax <= 0.5) return (Out);
+              if (inside && vmin > 0.5) return (In);
+            }
+            else {
+              // interpolation weights below 1e-6 are discarded by Image::Interp::P():
+              if (vmax < 0.5) return (Out);
+              if (inside && vmin * (1.0 - 8e-6) >= 0.5) return (In);
+            }
+            return (Test);
+          }
+
+        }
+
+
+
+
+        Base::ROILookup::ROILookup (const Image::Interp& source, ROISphere& spheres, ROIMask& masks) 
+        {
+          Point origin (source.R2P (Point (0.0, 0.0, 0.0)));
+          for (guint n = 0; n < 3; n++) {
+            Point axis (source.R2P (Point (n == 0, n == 1, n == 2)));
+            for (guint m = 0; m < 3; m++) 
+              T[m][n] = axis[m] - origin[m];
+            T[n][3] = origin[n];
+            dim[n] = source.dim(n);
+          }
+
+          std::vector<ROIRef> rois;
+          for (guint n = 0; n < spheres.mask.size(); n++) rois.push_back (ROIRef (0, &spheres.mask[n], NULL, n));
+          for (guint n = 0; n < masks.mask.size(); n++) rois.push_back (ROIRef (0, NULL, &masks.mask[n], n));
+          for (guint n = 0; n < spheres.exclude.size(); n++) rois.push_back (ROIRef (1, &spheres.exclude[n], NULL, n));
+          for (guint n = 0; n < masks.exclude.size(); n++) rois.push_back (ROIRef (1, NULL, &masks.exclude[n], n));
+          for (guint n = 0; n < spheres.include.size(); n++) rois.push_back (ROIRef (2, &spheres.include[n], NULL, n));
+          for (guint n = 0; n < masks.include.size(); n++) rois.push_back (ROIRef (2, NULL, &masks.include[n], n));
+
+          // bounding box of each ROI on the source voxel grid:
+          Point corners[8];
+          for (std::vector<ROIRef>::iterator roi = rois.begin(); roi != rois.end(); ++roi) {
+            for (guint k = 0; k < 8; k++) {
+              if (roi->sphere) 
+                corners[k] = roi->sphere->p + Point (k&1 ? roi->sphere->r : -roi->sphere->r, k&2 ? roi->sphere->r : -roi->sphere->r, k&4 ? roi->sphere->r : -roi->sphere->r);
+              else 
+                corners[k] = roi->mask->i.P2R (Point (k&1 ? roi->mask->upper[0] : roi->mask->lower[0], k&2 ? roi->mask->upper[1] : roi->mask->lower[1], k&4 ? roi->mask->upper[2] : roi->mask->lower[2]));
+            }
+            get_voxel_bounds (*roi, corners, source);
+          }
+
+          ProgressBar::init (dim[2], "precomputing ROI lookup table...");
+
+          std::map<std::vector<guint8>,guint32> label_map;
+          std::vector<guint8> state (rois.size()), previous;
+          guint32 label = 0, num_test = 0;
+          labels.resize (dim[0]*dim[1]*dim[2]);
+          guint32* l = &labels[0];
+
+          // voxels that may contain part of each inclusion ROI are the
+          // sources for its distance transform:
+          const guint first_include = rois.size() - spheres.include.size() - masks.include.size();
+          const float far = 1e30;
+          distances.assign (rois.size() - first_include, std::vector<float> (labels.size(), far));
+
+          for (int z = 0; z < dim[2]; z++) {
+            for (int y = 0; y < dim[1]; y++) {
+              for (int x = 0; x < dim[0]; x++) {
+                bool corners_set = false;
+                for (guint r = 0; r < rois.size(); r++) {
+                  ROIRef& roi (rois[r]);
+                  state[r] = Out;
+                  if (x < roi.lower[0] || x > roi.upper[0] || y < roi.lower[1] || y > roi.upper[1] || z < roi.lower[2] || z > roi.upper[2]) continue;
+                  if (!corners_set) {
+                    for (guint k = 0; k < 8; k++) 
+                      corners[k] = source.P2R (Point (x + (k&1 ? 0.5 : -0.5), y + (k&2 ? 0.5 : -0.5), z + (k&4 ? 0.5 : -0.5)));
+                    corners_set = true;
+                  }
+                  state[r] = roi.sphere ? classify (*roi.sphere, corners) : classify (*roi.mask, corners);
+                  if (state[r] == Test) num_test++;
+                  if (r >= first_include && state[r] != Out) 
+                    distances[r - first_include][l - &labels[0]] = 0.0;
+                }
+
+                if (state != previous) {
+                  std::map<std::vector<guint8>,guint32>::iterator i = label_map.find (state);
+                  if (i == label_map.end()) {
+                    label = label_map.size();
+                    label_map[state] = label;
+                  }
+                  else label = i->second;
+                  previous = state;
+                }
+                *l++ = label;
+              }
+            }
+            ProgressBar::inc();
+          }
+          ProgressBar::done();
+
+
+          entries.resize (label_map.size());
+          for (std::map<std::vector<guint8>,guint32>::const_iterator i = label_map.begin(); i != label_map.end(); ++i) {
+            Entry& entry (entries[i->second]);
+            for (guint r = 0; r < rois.size(); r++) {
+              Category& category (rois[r].category == 0 ? entry.mask : ( rois[r].category == 1 ? entry.exclude : entry.include ));
+              switch (i->first[r]) {
+                case Out: 
+                  category.any_out = true; 
+                  break;
+                case In: 
+                  category.any_in = true; 
+                  if (rois[r].sphere) category.in_spheres.push_back (rois[r].index);
+                  else category.in_masks.push_back (rois[r].index);
+                  break;
+                default:
+                  if (rois[r].sphere) category.test_spheres.push_back (rois[r].index);
+                  else category.test_masks.push_back (rois[r].index);
+              }
+            }
+          }
+
+          info ("ROI lookup table computed with " + str (entries.size()) + " distinct labels; " 
+              + str (num_test) + " voxel/ROI pairs require explicit testing");
+
+          if (distances.empty()) return;
+
+          // the voxel extent and the range of the final step may span the
+          // boundary of the source image, so any inclusion ROI that extends
+          // beyond it must be considered reachable from the boundary voxels:
+          const gsize stride[] = { 1, dim[0], dim[0]*dim[1] };
+          for (guint r = first_include; r < rois.size(); r++) {
+            if (!rois[r].outside) continue;
+            std::vector<float>& D (distances[r - first_include]);
+            for (gsize i = 0; i < D.size(); i++) {
+              int x = i % dim[0], y = (i / dim[0]) % dim[1], z = i / stride[2];
+              if (x == 0 || y == 0 || z == 0 || x == dim[0]-1 || y == dim[1]-1 || z == dim[2]-1) D[i] = 0.0;
+            }
+          }
+
+          // point-to-ROI distance is at least the distance between voxel
+          // centres, less the distance from either point to its voxel centre:
+          const float slack = sqrt (gsl_pow_2 (source.vox(0)) + gsl_pow_2 (source.vox(1)) + gsl_pow_2 (source.vox(2))) * (1.0 + ROI_MARGIN);
+          const int max_dim = MAX (dim[0], MAX (dim[1], dim[2]));
+          std::vector<double> g (max_dim), z (max_dim+1);
+          std::vector<int> v (max_dim);
+
+          for (std::vector<std::vector<float> >::iterator D = distances.begin(); D != distances.end(); ++D) {
+            for (guint axis = 0; axis < 3; axis++) {
+              const guint a = (axis+1) % 3, b = (axis+2) % 3;
+              const double spacing2 = gsl_pow_2 (source.vox(axis));
+              for (int j = 0; j < dim[b]; j++) 
+                for (int i = 0; i < dim[a]; i++) 
+                  distance_transform (&(*D)[i*stride[a] + j*stride[b]], dim[axis], stride[axis], spacing2, g, v, z);
+            }
+            for (std::vector<float>::iterator d = D->begin(); d != D->end(); ++d) 
+              *d = MAX (sqrt (*d) - slack, 0.0);
+          }
+
+          info ("computed distance maps for " + str (distances.size()) + " inclusion ROI(s)");
         }
 
 
@@ -46,10 +46,14 @@
 #ifndef __dwi_tractography_tracker_base_h__
 #define __dwi_tractography_tracker_base_h__
 
-#include "image/interp.h"
+#include "image/interp_vector.h"
 #include "math/matrix.h"
 #include "math/simulation.h"
 #include "dwi/tractography/properties.h"
+#include "dwi/tractography/tracker/statistics.h"
+
+// maximum number of points drawn within a seed voxel before drawing another voxel
+#define SEED_VOXEL_TRIALS 100
 
 namespace MR {
   namespace DWI {
@@ -61,12 +65,14 @@ namespace MR {
             Base (Image::Object& source_image, Properties& properties);
             virtual ~Base ();
 
-            bool          set (const Point& seed, const Point& seed_dir = Point::Invalid) { pos = seed; num_points = 0; entered_inclusion = false; return (init_direction (seed_dir)); }
-            void          new_seed (const Point& seed_dir, const float init_dir_tolerance_dp);
+            bool          set (const Point& seed, const Point& seed_dir = Point::Invalid) { pos = seed; num_points = 0; entered_inclusion = reverse_pending = false; return (init_direction (seed_dir)); }
+            bool          new_seed (const Point& seed_dir, const float init_dir_tolerance_dp, guint64 track_index);
             const Point&  position () const  { return (pos); }
             const Point&  direction () const { return (dir); }
 
             bool track_excluded () const { return (excluded); }
+            //! true if tracking was stopped because the track could no longer reach all inclusion ROIs
+            bool track_abandoned () const { return (abandoned); }
             bool track_included () const 
             { 
               for (std::vector<Sphere>::const_iterator i = spheres.include.begin(); i != spheres.include.end(); ++i) 
@@ -82,6 +88,12 @@ namespace MR {
             bool next ();
 
             void set_rng_seed (guint seed) { return (rng.set_seed (seed)); }
+            guint64 get_rng_key () const { return (rng_key); }
+
+            //! the statistics collected by this tracker
+            Statistics& statistics () { return (stats); }
+            //! also record the time spent fetching source data and computing directions
+            void enable_timing () { timing = true; }
 
             static float curv2angle (float step_size, float curv)     { return (2.0 * asin (step_size / (2.0 * curv))); }
 
@@ -103,10 +115,12 @@ namespace MR {
                 }
             };
 
+            class SeedVoxels;
+
             class Mask {
               public:
                 Mask (Image::Object& image, bool no_mask_interp) :
-                  i (image), lower (i.dim(0), i.dim(1), i.dim(2)), upper (0.0, 0.0, 0.0), volume (0.0), included (false), no_interp (no_mask_interp) {
+                  i (image), lower (i.dim(0), i.dim(1), i.dim(2)), upper (0.0, 0.0, 0.0), volume (0.0), num_voxels (0), included (false), no_interp (no_mask_interp) {
                     get_bounds();
                     if (volume == 0.0) 
                       throw Exception ("image ROI \"" + image.name() + "\" is empty");
@@ -115,7 +129,9 @@ namespace MR {
                 Image::Interp i;
                 Point lower, upper;
                 float volume;
+                guint num_voxels;
                 bool included, no_interp;
+                RefPtr<SeedVoxels> seeding;
 
                 bool contains (const Point& pt) {
                   if (!pt.valid()) return false;
@@ -133,6 +149,19 @@ namespace MR {
                 Point seed (Math::RNG& rng)
                 {
                   Point p;
+                  if (seeding) {
+                    // pick a voxel in proportion to its partial volume, and a
+                    // uniformly distributed point within the mask inside it: 
+                    do {
+                      const Point& v (seeding->voxels[(*seeding->sampler) (rng)]);
+                      for (guint n = 0; n < SEED_VOXEL_TRIALS; n++) {
+                        p.set (v[0]+rng.uniform()-0.5, v[1]+rng.uniform()-0.5, v[2]+rng.uniform()-0.5);
+                        i.P (p);
+                        if (i.value() >= 0.5) return (i.P2R (p));
+                      }
+                    } while (true);
+                  }
+
                   do {
                     p.set (lower[0]+rng.uniform()*(upper[0]-lower[0]), lower[1]+rng.uniform()*(upper[1]-lower[1]), lower[2]+rng.uniform()*(upper[2]-lower[2]));
                     i.P (p);
@@ -143,7 +172,7 @@ namespace MR {
               private:
                 void get_bounds ()
                 {
-                  guint count = 0;
+                  guint& count (num_voxels);
                   for (i.set(2,0); i[2] < i.dim(2); i.inc(2)) {
                     for (i.set(1,0); i[1] < i.dim(1); i.inc(1)) {
                       for (i.set(0,0); i[0] < i.dim(0); i.inc(0)) {
@@ -166,17 +195,116 @@ namespace MR {
             };
 
 
+            //! precomputed list of the voxels that may contain seeds for a mask ROI
+            /*! Each voxel is weighted by the (estimated) fraction of its volume
+             * for which the interpolated mask value is at least 0.5, and drawn
+             * using an alias table. The voxels whose centres lie within the
+             * mask are also listed, for use in grid seeding mode. */
+            class SeedVoxels {
+              public:
+                SeedVoxels (Mask& mask);
+
+                std::vector<Point> voxels, grid;
+                Ptr<Math::Discrete> sampler;
+            };
+
+            //! deterministic seeding, with a fixed number of seeds per mask voxel
+            /*! Seeds are identified by their index, so that each can be
+             * assigned to a given track. */
+            class SeedGrid {
+              public:
+                SeedGrid (const std::vector<Mask>& seed_masks, guint seeds_per_voxel);
+
+                //! the total number of seeds
+                guint size () const { return (offsets.back() * per_voxel); }
+                //! return seed \p index, or an invalid Point if out of range
+                Point get (guint64 index, std::vector<Mask>& seed_masks) const;
+
+              protected:
+                guint per_voxel;
+                std::vector<guint> offsets;
+            };
+
             class ROISphere { public: std::vector<Sphere> seed, include, exclude, mask; };
             class ROIMask   { public: std::vector<Mask>   seed, include, exclude, mask; };
 
 
+            //! precomputed ROI containment over the voxel grid of the source image
+            /*! Each voxel of the source image is given a label identifying which
+             * of the mask, exclusion and inclusion ROIs fully contain it, and which
+             * fully exclude it; both are determined conservatively, allowing for
+             * the trilinear (or nearest-neighbour) interpolation of mask images.
+             * Only the ROIs that partially overlap a voxel then need to be tested
+             * explicitly, so that most steps require no ROI tests at all. 
+             *
+             * For each inclusion ROI, a lower bound on the distance (in mm)
+             * from any point within each voxel to the ROI is also computed,
+             * using a Euclidean distance transform. */
+            class ROILookup {
+              public:
+                class Category {
+                  public:
+                    Category () : any_in (false), any_out (false) { }
+                    bool any_in, any_out;
+                    std::vector<int> in_spheres, in_masks, test_spheres, test_masks;
+                };
+
+                class Entry { 
+                  public: 
+                    Category mask, exclude, include; 
+                };
+
+                ROILookup (const Image::Interp& source, ROISphere& spheres, ROIMask& masks);
+
+                //! return the index of the voxel containing \p pt, or -1 if outside the source image
+                gssize voxel (const Point& pt) const 
+                {
+                  if (!pt.valid()) return (-1);
+                  int x[3];
+                  for (guint n = 0; n < 3; n++) {
+                    x[n] = int (floor (T[n][0]*pt[0] + T[n][1]*pt[1] + T[n][2]*pt[2] + T[n][3] + 0.5));
+                    if (x[n] < 0 || x[n] >= dim[n]) return (-1);
+                  }
+                  return (x[0] + dim[0]*(x[1] + dim[1]*x[2]));
+                }
+
+                const Entry& entry (gsize index) const { return (entries[labels[index]]); }
+
+                //! return the entry for the voxel containing \p pt, or NULL if outside the source image
+                const Entry* operator() (const Point& pt) const 
+                {
+                  gssize index = voxel (pt);
+                  return (index < 0 ? NULL : &entry (index));
+                }
+
+                //! lower bound on the distance from voxel \p index to inclusion ROI \p roi (spheres first, then masks)
+                float distance (gsize index, guint roi) const { return (distances[roi][index]); }
+                guint num_include () const { return (distances.size()); }
+
+              protected:
+                float T[3][4];
+                int dim[3];
+                std::vector<guint32> labels;
+                std::vector<Entry> entries;
+                std::vector<std::vector<float> > distances;
+            };
+
+            //! compute the ROI lookup table and seeding tables for this tracker
+            void precompute ();
+            //! use the precomputed tables of \p tracker, which must have been constructed using the same properties
+            void share_precomputed (const Base& tracker);
+
+
           protected:
-            Image::Interp source;
+            Image::InterpVector source;
             Properties& props;
             Math::RNG rng;
 
             ROISphere spheres;
             ROIMask   masks;
+            RefPtr<ROILookup> roi_lookup;
+            RefPtr<Math::Discrete> seed_selector;
+            RefPtr<SeedGrid> seed_grid;
 
             virtual bool  init_direction (const Point& seed_dir = Point::Invalid) = 0;
             virtual bool  next_point () = 0;
@@ -184,21 +312,49 @@ namespace MR {
             float total_seed_volume, step_size, threshold, init_threshold;
             Point pos, dir;
             int num_points, num_max;
+            guint seeds_per_voxel;
+            guint64 rng_key;
 
             bool excluded, no_mask_interp, stop_when_included, entered_inclusion;
+            // early abandonment of tracks that cannot reach all inclusion ROIs: 
+            bool abandoned, unidirectional, reverse_pending;
+            std::vector<bool> seed_reaches;
+
+            Statistics stats;
+            //! the reason for stopping, set by next_point() if not due to the threshold
+            Statistics::Termination termination;
+            bool timing;
+            Glib::Timer timer;
 
 
             int get_source_data (const Point& p, float* values)
             {
-              if (source.R (p)) return true;
-              for (source.set(3,0); source[3] < source.dim(3); source.inc(3)) values[source[3]] = source.value();
-              return (gsl_isnan (values[0]));
+              double start = timing ? timer.elapsed() : 0.0;
+              bool failed = source.R (p) || source.values (values) || gsl_isnan (values[0]);
+              if (timing) stats.data_time += timer.elapsed() - start;
+              if (failed) termination = Statistics::NoData;
+              return (failed);
             }
 
-            bool not_in_mask (const Point& pt);
+            bool terminate (Statistics::Termination reason) { stats.terminations[reason]++; return (false); }
+
+            const ROILookup::Entry* get_ROI_entry (const Point& pt) const { return (roi_lookup ? (*roi_lookup) (pt) : NULL); }
+
+            bool not_in_mask (const Point& pt) { return (not_in_mask (pt, get_ROI_entry (pt))); }
+            bool not_in_mask (const Point& pt, const ROILookup::Entry* roi);
+            bool in_exclude (const Point& pt, const ROILookup::Entry* roi);
+            void update_included (const Point& pt, const ROILookup::Entry* roi);
+            bool can_reach_includes (gsize voxel) const;
+            void init_reaches ();
 
             Point gen_seed () 
             {
+              if (seed_selector) {
+                guint n = (*seed_selector) (rng);
+                if (n < spheres.seed.size()) return (spheres.seed[n].seed (rng));
+                return (masks.seed[n - spheres.seed.size()].seed (rng));
+              }
+
               float seed_selection = 0.0;
               float seed_selector = total_seed_volume * rng.uniform();
               for (std::vector<Sphere>::iterator i = spheres.seed.begin(); i != spheres.seed.end(); ++i) { 
@@ -221,8 +377,17 @@ namespace MR {
 
 
 
-        inline bool Base::not_in_mask (const Point& pt)
+        inline bool Base::not_in_mask (const Point& pt, const ROILookup::Entry* roi)
         {
+          if (roi) {
+            if (roi->mask.any_out) return (true);
+            for (std::vector<int>::const_iterator i = roi->mask.test_spheres.begin(); i != roi->mask.test_spheres.end(); ++i) 
+              if (!spheres.mask[*i].contains (pt)) return (true);
+            for (std::vector<int>::const_iterator i = roi->mask.test_masks.begin(); i != roi->mask.test_masks.end(); ++i) 
+              if (!masks.mask[*i].contains (pt)) return (true);
+            return (false);
+          }
+
           for (std::vector<Sphere>::const_iterator i = spheres.mask.begin(); i != spheres.mask.end(); ++i) 
             if (!i->contains (pt)) return (true);
 
@@ -233,6 +398,81 @@ namespace MR {
         }
 
 
+
+
+        inline bool Base::in_exclude (const Point& pt, const ROILookup::Entry* roi)
+        {
+          if (roi) {
+            if (roi->exclude.any_in) return (true);
+            for (std::vector<int>::const_iterator i = roi->exclude.test_spheres.begin(); i != roi->exclude.test_spheres.end(); ++i) 
+              if (spheres.exclude[*i].contains (pt)) return (true);
+            for (std::vector<int>::const_iterator i = roi->exclude.test_masks.begin(); i != roi->exclude.test_masks.end(); ++i) 
+              if (masks.exclude[*i].contains (pt)) return (true);
+            return (false);
+          }
+
+          for (std::vector<Sphere>::const_iterator i = spheres.exclude.begin(); i != spheres.exclude.end(); ++i) 
+            if (i->contains (pt)) return (true);
+
+          for (std::vector<Mask>::iterator i = masks.exclude.begin(); i != masks.exclude.end(); ++i) 
+            if (i->contains (pt)) return (true);
+
+          return (false);
+        }
+
+
+
+
+        // the remaining steps of the current pass must bring the track within 
+        // reach of every inclusion ROI not yet visited, unless the reverse 
+        // pass (yet to be tracked from the seed) may reach it instead:
+        inline bool Base::can_reach_includes (gsize voxel) const
+        {
+          const float budget = (num_max - num_points) * step_size;
+          for (guint n = 0; n < roi_lookup->num_include(); n++) {
+            bool included = n < spheres.include.size() ? spheres.include[n].included : masks.include[n - spheres.include.size()].included;
+            if (included || roi_lookup->distance (voxel, n) <= budget) continue;
+            if (reverse_pending && seed_reaches[n]) continue;
+            return (false);
+          }
+          return (true);
+        }
+
+
+
+
+        inline void Base::update_included (const Point& pt, const ROILookup::Entry* roi)
+        {
+          if (roi) {
+            for (std::vector<int>::const_iterator i = roi->include.in_spheres.begin(); i != roi->include.in_spheres.end(); ++i) 
+              if (!spheres.include[*i].included) 
+                spheres.include[*i].included = entered_inclusion = true;
+            for (std::vector<int>::const_iterator i = roi->include.in_masks.begin(); i != roi->include.in_masks.end(); ++i) 
+              if (!masks.include[*i].included) 
+                masks.include[*i].included = entered_inclusion = true;
+            for (std::vector<int>::const_iterator i = roi->include.test_spheres.begin(); i != roi->include.test_spheres.end(); ++i) 
+              if (!spheres.include[*i].included) 
+                if (spheres.include[*i].contains (pt)) 
+                  spheres.include[*i].included = entered_inclusion = true;
+            for (std::vector<int>::const_iterator i = roi->include.test_masks.begin(); i != roi->include.test_masks.end(); ++i) 
+              if (!masks.include[*i].included) 
+                if (masks.include[*i].contains (pt)) 
+                  masks.include[*i].included = entered_inclusion = true;
+            return;
+          }
+
+          for (std::vector<Sphere>::iterator i = spheres.include.begin(); i != spheres.include.end(); ++i) 
+            if (!i->included)
+              if (i->contains (pt)) 
+                i->included = entered_inclusion = true;
+
+          for (std::vector<Mask>::iterator i = masks.include.begin(); i != masks.include.end(); ++i) 
+            if (!i->included) 
+              if (i->contains (pt)) 
+                i->included = entered_inclusion = true;
+        }
+
+
       }
     }
   }
@@ -98,7 +98,10 @@ namespace MR {
           float fa = get_EV (pos);
           if (fa < threshold) return (true);
           fa = dir.dot (prev_dir);
-          if (fabs (fa) < min_dp) return (true);
+          if (fabs (fa) < min_dp) {
+            termination = Statistics::Curvature;
+            return (true);
+          }
           if (fa < 0.0) {
             dir[0] = -dir[0];
             dir[1] = -dir[1];
@@ -68,6 +68,7 @@ namespace MR {
               float val = precomputed ? 
                 SH::value_precomputed (values, dir) : 
                 SH::value (values, dir, lmax);
+              stats.num_trials++;
 
               if (!gsl_isnan (val)) if (val > init_threshold) return (false);
             } 
@@ -87,40 +88,56 @@ namespace MR {
 
 
 
+        void SDProb::get_amplitudes (float* amplitudes, const float* values, const Point* dirs, int num)
+        {
+          if (precomputed) SH::value_precomputed (amplitudes, values, dirs, num);
+          else for (int n = 0; n < num; n++) amplitudes[n] = SH::value (values, dirs[n], lmax);
+        }
+
+
+
+
         bool SDProb::next_point ()
         {
           float values [source.dim(3)];
           if (get_source_data (pos, values)) return (true);
 
-          float max_val = 0.0;
-          for (int n = 0; n < 12; n++) {
-            Point new_dir = new_rand_dir();
-            float val = precomputed ? 
-              SH::value_precomputed (values, new_dir) : 
-              SH::value (values, new_dir, lmax);
+          Point new_dirs [SDPROB_BATCH_SIZE];
+          float vals [SDPROB_BATCH_SIZE];
 
-            if (val > max_val) max_val = val;
-          }
+          for (int n = 0; n < SDPROB_BATCH_SIZE; n++) 
+            new_dirs[n] = new_rand_dir();
+          get_amplitudes (vals, values, new_dirs, SDPROB_BATCH_SIZE);
+          stats.num_trials += SDPROB_BATCH_SIZE;
+
+          float max_val = 0.0;
+          for (int n = 0; n < SDPROB_BATCH_SIZE; n++) 
+            if (vals[n] > max_val) max_val = vals[n];
 
           if (gsl_isnan (max_val)) return (true);
           if (max_val < threshold) return (true);
           max_val *= 1.5;
 
-          for (int n = 0; n < max_trials; n++) {
-            Point new_dir = new_rand_dir();
-            float val = precomputed ? 
-              SH::value_precomputed (values, new_dir) : 
-              SH::value (values, new_dir, lmax);
-
-            if (val > threshold) {
-              if (val > max_val) info ("max_val exceeded!!! (val = " + str(val) + ", max_val = " + str (max_val) + ")");
-              if (rng.uniform() < val/max_val) {
-                dir = new_dir;
-                return (false);
+          for (int n = 0; n < max_trials; n += SDPROB_BATCH_SIZE) {
+            int num = max_trials - n < SDPROB_BATCH_SIZE ? max_trials - n : SDPROB_BATCH_SIZE;
+            for (int i = 0; i < num; i++) 
+              new_dirs[i] = new_rand_dir();
+            get_amplitudes (vals, values, new_dirs, num);
+
+            for (int i = 0; i < num; i++) {
+              stats.num_trials++;
+              if (vals[i] > threshold) {
+                if (vals[i] > max_val) info ("max_val exceeded!!! (val = " + str(vals[i]) + ", max_val = " + str (max_val) + ")");
+                if (rng.uniform() < vals[i]/max_val) {
+                  dir = new_dirs[i];
+                  return (false);
+                }
               }
             }
           }
 
+          // no direction accepted within the cone allowed by the curvature constraint:
+          termination = Statistics::Curvature;
           return (true);
         }
 
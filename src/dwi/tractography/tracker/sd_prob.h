@@ -25,6 +25,8 @@
 
 #include "dwi/tractography/tracker/base.h"
 
+#define SDPROB_BATCH_SIZE 12
+
 namespace MR {
   namespace DWI {
     namespace Tractography {
@@ -43,6 +45,7 @@ namespace MR {
             virtual bool  next_point ();
 
             Point         new_rand_dir ();
+            void          get_amplitudes (float* amplitudes, const float* values, const Point* dirs, int num);
         };
 
 
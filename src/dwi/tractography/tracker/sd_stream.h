@@ -61,7 +61,10 @@ namespace MR {
 
               if (!gsl_finite (val)) return (true);
               if (val < threshold) return (true);
-              if (dir.dot (prev_dir) < min_dp) return (true);
+              if (dir.dot (prev_dir) < min_dp) {
+                termination = Statistics::Curvature;
+                return (true);
+              }
 
               return (false);
             }
@@ -0,0 +1,99 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <fstream>
+#include <glibmm/stringutils.h>
+
+#include "dwi/tractography/tracker/statistics.h"
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Tracker {
+
+        const gchar* Statistics::name (Termination reason) 
+        {
+          static const gchar* names[] = { "no_data", "threshold", "curvature", "mask_exit", "excluded", "max_length", "included", "unreachable" };
+          return (names[reason]);
+        }
+
+
+
+        const gchar* Statistics::name (Outcome outcome) 
+        {
+          static const gchar* names[] = { "accepted", "seed_failed", "excluded", "not_included", "too_short", "abandoned" };
+          return (names[outcome]);
+        }
+
+
+
+
+        void Statistics::write (const String& file, const std::vector<Statistics>& per_thread, double wall_time, bool timed)
+        {
+          std::ofstream out (file.c_str());
+          if (!out) throw Exception ("error creating tracking statistics file \"" + file + "\": " + Glib::strerror (errno));
+
+          Statistics S;
+          for (std::vector<Statistics>::const_iterator i = per_thread.begin(); i != per_thread.end(); ++i) S += *i;
+
+          guint64 num_attempts = 0, num_terminations = 0;
+          for (guint n = 0; n < NumOutcomes; n++) num_attempts += S.outcomes[n];
+          for (guint n = 0; n < NumTerminations; n++) num_terminations += S.terminations[n];
+
+          out << "mrtrix tracking statistics\n";
+          out << "threads: " << per_thread.size() << "\n";
+          out << "wall_time: " << wall_time << "\n";
+          out << "attempts: " << num_attempts << "\n";
+          for (guint n = 0; n < NumOutcomes; n++) 
+            out << "outcome." << name (Outcome (n)) << ": " << S.outcomes[n] << "\n";
+          out << "terminations: " << num_terminations << "\n";
+          for (guint n = 0; n < NumTerminations; n++) 
+            out << "termination." << name (Termination (n)) << ": " << S.terminations[n] << "\n";
+          out << "pruning_ratio: " << ( num_attempts ? S.outcomes[Abandoned] / double (num_attempts) : 0.0 ) << "\n";
+          out << "seeds: " << S.num_seeds << "\n";
+          out << "steps: " << S.num_steps << "\n";
+          out << "steps_per_second: " << ( wall_time > 0.0 ? S.num_steps / wall_time : 0.0 ) << "\n";
+          if (S.num_trials) {
+            out << "trials: " << S.num_trials << "\n";
+            out << "trials_per_step: " << S.num_trials / double (S.num_steps + S.num_seeds) << "\n";
+          }
+
+          if (timed) {
+            out << "time.source_data: " << S.data_time << "\n";
+            out << "time.direction: " << S.direction_time - S.data_time << "\n";
+          }
+          out << "time.thread: " << S.thread_time << "\n";
+
+          for (guint t = 0; t < per_thread.size(); t++) {
+            const Statistics& T (per_thread[t]);
+            out << "thread." << t << ".steps: " << T.num_steps << "\n";
+            out << "thread." << t << ".time: " << T.thread_time << "\n";
+            out << "thread." << t << ".steps_per_second: " << ( T.thread_time > 0.0 ? T.num_steps / T.thread_time : 0.0 ) << "\n";
+          }
+
+          out << "END\n";
+          if (!out.good()) throw Exception ("error writing tracking statistics file \"" + file + "\": " + Glib::strerror (errno));
+        }
+
+      }
+    }
+  }
+}
+
@@ -0,0 +1,109 @@
+/*
+    Copyright 2008 Brain Research Institute, Melbourne, Australia
+
+    This file is part of MRtrix.
+
+    MRtrix is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MRtrix is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MRtrix.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __dwi_tractography_tracker_statistics_h__
+#define __dwi_tractography_tracker_statistics_h__
+
+#include "mrtrix.h"
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Tracker {
+
+        //! counters describing how tracking proceeded within one thread
+        /*! Each tracker updates its own instance, so that no locking is
+         * required; the instances are summed at the end of the run. The
+         * timings are only collected if enabled, since they require two
+         * calls to the system clock per step. */
+        class Statistics {
+          public:
+            //! the reasons for which the propagation of a track may stop
+            enum Termination { 
+              NoData,         //!< outside the source image, or invalid data
+              Threshold,      //!< below the FA / FOD amplitude threshold
+              Curvature,      //!< no direction found within the curvature constraint
+              MaskExit,       //!< left the mask ROI(s)
+              Excluded,       //!< entered an exclusion ROI
+              MaxLength,      //!< reached the maximum length
+              Included,       //!< stopped on entering the inclusion ROI(s)
+              Unreachable,    //!< could no longer reach all inclusion ROIs
+              NumTerminations 
+            };
+
+            //! the fate of each attempt
+            enum Outcome { 
+              Accepted,       //!< passed on for writing
+              SeedFailed,     //!< no valid seed or initial direction (grid seeding only)
+              RejectExcluded, //!< entered an exclusion ROI
+              NotIncluded,    //!< did not traverse all inclusion ROIs
+              TooShort,       //!< shorter than the minimum length
+              Abandoned,      //!< abandoned early, since it could not reach all inclusion ROIs
+              NumOutcomes 
+            };
+
+            Statistics () { reset(); }
+
+            void reset ()
+            {
+              for (guint n = 0; n < NumTerminations; n++) terminations[n] = 0;
+              for (guint n = 0; n < NumOutcomes; n++) outcomes[n] = 0;
+              num_steps = num_seeds = num_trials = 0;
+              data_time = direction_time = thread_time = 0.0;
+            }
+
+            Statistics& operator+= (const Statistics& S)
+            {
+              for (guint n = 0; n < NumTerminations; n++) terminations[n] += S.terminations[n];
+              for (guint n = 0; n < NumOutcomes; n++) outcomes[n] += S.outcomes[n];
+              num_steps += S.num_steps;
+              num_seeds += S.num_seeds;
+              num_trials += S.num_trials;
+              data_time += S.data_time;
+              direction_time += S.direction_time;
+              thread_time += S.thread_time;
+              return (*this);
+            }
+
+            guint64 terminations[NumTerminations], outcomes[NumOutcomes];
+            //! number of steps taken, and of seed points drawn
+            guint64 num_steps, num_seeds;
+            //! number of candidate directions evaluated (probabilistic tracking only)
+            guint64 num_trials;
+            //! time (in seconds) spent fetching source data, computing directions (including fetching the data), and in the tracking thread
+            /*! Only \a thread_time is recorded if per-step timing is disabled. */
+            double data_time, direction_time, thread_time;
+
+            static const gchar* name (Termination reason);
+            static const gchar* name (Outcome outcome);
+
+            //! write the summary for all threads to \p file, as key: value pairs
+            /*! The output can be parsed using File::KeyValue. The per-step
+             * timing entries are omitted if \p timed is false. */
+            static void write (const String& file, const std::vector<Statistics>& per_thread, double wall_time, bool timed);
+        };
+
+      }
+    }
+  }
+}
+
+#endif
+